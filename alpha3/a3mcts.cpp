@@ -1,7 +1,14 @@
 #include <Python.h>
 #include <stddef.h>
 
+#include "channel.h"
+#include "connectk.h"
+#include "inference.h"
 #include "mcts.h"
+#include "replay.h"
+#include "runtime.h"
+#include "selfplay.h"
+#include "treeimage.h"
 
 struct PythonHandle {
   PyObject *object;
@@ -43,6 +50,63 @@ struct PythonHandle {
   bool null() const { return object == NULL; }
 };
 
+// Holds a buffer exported by another object, such as a numpy array
+struct BufferView {
+  Py_buffer view;
+  bool acquired;
+
+  BufferView() : acquired(false) {}
+
+  BufferView(const BufferView &) = delete;
+
+  BufferView &operator=(const BufferView &) = delete;
+
+  ~BufferView() {
+    if (acquired) {
+      PyBuffer_Release(&view);
+    }
+  }
+
+  float *floats() const { return (float *)view.buf; }
+};
+
+// A TreeImage over a buffer exported by another object (an mmap.mmap of the
+// image's file, say), which stays exported for as long as the book is held
+struct OpeningBook {
+  BufferView buffer;
+  TreeImage image;
+};
+
+// Adds the time from its construction until stop (or its destruction) to a
+// counter of nanoseconds, if timing
+struct PhaseTimer {
+  uint64_t *counter;
+  std::chrono::steady_clock::time_point started_at;
+
+  PhaseTimer(bool timing, uint64_t &counter_)
+      : counter(timing ? &counter_ : NULL) {
+    if (counter != NULL) {
+      started_at = std::chrono::steady_clock::now();
+    }
+  }
+
+  PhaseTimer(const PhaseTimer &) = delete;
+
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+  ~PhaseTimer() { stop(); }
+
+  void stop() {
+    if (counter != NULL) {
+      *counter += (uint64_t)std::chrono::duration_cast<
+                      std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - started_at)
+                      .count();
+      counter = NULL;
+    }
+  }
+};
+
 struct TypeSpec {
   const char *name;
   size_t size;
@@ -53,8 +117,143 @@ struct TypeSpec {
 
 static PythonHandle create_type(const TypeSpec *spec);
 
+// Self-play over Python game states, through their moves, play and outcome
+// methods. Every operation calls into the interpreter, so the GIL must be
+// held throughout.
+struct PythonGame {
+  typedef PythonHandle State;
+  typedef PythonHandle Move;
+  typedef PythonHandle Policy;
+
+  static constexpr bool transposable = false;
+
+  State copy(const State &state) { return PythonHandle::copy(state.object); }
+
+  bool outcome(const State &state, bool &terminal, double &av);
+
+  template <class Entry>
+  bool expand(const State &state, const Policy &policy,
+              std::vector<Entry> &expansion);
+
+  bool play(const State &parent, const Move &move, State &state);
+
+  // Moves are saved in tree images as non-negative ints below 2**32
+  bool encode_move(const Move &move, uint32_t &code);
+  bool decode_move(uint32_t code, Move &move);
+};
+
 struct PyMCTS {
   PyObject_HEAD MCTS<PythonHandle, PythonHandle> mcts;
+
+  // The (leaf, state) tuple select_leaf last returned, handed back out for
+  // the next leaf once the caller has let go of it
+  PythonHandle selected;
+
+  // Nanoseconds spent, while timing, in the states' play (through
+  // materialize) and converting leaves and expansions to and from Python
+  uint64_t game_ns;
+  uint64_t marshal_ns;
+};
+
+// A leaf selected from a tree, awaiting expansion. Once expanded, a leaf is
+// spent, and select_leaf may reuse it for another
+struct PyLeaf {
+  PyObject_HEAD PyMCTS *tree;
+  MCTS<PythonHandle, PythonHandle>::Node *node;
+};
+
+struct PySelfPlayEngine {
+  PyObject_HEAD SelfPlayEngine<PythonGame> engine;
+  std::unique_ptr<OpeningBook> book;
+
+  // Nanoseconds spent, while timing, converting evaluations and states
+  uint64_t marshal_ns;
+};
+
+// Self-play of natively implemented Connect-K. Steps run without the GIL, so
+// an engine must not be shared between Python threads
+struct PyConnectKEngine {
+  PyObject_HEAD ConnectKRules rules;
+  SelfPlayEngine<ConnectKRules> engine;
+  std::unique_ptr<OpeningBook> book;
+
+  // Nanoseconds spent, while timing, reading evaluations, writing features
+  // and converting results
+  uint64_t marshal_ns;
+};
+
+// Self-play of natively implemented Connect-K over a pool of native threads,
+// which exchange batches through slots of an evaluation channel themselves.
+// Holds a reference to the channel for as long as the runtime exists
+struct PyConnectKRuntime {
+  PyObject_HEAD PythonHandle channel;
+  ConnectKRules rules;
+  std::unique_ptr<SelfPlayRuntime<ConnectKRules>> runtime;
+  std::unique_ptr<OpeningBook> book;
+};
+
+// Inserts and samples run without the GIL, and may come from any number of
+// Python threads at once
+struct PyReplayBuffer {
+  PyObject_HEAD ReplayRing ring;
+
+  std::mutex generator_mutex;
+  std::default_random_engine generator;
+};
+
+// A view of an EvaluationChannel in memory exported by another object, such
+// as a multiprocessing.shared_memory.SharedMemory's buf, which stays exported
+// until the channel is destroyed. Waits run without the GIL
+struct PyEvaluationChannel {
+  PyObject_HEAD BufferView memory;
+  EvaluationChannel channel;
+};
+
+// Evaluates batches for an InferenceScheduler through a Python callable,
+//
+//   evaluate(stream, features, values, policies)
+//
+// given memoryviews of float32, shaped (n, features), (n,) and (n,
+// policy_width), of which only features is read-only. The views are
+// released when the call returns. Each call takes the GIL.
+struct PythonBackend : InferenceBackend {
+  PythonHandle evaluate_;
+  size_t n_features;
+  size_t policy_width;
+
+  // The first exception raised by an evaluation, for check to raise again
+  PyObject *error_type = NULL;
+  PyObject *error_value = NULL;
+  PyObject *error_traceback = NULL;
+
+  PythonBackend(PythonHandle evaluate, size_t n_features_,
+                size_t policy_width_)
+      : evaluate_(std::move(evaluate)), n_features(n_features_),
+        policy_width(policy_width_) {}
+
+  ~PythonBackend() {
+    Py_XDECREF(error_type);
+    Py_XDECREF(error_value);
+    Py_XDECREF(error_traceback);
+  }
+
+  bool evaluate(size_t stream, size_t n, const float *features,
+                float *values, float *policies) override;
+
+private:
+  bool evaluate_locked(size_t stream, size_t n, const float *features,
+                       float *values, float *policies);
+
+  // Take the raised exception, unless one was kept already
+  void keep_error();
+};
+
+// Serves an EvaluationChannel through a Python backend, holding a reference
+// to the channel for as long as it runs
+struct PyInferenceScheduler {
+  PyObject_HEAD PythonHandle channel;
+  PythonBackend backend;
+  std::unique_ptr<InferenceScheduler> scheduler;
 };
 
 static PyObject *mcts_create(PyTypeObject *type, PyObject *args,
@@ -68,15 +267,35 @@ static PyObject *mcts_complete(PyObject *self, PyObject *args);
 static PyObject *mcts_collected(PyObject *self, PyObject *args);
 static PyObject *mcts_turns(PyObject *self, PyObject *args);
 static PyObject *mcts_searches_this_turn(PyObject *self, PyObject *args);
+static PyObject *mcts_set_node_budget(PyObject *self, PyObject *args,
+                                      PyObject *kwargs);
+static PyObject *mcts_memory_stats(PyObject *self, PyObject *args);
+static PyObject *mcts_set_timing(PyObject *self, PyObject *args,
+                                 PyObject *kwargs);
+static PyObject *mcts_search_stats(PyObject *self, PyObject *args);
+static PyObject *mcts_decided(PyObject *self, PyObject *args,
+                              PyObject *kwargs);
 static PyObject *mcts_add_dirichlet_noise(PyObject *self, PyObject *args,
                                           PyObject *kwargs);
 static PyObject *mcts_select_leaf(PyObject *self, PyObject *args);
-static PyObject *mcts_expand_leaf(PyObject *self, PyObject *args,
-                                  PyObject *kwargs);
+static PyObject *mcts_select_leaves(PyObject *self, PyObject *args,
+                                    PyObject *kwargs);
+static PyObject *mcts_expand_leaf(PyObject *self, PyObject *const *args,
+                                  Py_ssize_t nargs, PyObject *kwnames);
+static PyObject *mcts_expand_leaves(PyObject *self, PyObject *const *args,
+                                    Py_ssize_t nargs, PyObject *kwnames);
+static PyObject *mcts_expand_leaf_dense(PyObject *self, PyObject *const *args,
+                                        Py_ssize_t nargs, PyObject *kwnames);
+static PyObject *mcts_add_gumbel_noise(PyObject *self, PyObject *args,
+                                       PyObject *kwargs);
 static PyObject *mcts_move_greedy(PyObject *self, PyObject *args);
 static PyObject *mcts_move_proportional(PyObject *self, PyObject *args);
+static PyObject *mcts_move_gumbel(PyObject *self, PyObject *args);
 static PyObject *mcts_collect_result(PyObject *self, PyObject *args);
 static PyObject *mcts_reset(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *mcts_image(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *mcts_load_image(PyObject *self, PyObject *args,
+                                 PyObject *kwargs);
 
 static PyMethodDef mcts_methods[] = {
     {"game_state", mcts_game_state, METH_NOARGS, NULL},
@@ -85,25 +304,319 @@ static PyMethodDef mcts_methods[] = {
     {"collected", mcts_collected, METH_NOARGS, NULL},
     {"turns", mcts_turns, METH_NOARGS, NULL},
     {"searches_this_turn", mcts_searches_this_turn, METH_NOARGS, NULL},
+    {"set_node_budget", (PyCFunction)mcts_set_node_budget,
+     METH_VARARGS | METH_KEYWORDS, NULL},
+    {"memory_stats", mcts_memory_stats, METH_NOARGS, NULL},
+    {"set_timing", (PyCFunction)mcts_set_timing, METH_VARARGS | METH_KEYWORDS,
+     NULL},
+    {"search_stats", mcts_search_stats, METH_NOARGS, NULL},
+    {"decided", (PyCFunction)mcts_decided, METH_VARARGS | METH_KEYWORDS,
+     NULL},
     {"add_dirichlet_noise", (PyCFunction)mcts_add_dirichlet_noise,
      METH_VARARGS | METH_KEYWORDS, NULL},
     {"select_leaf", mcts_select_leaf, METH_NOARGS, NULL},
-    {"expand_leaf", (PyCFunction)mcts_expand_leaf, METH_VARARGS | METH_KEYWORDS,
-     NULL},
+    {"select_leaves", (PyCFunction)mcts_select_leaves,
+     METH_VARARGS | METH_KEYWORDS, NULL},
+    {"expand_leaf", (PyCFunction)(void (*)(void))mcts_expand_leaf,
+     METH_FASTCALL | METH_KEYWORDS, NULL},
+    {"expand_leaves", (PyCFunction)(void (*)(void))mcts_expand_leaves,
+     METH_FASTCALL | METH_KEYWORDS, NULL},
+    {"expand_leaf_dense", (PyCFunction)(void (*)(void))mcts_expand_leaf_dense,
+     METH_FASTCALL | METH_KEYWORDS, NULL},
     {"move_greedy", mcts_move_greedy, METH_NOARGS, NULL},
     {"move_proportional", mcts_move_proportional, METH_NOARGS, NULL},
+    {"add_gumbel_noise", (PyCFunction)mcts_add_gumbel_noise,
+     METH_VARARGS | METH_KEYWORDS, NULL},
+    {"move_gumbel", mcts_move_gumbel, METH_NOARGS, NULL},
     {"collect_result", mcts_collect_result, METH_NOARGS, NULL},
     {"reset", (PyCFunction)mcts_reset, METH_VARARGS | METH_KEYWORDS, NULL},
+    {"image", (PyCFunction)mcts_image, METH_VARARGS | METH_KEYWORDS, NULL},
+    {"load_image", (PyCFunction)mcts_load_image, METH_VARARGS | METH_KEYWORDS,
+     NULL},
     {NULL, NULL, -1, NULL}};
 
 const static TypeSpec mcts_typespec = {"MCTS", sizeof(PyMCTS), mcts_create,
                                        mcts_destroy, mcts_methods};
 
+static PyObject *leaf_create(PyTypeObject *type, PyObject *args,
+                             PyObject *kwargs);
+
+static void leaf_destroy(PyObject *self);
+
+static PyMethodDef leaf_methods[] = {{NULL, NULL, -1, NULL}};
+
+const static TypeSpec leaf_typespec = {"Leaf", sizeof(PyLeaf), leaf_create,
+                                       leaf_destroy, leaf_methods};
+
+// Set once the module is initialized, to check the leaves given to trees
+static PyTypeObject *leaf_type_object = NULL;
+
+static PyObject *engine_create(PyTypeObject *type, PyObject *args,
+                               PyObject *kwargs);
+
+static void engine_destroy(PyObject *self);
+
+static PyObject *engine_step(PyObject *self, PyObject *args,
+                             PyObject *kwargs);
+static PyObject *engine_results(PyObject *self, PyObject *args);
+static PyObject *engine_memory_stats(PyObject *self, PyObject *args);
+static PyObject *engine_set_timing(PyObject *self, PyObject *args,
+                                   PyObject *kwargs);
+static PyObject *engine_search_stats(PyObject *self, PyObject *args);
+static PyObject *engine_set_opening_book(PyObject *self, PyObject *args,
+                                         PyObject *kwargs);
+
+static PyMethodDef engine_methods[] = {
+    {"step", (PyCFunction)engine_step, METH_VARARGS | METH_KEYWORDS, NULL},
+    {"results", engine_results, METH_NOARGS, NULL},
+    {"memory_stats", engine_memory_stats, METH_NOARGS, NULL},
+    {"set_timing", (PyCFunction)engine_set_timing,
+     METH_VARARGS | METH_KEYWORDS, NULL},
+    {"search_stats", engine_search_stats, METH_NOARGS, NULL},
+    {"set_opening_book", (PyCFunction)engine_set_opening_book,
+     METH_VARARGS | METH_KEYWORDS, NULL},
+    {NULL, NULL, -1, NULL}};
+
+const static TypeSpec engine_typespec = {
+    "SelfPlayEngine", sizeof(PySelfPlayEngine), engine_create, engine_destroy,
+    engine_methods};
+
+static PyObject *connectk_engine_create(PyTypeObject *type, PyObject *args,
+                                        PyObject *kwargs);
+
+static void connectk_engine_destroy(PyObject *self);
+
+static PyObject *connectk_engine_step(PyObject *self, PyObject *args,
+                                      PyObject *kwargs);
+static PyObject *connectk_engine_features(PyObject *self, PyObject *args,
+                                          PyObject *kwargs);
+static PyObject *connectk_engine_batch_size(PyObject *self, PyObject *args);
+static PyObject *connectk_engine_feature_shape(PyObject *self,
+                                               PyObject *args);
+static PyObject *connectk_engine_results(PyObject *self, PyObject *args);
+static PyObject *connectk_engine_results_packed(PyObject *self,
+                                                PyObject *args);
+static PyObject *connectk_engine_set_generation(PyObject *self,
+                                                PyObject *args,
+                                                PyObject *kwargs);
+static PyObject *connectk_engine_transposition_stats(PyObject *self,
+                                                     PyObject *args);
+static PyObject *connectk_engine_memory_stats(PyObject *self, PyObject *args);
+static PyObject *connectk_engine_set_timing(PyObject *self, PyObject *args,
+                                            PyObject *kwargs);
+static PyObject *connectk_engine_search_stats(PyObject *self,
+                                              PyObject *args);
+static PyObject *connectk_engine_set_opening_book(PyObject *self,
+                                                  PyObject *args,
+                                                  PyObject *kwargs);
+
+static PyMethodDef connectk_engine_methods[] = {
+    {"step", (PyCFunction)connectk_engine_step, METH_VARARGS | METH_KEYWORDS,
+     NULL},
+    {"features", (PyCFunction)connectk_engine_features,
+     METH_VARARGS | METH_KEYWORDS, NULL},
+    {"batch_size", connectk_engine_batch_size, METH_NOARGS, NULL},
+    {"feature_shape", connectk_engine_feature_shape, METH_NOARGS, NULL},
+    {"results", connectk_engine_results, METH_NOARGS, NULL},
+    {"results_packed", connectk_engine_results_packed, METH_NOARGS, NULL},
+    {"set_generation", (PyCFunction)connectk_engine_set_generation,
+     METH_VARARGS | METH_KEYWORDS, NULL},
+    {"transposition_stats", connectk_engine_transposition_stats, METH_NOARGS,
+     NULL},
+    {"memory_stats", connectk_engine_memory_stats, METH_NOARGS, NULL},
+    {"set_timing", (PyCFunction)connectk_engine_set_timing,
+     METH_VARARGS | METH_KEYWORDS, NULL},
+    {"search_stats", connectk_engine_search_stats, METH_NOARGS, NULL},
+    {"set_opening_book", (PyCFunction)connectk_engine_set_opening_book,
+     METH_VARARGS | METH_KEYWORDS, NULL},
+    {NULL, NULL, -1, NULL}};
+
+const static TypeSpec connectk_engine_typespec = {
+    "ConnectKSelfPlayEngine", sizeof(PyConnectKEngine), connectk_engine_create,
+    connectk_engine_destroy, connectk_engine_methods};
+
+static PyObject *runtime_create(PyTypeObject *type, PyObject *args,
+                                PyObject *kwargs);
+
+static void runtime_destroy(PyObject *self);
+
+static PyObject *runtime_start(PyObject *self, PyObject *args);
+static PyObject *runtime_stop(PyObject *self, PyObject *args);
+static PyObject *runtime_wait(PyObject *self, PyObject *args,
+                              PyObject *kwargs);
+static PyObject *runtime_results_packed(PyObject *self, PyObject *args);
+static PyObject *runtime_transposition_stats(PyObject *self, PyObject *args);
+static PyObject *runtime_memory_stats(PyObject *self, PyObject *args);
+static PyObject *runtime_set_timing(PyObject *self, PyObject *args,
+                                    PyObject *kwargs);
+static PyObject *runtime_search_stats(PyObject *self, PyObject *args);
+static PyObject *runtime_wait_ns(PyObject *self, PyObject *args);
+static PyObject *runtime_latency_counts(PyObject *self, PyObject *args);
+static PyObject *runtime_set_opening_book(PyObject *self, PyObject *args,
+                                          PyObject *kwargs);
+
+static PyMethodDef runtime_methods[] = {
+    {"start", runtime_start, METH_NOARGS, NULL},
+    {"stop", runtime_stop, METH_NOARGS, NULL},
+    {"wait", (PyCFunction)runtime_wait, METH_VARARGS | METH_KEYWORDS, NULL},
+    {"results_packed", runtime_results_packed, METH_NOARGS, NULL},
+    {"transposition_stats", runtime_transposition_stats, METH_NOARGS, NULL},
+    {"memory_stats", runtime_memory_stats, METH_NOARGS, NULL},
+    {"set_timing", (PyCFunction)runtime_set_timing,
+     METH_VARARGS | METH_KEYWORDS, NULL},
+    {"search_stats", runtime_search_stats, METH_NOARGS, NULL},
+    {"wait_ns", runtime_wait_ns, METH_NOARGS, NULL},
+    {"latency_counts", runtime_latency_counts, METH_NOARGS, NULL},
+    {"set_opening_book", (PyCFunction)runtime_set_opening_book,
+     METH_VARARGS | METH_KEYWORDS, NULL},
+    {NULL, NULL, -1, NULL}};
+
+const static TypeSpec runtime_typespec = {
+    "ConnectKSelfPlayRuntime", sizeof(PyConnectKRuntime), runtime_create,
+    runtime_destroy, runtime_methods};
+
+static PyObject *replay_buffer_create(PyTypeObject *type, PyObject *args,
+                                      PyObject *kwargs);
+
+static void replay_buffer_destroy(PyObject *self);
+
+static PyObject *replay_buffer_insert(PyObject *self, PyObject *args,
+                                      PyObject *kwargs);
+static PyObject *replay_buffer_sample(PyObject *self, PyObject *args,
+                                      PyObject *kwargs);
+static PyObject *replay_buffer_size(PyObject *self, PyObject *args);
+static PyObject *replay_buffer_record_size(PyObject *self, PyObject *args);
+
+static PyMethodDef replay_buffer_methods[] = {
+    {"insert", (PyCFunction)replay_buffer_insert, METH_VARARGS | METH_KEYWORDS,
+     NULL},
+    {"sample", (PyCFunction)replay_buffer_sample, METH_VARARGS | METH_KEYWORDS,
+     NULL},
+    {"size", replay_buffer_size, METH_NOARGS, NULL},
+    {"record_size", replay_buffer_record_size, METH_NOARGS, NULL},
+    {NULL, NULL, -1, NULL}};
+
+const static TypeSpec replay_buffer_typespec = {
+    "ReplayBuffer", sizeof(PyReplayBuffer), replay_buffer_create,
+    replay_buffer_destroy, replay_buffer_methods};
+
+static PyObject *channel_create(PyTypeObject *type, PyObject *args,
+                                PyObject *kwargs);
+
+static void channel_destroy(PyObject *self);
+
+static PyObject *channel_nbytes(PyObject *self, PyObject *args,
+                                PyObject *kwargs);
+static PyObject *channel_offsets(PyObject *self, PyObject *args,
+                                 PyObject *kwargs);
+static PyObject *channel_request(PyObject *self, PyObject *args,
+                                 PyObject *kwargs);
+static PyObject *channel_wait_response(PyObject *self, PyObject *args,
+                                       PyObject *kwargs);
+static PyObject *channel_wait_requests(PyObject *self, PyObject *args,
+                                       PyObject *kwargs);
+static PyObject *channel_respond(PyObject *self, PyObject *args,
+                                 PyObject *kwargs);
+static PyObject *channel_close(PyObject *self, PyObject *args);
+static PyObject *channel_closed(PyObject *self, PyObject *args);
+
+static PyMethodDef channel_methods[] = {
+    {"nbytes", (PyCFunction)channel_nbytes,
+     METH_VARARGS | METH_KEYWORDS | METH_STATIC, NULL},
+    {"offsets", (PyCFunction)channel_offsets, METH_VARARGS | METH_KEYWORDS,
+     NULL},
+    {"request", (PyCFunction)channel_request, METH_VARARGS | METH_KEYWORDS,
+     NULL},
+    {"wait_response", (PyCFunction)channel_wait_response,
+     METH_VARARGS | METH_KEYWORDS, NULL},
+    {"wait_requests", (PyCFunction)channel_wait_requests,
+     METH_VARARGS | METH_KEYWORDS, NULL},
+    {"respond", (PyCFunction)channel_respond, METH_VARARGS | METH_KEYWORDS,
+     NULL},
+    {"close", channel_close, METH_NOARGS, NULL},
+    {"closed", channel_closed, METH_NOARGS, NULL},
+    {NULL, NULL, -1, NULL}};
+
+const static TypeSpec channel_typespec = {
+    "EvaluationChannel", sizeof(PyEvaluationChannel), channel_create,
+    channel_destroy, channel_methods};
+
+// Set once the module is initialized, to check the channels given to
+// schedulers
+static PyTypeObject *channel_type_object = NULL;
+
+static PyObject *scheduler_create(PyTypeObject *type, PyObject *args,
+                                  PyObject *kwargs);
+
+static void scheduler_destroy(PyObject *self);
+
+static PyObject *scheduler_set_generation(PyObject *self, PyObject *args,
+                                          PyObject *kwargs);
+static PyObject *scheduler_stats(PyObject *self, PyObject *args);
+static PyObject *scheduler_failed(PyObject *self, PyObject *args);
+static PyObject *scheduler_check(PyObject *self, PyObject *args);
+static PyObject *scheduler_stop(PyObject *self, PyObject *args);
+
+static PyMethodDef scheduler_methods[] = {
+    {"set_generation", (PyCFunction)scheduler_set_generation,
+     METH_VARARGS | METH_KEYWORDS, NULL},
+    {"stats", scheduler_stats, METH_NOARGS, NULL},
+    {"failed", scheduler_failed, METH_NOARGS, NULL},
+    {"check", scheduler_check, METH_NOARGS, NULL},
+    {"stop", scheduler_stop, METH_NOARGS, NULL},
+    {NULL, NULL, -1, NULL}};
+
+const static TypeSpec scheduler_typespec = {
+    "InferenceScheduler", sizeof(PyInferenceScheduler), scheduler_create,
+    scheduler_destroy, scheduler_methods};
+
 static PyModuleDef module_defn = {
     PyModuleDef_HEAD_INIT, "a3mcts", NULL, 0, NULL, NULL, NULL, NULL, NULL};
 
 static bool assert_tuple_length(PyObject *tuple, size_t length);
 
+static PythonHandle leaf_to_tuple(PyMCTS *tree,
+                                  MCTS<PythonHandle, PythonHandle>::Node *leaf);
+
+static PythonHandle
+reuse_leaf_tuple(PyMCTS *tree, MCTS<PythonHandle, PythonHandle>::Node *leaf);
+
+static PyLeaf *parse_leaf(PyMCTS *tree, PyObject *leaf_object);
+
+static bool parse_fastcall(PyObject *const *args, Py_ssize_t nargs,
+                           PyObject *kwnames, const char *const *keyword_names,
+                           PyObject **values);
+
+static bool parse_expansion(
+    PyObject *expansion_sequence,
+    std::vector<MCTS<PythonHandle, PythonHandle>::ExpansionEntry> &expansion);
+
+static PythonHandle history_to_list(
+    std::vector<MCTS<PythonHandle, PythonHandle>::HistoryEntry> &history);
+
+static bool materialize(MCTS<PythonHandle, PythonHandle> &mcts,
+                        MCTS<PythonHandle, PythonHandle>::Node *node);
+
+static PythonHandle features_to_bytes(const ConnectKRules &rules,
+                                      const BitboardConnectK &state);
+static PythonHandle
+result_to_records(const ConnectKRules &rules,
+                  const SelfPlayEngine<ConnectKRules>::Result &result);
+static bool parse_slot(const EvaluationChannel &channel, Py_ssize_t slot);
+
+static bool get_float_buffer(PyObject *object, bool writable, size_t length,
+                             BufferView &buffer);
+
+static bool open_book(PyObject *object, OpeningBook &book);
+
+template <class Engine>
+static PyObject *set_opening_book(Engine &engine,
+                                  std::unique_ptr<OpeningBook> &book,
+                                  PyObject *args, PyObject *kwargs);
+
+static PythonHandle float_view(const float *floats, size_t rows,
+                               size_t columns, bool writable);
+
 template <class Iterator, class Fn>
 static PythonHandle iterator_to_list(Iterator begin, Iterator end, Fn fn) {
   PythonHandle list(PyList_New((Py_ssize_t)(end - begin)));
@@ -123,6 +636,51 @@ static PythonHandle iterator_to_list(Iterator begin, Iterator end, Fn fn) {
   return list;
 }
 
+template <class MemoryStats>
+static PyObject *memory_stats_to_dict(const MemoryStats &stats) {
+  return Py_BuildValue(
+      "{s:n,s:n,s:n,s:n,s:n,s:K,s:K}", "live_nodes",
+      (Py_ssize_t)stats.live_nodes, "reused_nodes",
+      (Py_ssize_t)stats.reused_nodes, "pruned_nodes",
+      (Py_ssize_t)stats.pruned_nodes, "live_bytes",
+      (Py_ssize_t)stats.live_bytes, "free_bytes", (Py_ssize_t)stats.free_bytes,
+      "allocated_blocks", (unsigned long long)stats.allocated_blocks,
+      "recycled_blocks", (unsigned long long)stats.recycled_blocks);
+}
+
+template <class SearchStats>
+static PyObject *search_stats_to_dict(const SearchStats &stats,
+                                      uint64_t game_ns, uint64_t marshal_ns) {
+  return Py_BuildValue(
+      "{s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K}", "searches",
+      (unsigned long long)stats.searches, "descents",
+      (unsigned long long)stats.descents, "depth",
+      (unsigned long long)stats.depth, "terminal_hits",
+      (unsigned long long)stats.terminal_hits, "collisions",
+      (unsigned long long)stats.collisions, "select_ns",
+      (unsigned long long)stats.select_ns, "expand_ns",
+      (unsigned long long)stats.expand_ns, "backup_ns",
+      (unsigned long long)stats.backup_ns, "game_ns",
+      (unsigned long long)game_ns, "marshal_ns",
+      (unsigned long long)marshal_ns);
+}
+
+// Parse the enabled argument of set_timing
+static bool parse_timing(PyObject *args, PyObject *kwargs, bool &timing) {
+  static char enabled_str[] = "enabled";
+  static char *keyword_names[] = {enabled_str, NULL};
+
+  int enabled = 1;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|p", keyword_names,
+                                   &enabled)) {
+    return false;
+  }
+
+  timing = enabled != 0;
+  return true;
+}
+
 extern "C" PyObject *PyInit_a3mcts(void) {
   PythonHandle module(PyModule_Create(&module_defn));
 
@@ -143,6 +701,97 @@ extern "C" PyObject *PyInit_a3mcts(void) {
 
   mcts_type.steal();
 
+  PythonHandle leaf_type(create_type(&leaf_typespec));
+
+  if (leaf_type.null()) {
+    return NULL;
+  }
+
+  if (PyModule_AddObject(module.object, leaf_typespec.name, leaf_type.object) <
+      0) {
+    return NULL;
+  }
+
+  leaf_type_object = (PyTypeObject *)leaf_type.steal();
+
+  PythonHandle engine_type(create_type(&engine_typespec));
+
+  if (engine_type.null()) {
+    return NULL;
+  }
+
+  if (PyModule_AddObject(module.object, engine_typespec.name,
+                         engine_type.object) < 0) {
+    return NULL;
+  }
+
+  engine_type.steal();
+
+  PythonHandle connectk_engine_type(create_type(&connectk_engine_typespec));
+
+  if (connectk_engine_type.null()) {
+    return NULL;
+  }
+
+  if (PyModule_AddObject(module.object, connectk_engine_typespec.name,
+                         connectk_engine_type.object) < 0) {
+    return NULL;
+  }
+
+  connectk_engine_type.steal();
+
+  PythonHandle runtime_type(create_type(&runtime_typespec));
+
+  if (runtime_type.null()) {
+    return NULL;
+  }
+
+  if (PyModule_AddObject(module.object, runtime_typespec.name,
+                         runtime_type.object) < 0) {
+    return NULL;
+  }
+
+  runtime_type.steal();
+
+  PythonHandle replay_buffer_type(create_type(&replay_buffer_typespec));
+
+  if (replay_buffer_type.null()) {
+    return NULL;
+  }
+
+  if (PyModule_AddObject(module.object, replay_buffer_typespec.name,
+                         replay_buffer_type.object) < 0) {
+    return NULL;
+  }
+
+  replay_buffer_type.steal();
+
+  PythonHandle channel_type(create_type(&channel_typespec));
+
+  if (channel_type.null()) {
+    return NULL;
+  }
+
+  if (PyModule_AddObject(module.object, channel_typespec.name,
+                         channel_type.object) < 0) {
+    return NULL;
+  }
+
+  channel_type_object = (PyTypeObject *)channel_type.steal();
+
+  PythonHandle scheduler_type(create_type(&scheduler_typespec));
+
+  if (scheduler_type.null()) {
+    return NULL;
+  }
+
+  if (PyModule_AddObject(module.object, scheduler_typespec.name,
+                         scheduler_type.object) < 0) {
+    return NULL;
+  }
+
+  scheduler_type.steal();
+
   return module.steal();
 }
 
@@ -197,6 +846,10 @@ static PyObject *mcts_create(PyTypeObject *type, PyObject *args,
     return NULL;
   }
 
+  new (&((PyMCTS *)self.object)->selected) PythonHandle();
+  ((PyMCTS *)self.object)->game_ns = 0;
+  ((PyMCTS *)self.object)->marshal_ns = 0;
+
   void *location = &((PyMCTS *)self.object)->mcts;
 
   try {
@@ -214,12 +867,35 @@ static PyObject *mcts_create(PyTypeObject *type, PyObject *args,
 static void mcts_destroy(PyObject *self) {
   auto &mcts = ((PyMCTS *)self)->mcts;
   mcts.~MCTS();
+  ((PyMCTS *)self)->selected.~PythonHandle();
   Py_TYPE(self)->tp_free(self);
 }
 
+static PyObject *leaf_create(PyTypeObject *type, PyObject *args,
+                             PyObject *kwargs) {
+  (void)type;
+  (void)args;
+  (void)kwargs;
+
+  PyErr_SetString(PyExc_TypeError, "leaves are only made by selection");
+  return NULL;
+}
+
+static void leaf_destroy(PyObject *self) { Py_TYPE(self)->tp_free(self); }
+
 static PyObject *mcts_game_state(PyObject *self, PyObject *args) {
   (void)args;
   auto &mcts = ((PyMCTS *)self)->mcts;
+
+  if (mcts.collected()) {
+    PyErr_SetString(PyExc_RuntimeError, "results were already collected");
+    return NULL;
+  }
+
+  if (!materialize(mcts, NULL)) {
+    return NULL;
+  }
+
   auto game_state = PythonHandle::copy(mcts.game_state().object);
   return game_state.steal();
 }
@@ -281,274 +957,468 @@ static PyObject *mcts_searches_this_turn(PyObject *self, PyObject *args) {
   return PyLong_FromSize_t(mcts.searches_this_turn());
 }
 
-static PyObject *mcts_add_dirichlet_noise(PyObject *self, PyObject *args,
-                                          PyObject *kwargs) {
-  static char alpha_str[] = "alpha";
-  static char fraction_str[] = "fraction";
-  static char *keyword_names[] = {alpha_str, fraction_str, NULL};
+static PyObject *mcts_set_node_budget(PyObject *self, PyObject *args,
+                                      PyObject *kwargs) {
+  static char budget_str[] = "budget";
+  static char *keyword_names[] = {budget_str, NULL};
 
-  double alpha;
-  double fraction;
+  Py_ssize_t budget;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "dd", keyword_names, &alpha, &fraction)) {
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n", keyword_names,
+                                   &budget)) {
     return NULL;
   }
 
-  auto &mcts = ((PyMCTS *)self)->mcts;
-
-  try {
-    mcts.add_dirichlet_noise(alpha, fraction);
-  } catch (std::bad_alloc &) {
-    PyErr_NoMemory();
+  if (budget < 0) {
+    PyErr_SetString(PyExc_ValueError, "budget must be non-negative");
     return NULL;
   }
 
+  ((PyMCTS *)self)->mcts.set_node_budget((size_t)budget);
+
   Py_RETURN_NONE;
 }
 
-static PyObject *mcts_select_leaf(PyObject *self, PyObject *args) {
+static PyObject *mcts_memory_stats(PyObject *self, PyObject *args) {
   (void)args;
-  auto &mcts = ((PyMCTS *)self)->mcts;
-
-  auto leaf = mcts.select_leaf();
-
-  if (leaf == NULL) {
-    Py_RETURN_NONE;
-  }
-
-  PythonHandle capsule(PyCapsule_New((void *)leaf, "Node", NULL));
-
-  if (capsule.null()) {
-    return NULL;
-  }
-
-  auto game_state = PythonHandle::copy(leaf->state().object);
+  return memory_stats_to_dict(((PyMCTS *)self)->mcts.memory_stats());
+}
 
-  PythonHandle tuple(PyTuple_New(2));
+static PyObject *mcts_set_timing(PyObject *self, PyObject *args,
+                                 PyObject *kwargs) {
+  bool timing;
 
-  if (tuple.null()) {
+  if (!parse_timing(args, kwargs, timing)) {
     return NULL;
   }
 
-  PyTuple_SET_ITEM(tuple.object, 0, capsule.steal());
-  PyTuple_SET_ITEM(tuple.object, 1, game_state.steal());
+  ((PyMCTS *)self)->mcts.set_timing(timing);
 
-  return tuple.steal();
+  Py_RETURN_NONE;
 }
 
-static PyObject *mcts_expand_leaf(PyObject *self, PyObject *args,
-                                  PyObject *kwargs) {
-  PyObject *leaf_capsule;
-  double av;
-  PyObject *expansion_sequence;
+static PyObject *mcts_search_stats(PyObject *self, PyObject *args) {
+  (void)args;
+  auto tree = (PyMCTS *)self;
+  return search_stats_to_dict(tree->mcts.search_stats(), tree->game_ns,
+                              tree->marshal_ns);
+}
 
-  static char leaf_str[] = "leaf";
-  static char av_str[] = "av";
-  static char expansion_str[] = "expansion";
+static PyObject *mcts_decided(PyObject *self, PyObject *args,
+                              PyObject *kwargs) {
+  static char remaining_str[] = "remaining";
+  static char *keyword_names[] = {remaining_str, NULL};
 
-  static char *keyword_names[] = {leaf_str, av_str, expansion_str, NULL};
+  Py_ssize_t remaining;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OdO", keyword_names,
-                                   &leaf_capsule, &av, &expansion_sequence)) {
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n", keyword_names,
+                                   &remaining)) {
     return NULL;
   }
 
-  if (!PyCapsule_CheckExact(leaf_capsule)) {
-    PyErr_SetString(PyExc_TypeError, "bad leaf argument");
+  if (remaining < 0) {
+    PyErr_SetString(PyExc_ValueError, "remaining must be non-negative");
     return NULL;
   }
 
-  auto leaf = (MCTS<PythonHandle, PythonHandle>::Node *)PyCapsule_GetPointer(
-      leaf_capsule, "Node");
+  auto &mcts = ((PyMCTS *)self)->mcts;
 
-  if (leaf == NULL) {
+  if (mcts.collected()) {
+    PyErr_SetString(PyExc_RuntimeError, "results were already collected");
     return NULL;
   }
 
-  PythonHandle expansion_iter(PyObject_GetIter(expansion_sequence));
+  return PyBool_FromLong(mcts.decided((size_t)remaining));
+}
+
+static PyObject *mcts_add_dirichlet_noise(PyObject *self, PyObject *args,
+                                          PyObject *kwargs) {
+  static char alpha_str[] = "alpha";
+  static char fraction_str[] = "fraction";
+  static char *keyword_names[] = {alpha_str, fraction_str, NULL};
+
+  double alpha;
+  double fraction;
 
-  if (expansion_iter.null()) {
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "dd", keyword_names, &alpha, &fraction)) {
     return NULL;
   }
 
-  std::vector<MCTS<PythonHandle, PythonHandle>::ExpansionEntry> expansion;
+  auto &mcts = ((PyMCTS *)self)->mcts;
 
-  for (;;) {
-    PythonHandle expansion_elem(PyIter_Next(expansion_iter.object));
+  try {
+    mcts.add_dirichlet_noise(alpha, fraction);
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
 
-    if (expansion_elem.null()) {
-      break;
-    }
+  Py_RETURN_NONE;
+}
 
-    if (!assert_tuple_length(expansion_elem.object, 3)) {
-      return NULL;
-    }
+static PyObject *mcts_select_leaf(PyObject *self, PyObject *args) {
+  (void)args;
+  auto &mcts = ((PyMCTS *)self)->mcts;
+
+  auto tree = (PyMCTS *)self;
 
-    PyObject *move;
-    PyObject *game_state;
-    double prior_probability;
+  auto leaf = mcts.select_leaf();
+
+  if (leaf == NULL) {
+    Py_RETURN_NONE;
+  }
+
+  {
+    PhaseTimer playing(mcts.timing(), tree->game_ns);
 
-    if (!PyArg_ParseTuple(expansion_elem.object, "OOd", &move, &game_state,
-                          &prior_probability)) {
+    if (!materialize(mcts, leaf)) {
       return NULL;
     }
+  }
+
+  PhaseTimer marshalling(mcts.timing(), tree->marshal_ns);
 
-    MCTS<PythonHandle, PythonHandle>::ExpansionEntry expansion_entry = {
-        PythonHandle::copy(move), PythonHandle::copy(game_state),
-        prior_probability};
+  return reuse_leaf_tuple(tree, leaf).steal();
+}
+
+static PyObject *mcts_select_leaves(PyObject *self, PyObject *args,
+                                    PyObject *kwargs) {
+  static char n_str[] = "n";
+  static char *keyword_names[] = {n_str, NULL};
 
-    expansion.emplace_back(std::move(expansion_entry));
+  Py_ssize_t n;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n", keyword_names, &n)) {
+    return NULL;
   }
 
-  if (PyErr_Occurred()) {
+  if (n < 0) {
+    PyErr_SetString(PyExc_ValueError, "n must be non-negative");
     return NULL;
   }
 
   auto &mcts = ((PyMCTS *)self)->mcts;
 
+  std::vector<MCTS<PythonHandle, PythonHandle>::Node *> leaves;
+
   try {
-    mcts.expand_leaf(leaf, av, std::move(expansion));
+    leaves = mcts.select_leaves((size_t)n);
   } catch (std::bad_alloc &) {
     PyErr_NoMemory();
     return NULL;
   }
 
-  Py_RETURN_NONE;
+  auto tree = (PyMCTS *)self;
+
+  {
+    PhaseTimer playing(mcts.timing(), tree->game_ns);
+
+    for (auto leaf : leaves) {
+      if (!materialize(mcts, leaf)) {
+        for (auto abandoned : leaves) {
+          mcts.abandon_leaf(abandoned);
+        }
+
+        return NULL;
+      }
+    }
+  }
+
+  PhaseTimer marshalling(mcts.timing(), tree->marshal_ns);
+
+  return iterator_to_list(leaves.begin(), leaves.end(),
+                          [tree](MCTS<PythonHandle, PythonHandle>::Node *leaf) {
+                            return leaf_to_tuple(tree, leaf);
+                          })
+      .steal();
 }
 
-static PyObject *mcts_move_greedy(PyObject *self, PyObject *args) {
-  (void)args;
+static PyObject *mcts_expand_leaf(PyObject *self, PyObject *const *args,
+                                  Py_ssize_t nargs, PyObject *kwnames) {
+  static const char *const keyword_names[] = {"leaf", "av", "expansion",
+                                              NULL};
+
   auto &mcts = ((PyMCTS *)self)->mcts;
 
-  if (!mcts.expanded()) {
-    PyErr_SetString(PyExc_RuntimeError, "root node hasn't been expanded");
+  PhaseTimer marshalling(mcts.timing(), ((PyMCTS *)self)->marshal_ns);
+
+  PyObject *values[3];
+
+  if (!parse_fastcall(args, nargs, kwnames, keyword_names, values)) {
     return NULL;
   }
 
-  if (mcts.complete()) {
-    PyErr_SetString(PyExc_RuntimeError, "game is over");
+  auto leaf = parse_leaf((PyMCTS *)self, values[0]);
+
+  if (leaf == NULL) {
+    return NULL;
+  }
+
+  const double av = PyFloat_AsDouble(values[1]);
+
+  if (av == -1.0 && PyErr_Occurred()) {
+    return NULL;
+  }
+
+  std::vector<MCTS<PythonHandle, PythonHandle>::ExpansionEntry> expansion;
+
+  if (!parse_expansion(values[2], expansion)) {
     return NULL;
   }
 
+  marshalling.stop();
+
   try {
-    return PythonHandle::copy(mcts.move_greedy().object).steal();
+    mcts.expand_leaf(leaf->node, av, std::move(expansion));
   } catch (std::bad_alloc &) {
     PyErr_NoMemory();
     return NULL;
   }
 
+  leaf->node = NULL;
+
   Py_RETURN_NONE;
 }
 
-static PyObject *mcts_move_proportional(PyObject *self, PyObject *args) {
-  (void)args;
+static PyObject *mcts_expand_leaves(PyObject *self, PyObject *const *args,
+                                    Py_ssize_t nargs, PyObject *kwnames) {
+  static const char *const keyword_names[] = {"evaluations", NULL};
+
   auto &mcts = ((PyMCTS *)self)->mcts;
 
-  if (!mcts.expanded()) {
-    PyErr_SetString(PyExc_RuntimeError, "root node hasn't been expanded");
+  PhaseTimer marshalling(mcts.timing(), ((PyMCTS *)self)->marshal_ns);
+
+  PyObject *evaluations_sequence;
+
+  if (!parse_fastcall(args, nargs, kwnames, keyword_names,
+                      &evaluations_sequence)) {
     return NULL;
   }
 
-  if (mcts.complete()) {
-    PyErr_SetString(PyExc_RuntimeError, "game is over");
+  PythonHandle evaluations_fast(
+      PySequence_Fast(evaluations_sequence, "evaluations must be iterable"));
+
+  if (evaluations_fast.null()) {
+    return NULL;
+  }
+
+  const Py_ssize_t n_evaluations =
+      PySequence_Fast_GET_SIZE(evaluations_fast.object);
+  PyObject **evaluation_elems =
+      PySequence_Fast_ITEMS(evaluations_fast.object);
+
+  std::vector<MCTS<PythonHandle, PythonHandle>::Evaluation> evaluations;
+  std::vector<PyLeaf *> leaves;
+
+  try {
+    evaluations.reserve((size_t)n_evaluations);
+    leaves.reserve((size_t)n_evaluations);
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
     return NULL;
   }
 
+  for (Py_ssize_t i = 0; i < n_evaluations; i++) {
+    PyObject *evaluation_elem = evaluation_elems[i];
+
+    if (!assert_tuple_length(evaluation_elem, 3)) {
+      return NULL;
+    }
+
+    auto leaf =
+        parse_leaf((PyMCTS *)self, PyTuple_GET_ITEM(evaluation_elem, 0));
+
+    if (leaf == NULL) {
+      return NULL;
+    }
+
+    const double av = PyFloat_AsDouble(PyTuple_GET_ITEM(evaluation_elem, 1));
+
+    if (av == -1.0 && PyErr_Occurred()) {
+      return NULL;
+    }
+
+    MCTS<PythonHandle, PythonHandle>::Evaluation evaluation = {leaf->node, av,
+                                                               {}};
+
+    if (!parse_expansion(PyTuple_GET_ITEM(evaluation_elem, 2),
+                         evaluation.expansion)) {
+      return NULL;
+    }
+
+    evaluations.emplace_back(std::move(evaluation));
+    leaves.push_back(leaf);
+  }
+
+  marshalling.stop();
+
   try {
-    return PythonHandle::copy(mcts.move_proportional().object).steal();
+    mcts.expand_leaves(std::move(evaluations));
   } catch (std::bad_alloc &) {
     PyErr_NoMemory();
     return NULL;
   }
 
+  for (PyLeaf *leaf : leaves) {
+    leaf->node = NULL;
+  }
+
   Py_RETURN_NONE;
 }
 
-static PyObject *mcts_collect_result(PyObject *self, PyObject *args) {
-  (void)args;
+static PyObject *mcts_expand_leaf_dense(PyObject *self, PyObject *const *args,
+                                        Py_ssize_t nargs, PyObject *kwnames) {
+  static const char *const keyword_names[] = {"leaf", "av", "policy", NULL};
+
   auto &mcts = ((PyMCTS *)self)->mcts;
 
-  if (mcts.collected()) {
-    PyErr_SetString(PyExc_RuntimeError, "results were already collected");
+  PhaseTimer marshalling(mcts.timing(), ((PyMCTS *)self)->marshal_ns);
+
+  PyObject *values[3];
+
+  if (!parse_fastcall(args, nargs, kwnames, keyword_names, values)) {
     return NULL;
   }
 
-  std::pair<double, std::vector<MCTS<PythonHandle, PythonHandle>::HistoryEntry>>
-      result;
+  auto leaf_handle = parse_leaf((PyMCTS *)self, values[0]);
 
-  try {
-    result = mcts.collect_result();
-  } catch (std::bad_alloc &) {
-    PyErr_NoMemory();
+  if (leaf_handle == NULL) {
     return NULL;
   }
 
-  PythonHandle av = PyFloat_FromDouble(result.first);
+  auto leaf = leaf_handle->node;
 
-  std::vector<MCTS<PythonHandle, PythonHandle>::HistoryEntry> &history =
-      result.second;
+  const double av = PyFloat_AsDouble(values[1]);
 
-  PythonHandle history_list = iterator_to_list(
-      history.begin(), history.end(),
-      [](MCTS<PythonHandle, PythonHandle>::HistoryEntry &entry) {
-        const auto lambda =
-            [](std::pair<PythonHandle, double> &move_and_probability) {
-              PythonHandle tuple(
-                  Py_BuildValue("Nd", move_and_probability.first.object,
-                                move_and_probability.second));
+  if (av == -1.0 && PyErr_Occurred()) {
+    return NULL;
+  }
 
-              if (tuple.null()) {
-                return PythonHandle(NULL);
-              }
+  PyObject *policy_object = values[2];
 
-              move_and_probability.first.steal();
+  BufferView policy;
 
-              return tuple;
-            };
+  if (!get_float_buffer(policy_object, false, 0, policy)) {
+    return NULL;
+  }
 
-        PythonHandle search_probabilities =
-            iterator_to_list(entry.search_probabilities.begin(),
-                             entry.search_probabilities.end(), lambda);
+  const size_t policy_size = (size_t)policy.view.len / sizeof(float);
 
-        PythonHandle tuple(PyTuple_New(2));
+  PythonHandle moves(PyObject_CallMethod(leaf->state().object, "moves", NULL));
 
-        if (tuple.null()) {
-          return PythonHandle(NULL);
-        }
+  if (moves.null()) {
+    return NULL;
+  }
 
-        PyTuple_SET_ITEM(tuple.object, 0, entry.game_state.steal());
-        PyTuple_SET_ITEM(tuple.object, 1, search_probabilities.steal());
+  PythonHandle moves_iter(PyObject_GetIter(moves.object));
 
-        return tuple;
-      });
+  if (moves_iter.null()) {
+    return NULL;
+  }
 
-  PythonHandle tuple(PyTuple_New(2));
+  std::vector<MCTS<PythonHandle, PythonHandle>::MoveEntry> expansion;
+  double sum = 0.0;
 
-  if (tuple.null()) {
+  try {
+    for (;;) {
+      PythonHandle move(PyIter_Next(moves_iter.object));
+
+      if (move.null()) {
+        break;
+      }
+
+      const Py_ssize_t index = PyNumber_AsSsize_t(move.object, NULL);
+
+      if (index == -1 && PyErr_Occurred()) {
+        return NULL;
+      }
+
+      if (index < 0 || (size_t)index >= policy_size) {
+        PyErr_Format(PyExc_IndexError, "move %zd is outside the policy",
+                     index);
+        return NULL;
+      }
+
+      const double prior = policy.floats()[index];
+
+      expansion.push_back({std::move(move), prior});
+      sum += prior;
+    }
+
+    if (PyErr_Occurred()) {
+      return NULL;
+    }
+
+    for (auto &entry : expansion) {
+      entry.prior_probability = (sum > 0.0)
+                                    ? (entry.prior_probability / sum)
+                                    : (1.0 / expansion.size());
+    }
+
+    marshalling.stop();
+    mcts.expand_leaf_lazy(leaf, av, std::move(expansion));
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
     return NULL;
   }
 
-  PyTuple_SET_ITEM(tuple.object, 0, av.steal());
-  PyTuple_SET_ITEM(tuple.object, 1, history_list.steal());
+  leaf_handle->node = NULL;
 
-  return tuple.steal();
+  Py_RETURN_NONE;
 }
 
-static PyObject *mcts_reset(PyObject *self, PyObject *args, PyObject *kwargs) {
-  static char initial_state_str[] = "initial_state";
-  static char *keyword_names[] = {initial_state_str, NULL};
+static PyObject *mcts_move_greedy(PyObject *self, PyObject *args) {
+  (void)args;
+  auto &mcts = ((PyMCTS *)self)->mcts;
 
-  PyObject *initial_state;
+  if (!mcts.expanded()) {
+    PyErr_SetString(PyExc_RuntimeError, "root node hasn't been expanded");
+    return NULL;
+  }
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", keyword_names,
-                                   &initial_state)) {
+  if (mcts.complete()) {
+    PyErr_SetString(PyExc_RuntimeError, "game is over");
+    return NULL;
+  }
+
+  try {
+    PythonHandle move = PythonHandle::copy(mcts.move_greedy().object);
+
+    if (!materialize(mcts, NULL)) {
+      return NULL;
+    }
+
+    return move.steal();
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
     return NULL;
   }
 
+  Py_RETURN_NONE;
+}
+
+static PyObject *mcts_move_proportional(PyObject *self, PyObject *args) {
+  (void)args;
   auto &mcts = ((PyMCTS *)self)->mcts;
 
+  if (!mcts.expanded()) {
+    PyErr_SetString(PyExc_RuntimeError, "root node hasn't been expanded");
+    return NULL;
+  }
+
+  if (mcts.complete()) {
+    PyErr_SetString(PyExc_RuntimeError, "game is over");
+    return NULL;
+  }
+
   try {
-    mcts.reset(PythonHandle::copy(initial_state), PythonHandle::copy(Py_None));
+    PythonHandle move = PythonHandle::copy(mcts.move_proportional().object);
+
+    if (!materialize(mcts, NULL)) {
+      return NULL;
+    }
+
+    return move.steal();
   } catch (std::bad_alloc &) {
     PyErr_NoMemory();
     return NULL;
@@ -557,12 +1427,2452 @@ static PyObject *mcts_reset(PyObject *self, PyObject *args, PyObject *kwargs) {
   Py_RETURN_NONE;
 }
 
-static bool assert_tuple_length(PyObject *tuple, size_t length) {
-  if (PyTuple_Check(tuple) && (size_t)PyTuple_Size(tuple) == length) {
-    return true;
+static PyObject *mcts_add_gumbel_noise(PyObject *self, PyObject *args,
+                                       PyObject *kwargs) {
+  static char considered_str[] = "considered";
+  static char budget_str[] = "budget";
+  static char *keyword_names[] = {considered_str, budget_str, NULL};
+
+  Py_ssize_t considered;
+  Py_ssize_t budget;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "nn", keyword_names,
+                                   &considered, &budget)) {
+    return NULL;
   }
 
-  PyErr_Format(PyExc_TypeError, "expected a tuple of length %u",
-               (unsigned int)length);
-  return false;
+  if (considered <= 0 || budget <= 0) {
+    PyErr_SetString(PyExc_ValueError, "considered and budget must be positive");
+    return NULL;
+  }
+
+  auto &mcts = ((PyMCTS *)self)->mcts;
+
+  if (!mcts.expanded()) {
+    PyErr_SetString(PyExc_RuntimeError, "root node hasn't been expanded");
+    return NULL;
+  }
+
+  if (mcts.complete()) {
+    PyErr_SetString(PyExc_RuntimeError, "game is over");
+    return NULL;
+  }
+
+  try {
+    mcts.add_gumbel_noise((size_t)considered, (size_t)budget);
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *mcts_move_gumbel(PyObject *self, PyObject *args) {
+  (void)args;
+  auto &mcts = ((PyMCTS *)self)->mcts;
+
+  if (!mcts.halving()) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "root isn't searched by sequential halving");
+    return NULL;
+  }
+
+  try {
+    PythonHandle move = PythonHandle::copy(mcts.move_gumbel().object);
+
+    if (!materialize(mcts, NULL)) {
+      return NULL;
+    }
+
+    return move.steal();
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+}
+
+static PyObject *mcts_collect_result(PyObject *self, PyObject *args) {
+  (void)args;
+  auto &mcts = ((PyMCTS *)self)->mcts;
+
+  if (mcts.collected()) {
+    PyErr_SetString(PyExc_RuntimeError, "results were already collected");
+    return NULL;
+  }
+
+  std::pair<double, std::vector<MCTS<PythonHandle, PythonHandle>::HistoryEntry>>
+      result;
+
+  try {
+    result = mcts.collect_result();
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  PythonHandle av = PyFloat_FromDouble(result.first);
+  PythonHandle history_list = history_to_list(result.second);
+
+  PythonHandle tuple(PyTuple_New(2));
+
+  if (tuple.null()) {
+    return NULL;
+  }
+
+  PyTuple_SET_ITEM(tuple.object, 0, av.steal());
+  PyTuple_SET_ITEM(tuple.object, 1, history_list.steal());
+
+  return tuple.steal();
+}
+
+static PyObject *mcts_reset(PyObject *self, PyObject *args, PyObject *kwargs) {
+  static char initial_state_str[] = "initial_state";
+  static char *keyword_names[] = {initial_state_str, NULL};
+
+  PyObject *initial_state;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", keyword_names,
+                                   &initial_state)) {
+    return NULL;
+  }
+
+  auto &mcts = ((PyMCTS *)self)->mcts;
+
+  try {
+    mcts.reset(PythonHandle::copy(initial_state), PythonHandle::copy(Py_None));
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *mcts_image(PyObject *self, PyObject *args, PyObject *kwargs) {
+  static char plies_str[] = "plies";
+  static char *keyword_names[] = {plies_str, NULL};
+
+  Py_ssize_t plies;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n", keyword_names, &plies)) {
+    return NULL;
+  }
+
+  if (plies < 0) {
+    PyErr_SetString(PyExc_ValueError, "plies must be non-negative");
+    return NULL;
+  }
+
+  auto &mcts = ((PyMCTS *)self)->mcts;
+
+  if (mcts.collected()) {
+    PyErr_SetString(PyExc_RuntimeError, "results were already collected");
+    return NULL;
+  }
+
+  PythonGame game;
+
+  std::vector<TreeImage::Node> nodes;
+  std::vector<char> bytes;
+
+  try {
+    if (!mcts.image((size_t)plies, nodes,
+                    [&game](const PythonHandle &move, uint32_t &code) {
+                      return game.encode_move(move, code);
+                    })) {
+      return NULL;
+    }
+
+    bytes = TreeImage::serialize(nodes);
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  return PyBytes_FromStringAndSize(bytes.data(), (Py_ssize_t)bytes.size());
+}
+
+static PyObject *mcts_load_image(PyObject *self, PyObject *args,
+                                 PyObject *kwargs) {
+  static char image_str[] = "image";
+  static char *keyword_names[] = {image_str, NULL};
+
+  PyObject *image_object;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", keyword_names,
+                                   &image_object)) {
+    return NULL;
+  }
+
+  auto &mcts = ((PyMCTS *)self)->mcts;
+
+  if (mcts.collected()) {
+    PyErr_SetString(PyExc_RuntimeError, "results were already collected");
+    return NULL;
+  }
+
+  if (mcts.expanded()) {
+    PyErr_SetString(PyExc_RuntimeError, "root node was already expanded");
+    return NULL;
+  }
+
+  // The image is copied into the tree, so it need not outlive the call
+  OpeningBook image;
+
+  if (!open_book(image_object, image)) {
+    return NULL;
+  }
+
+  PythonGame game;
+
+  try {
+    if (!mcts.load_image(image.image,
+                         [&game](uint32_t code, PythonHandle &move) {
+                           return game.decode_move(code, move);
+                         })) {
+      return NULL;
+    }
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *engine_create(PyTypeObject *type, PyObject *args,
+                               PyObject *kwargs) {
+  PyObject *initial_state;
+  Py_ssize_t trees;
+  SelfPlayEngine<PythonGame>::Config config;
+  Py_ssize_t evaluations;
+  Py_ssize_t leaves_per_tree = 1;
+  Py_ssize_t max_turns = PY_SSIZE_T_MAX;
+  Py_ssize_t node_budget = 0;
+  int stop_early = 0;
+  Py_ssize_t gumbel_considered = 0;
+
+  static char initial_state_str[] = "initial_state";
+  static char trees_str[] = "trees";
+  static char c_init_str[] = "c_init";
+  static char c_base_str[] = "c_base";
+  static char evaluations_str[] = "evaluations";
+  static char noise_alpha_str[] = "noise_alpha";
+  static char noise_fraction_str[] = "noise_fraction";
+  static char leaves_per_tree_str[] = "leaves_per_tree";
+  static char max_turns_str[] = "max_turns";
+  static char node_budget_str[] = "node_budget";
+  static char stop_early_str[] = "stop_early";
+  static char gumbel_considered_str[] = "gumbel_considered";
+
+  static char *keyword_names[] = {
+      initial_state_str,  trees_str,           c_init_str,
+      c_base_str,         evaluations_str,     noise_alpha_str,
+      noise_fraction_str, leaves_per_tree_str, max_turns_str,
+      node_budget_str,    stop_early_str,      gumbel_considered_str,
+      NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwargs, "Onddndd|nnnpn", keyword_names, &initial_state, &trees,
+          &config.c_init, &config.c_base, &evaluations, &config.noise_alpha,
+          &config.noise_fraction, &leaves_per_tree, &max_turns, &node_budget,
+          &stop_early, &gumbel_considered)) {
+    return NULL;
+  }
+
+  if (trees <= 0 || evaluations <= 0 || leaves_per_tree <= 0 ||
+      max_turns <= 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "trees, evaluations, leaves_per_tree and max_turns must "
+                    "be positive");
+    return NULL;
+  }
+
+  if (node_budget < 0 || gumbel_considered < 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "node_budget and gumbel_considered must be non-negative");
+    return NULL;
+  }
+
+  config.evaluations = (size_t)evaluations;
+  config.leaves_per_tree = (size_t)leaves_per_tree;
+  config.max_turns = (size_t)max_turns;
+  config.stop_early = stop_early != 0;
+  config.gumbel_considered = (size_t)gumbel_considered;
+  config.transpositions = 0;
+  config.node_budget = (size_t)node_budget;
+
+  // Python states are only destroyed while holding the GIL
+  config.reclaim_visits = 0;
+
+  PythonHandle self(PyObject_New(PyObject, type));
+
+  if (self.null()) {
+    return NULL;
+  }
+
+  ((PySelfPlayEngine *)self.object)->marshal_ns = 0;
+  new (&((PySelfPlayEngine *)self.object)->book)
+      std::unique_ptr<OpeningBook>();
+
+  void *location = &((PySelfPlayEngine *)self.object)->engine;
+
+  try {
+    new (location) SelfPlayEngine<PythonGame>(
+        PythonGame(), config, (size_t)trees,
+        PythonHandle::copy(initial_state));
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  return self.steal();
+}
+
+static void engine_destroy(PyObject *self) {
+  auto &engine = ((PySelfPlayEngine *)self)->engine;
+  engine.~SelfPlayEngine();
+  ((PySelfPlayEngine *)self)->book.~unique_ptr();
+  Py_TYPE(self)->tp_free(self);
+}
+
+static PyObject *engine_step(PyObject *self, PyObject *args,
+                             PyObject *kwargs) {
+  static char evaluations_str[] = "evaluations";
+  static char *keyword_names[] = {evaluations_str, NULL};
+
+  PyObject *evaluations_sequence;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", keyword_names,
+                                   &evaluations_sequence)) {
+    return NULL;
+  }
+
+  auto py_engine = (PySelfPlayEngine *)self;
+  auto &engine = py_engine->engine;
+
+  PhaseTimer marshalling(engine.timing(), py_engine->marshal_ns);
+
+  PythonHandle evaluations_iter(PyObject_GetIter(evaluations_sequence));
+
+  if (evaluations_iter.null()) {
+    return NULL;
+  }
+
+  std::vector<SelfPlayEngine<PythonGame>::Evaluation> evaluations;
+
+  try {
+    for (;;) {
+      PythonHandle evaluation_elem(PyIter_Next(evaluations_iter.object));
+
+      if (evaluation_elem.null()) {
+        break;
+      }
+
+      if (!assert_tuple_length(evaluation_elem.object, 2)) {
+        return NULL;
+      }
+
+      double av;
+      PyObject *policy;
+
+      if (!PyArg_ParseTuple(evaluation_elem.object, "dO", &av, &policy)) {
+        return NULL;
+      }
+
+      evaluations.push_back({av, PythonHandle::copy(policy)});
+    }
+
+    if (PyErr_Occurred()) {
+      return NULL;
+    }
+
+    if (evaluations.size() != engine.batch().size()) {
+      PyErr_Format(PyExc_ValueError, "expected %zu evaluation(s), got %zu",
+                   engine.batch().size(), evaluations.size());
+      return NULL;
+    }
+
+    marshalling.stop();
+
+    if (!engine.step(std::move(evaluations))) {
+      return NULL;
+    }
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  PhaseTimer returning(engine.timing(), py_engine->marshal_ns);
+
+  const auto &batch = engine.batch();
+
+  return iterator_to_list(batch.begin(), batch.end(),
+                          [](MCTS<PythonHandle, PythonHandle>::Node *leaf) {
+                            return PythonHandle::copy(leaf->state().object);
+                          })
+      .steal();
+}
+
+static PyObject *engine_results(PyObject *self, PyObject *args) {
+  (void)args;
+  auto &engine = ((PySelfPlayEngine *)self)->engine;
+
+  std::vector<SelfPlayEngine<PythonGame>::Result> results;
+
+  try {
+    results = engine.take_results();
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  return iterator_to_list(
+             results.begin(), results.end(),
+             [](SelfPlayEngine<PythonGame>::Result &result) {
+               PythonHandle score(PyFloat_FromDouble(result.score));
+
+               if (score.null()) {
+                 return PythonHandle(NULL);
+               }
+
+               PythonHandle history_list = history_to_list(result.history);
+
+               if (history_list.null()) {
+                 return PythonHandle(NULL);
+               }
+
+               PythonHandle tuple(PyTuple_New(2));
+
+               if (tuple.null()) {
+                 return PythonHandle(NULL);
+               }
+
+               PyTuple_SET_ITEM(tuple.object, 0, score.steal());
+               PyTuple_SET_ITEM(tuple.object, 1, history_list.steal());
+
+               return tuple;
+             })
+      .steal();
+}
+
+static PyObject *engine_memory_stats(PyObject *self, PyObject *args) {
+  (void)args;
+  return memory_stats_to_dict(
+      ((PySelfPlayEngine *)self)->engine.memory_stats());
+}
+
+static PyObject *engine_set_timing(PyObject *self, PyObject *args,
+                                   PyObject *kwargs) {
+  bool timing;
+
+  if (!parse_timing(args, kwargs, timing)) {
+    return NULL;
+  }
+
+  ((PySelfPlayEngine *)self)->engine.set_timing(timing);
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *engine_search_stats(PyObject *self, PyObject *args) {
+  (void)args;
+  auto py_engine = (PySelfPlayEngine *)self;
+  return search_stats_to_dict(py_engine->engine.search_stats(),
+                              py_engine->engine.game_ns(),
+                              py_engine->marshal_ns);
+}
+
+static PyObject *engine_set_opening_book(PyObject *self, PyObject *args,
+                                         PyObject *kwargs) {
+  auto py_engine = (PySelfPlayEngine *)self;
+  return set_opening_book(py_engine->engine, py_engine->book, args, kwargs);
+}
+
+static PyObject *connectk_engine_create(PyTypeObject *type, PyObject *args,
+                                        PyObject *kwargs) {
+  Py_ssize_t rows;
+  Py_ssize_t columns;
+  Py_ssize_t k;
+  Py_ssize_t trees;
+  SelfPlayEngine<ConnectKRules>::Config config;
+  Py_ssize_t evaluations;
+  Py_ssize_t leaves_per_tree = 1;
+  Py_ssize_t max_turns = PY_SSIZE_T_MAX;
+  Py_ssize_t transpositions = 0;
+  Py_ssize_t node_budget = 0;
+  Py_ssize_t reclaim_visits = 0;
+  int stop_early = 0;
+  Py_ssize_t gumbel_considered = 0;
+  int symmetric = 0;
+
+  static char rows_str[] = "rows";
+  static char columns_str[] = "columns";
+  static char k_str[] = "k";
+  static char trees_str[] = "trees";
+  static char c_init_str[] = "c_init";
+  static char c_base_str[] = "c_base";
+  static char evaluations_str[] = "evaluations";
+  static char noise_alpha_str[] = "noise_alpha";
+  static char noise_fraction_str[] = "noise_fraction";
+  static char leaves_per_tree_str[] = "leaves_per_tree";
+  static char max_turns_str[] = "max_turns";
+  static char transpositions_str[] = "transpositions";
+  static char node_budget_str[] = "node_budget";
+  static char reclaim_visits_str[] = "reclaim_visits";
+  static char stop_early_str[] = "stop_early";
+  static char gumbel_considered_str[] = "gumbel_considered";
+  static char symmetric_str[] = "symmetric";
+
+  static char *keyword_names[] = {
+      rows_str,           columns_str,         k_str,
+      trees_str,          c_init_str,          c_base_str,
+      evaluations_str,    noise_alpha_str,     noise_fraction_str,
+      leaves_per_tree_str, max_turns_str,      transpositions_str,
+      node_budget_str,    reclaim_visits_str,  stop_early_str,
+      gumbel_considered_str, symmetric_str,    NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwargs, "nnnnddndd|nnnnnpnp", keyword_names, &rows, &columns,
+          &k, &trees, &config.c_init, &config.c_base, &evaluations,
+          &config.noise_alpha, &config.noise_fraction, &leaves_per_tree,
+          &max_turns, &transpositions, &node_budget, &reclaim_visits,
+          &stop_early, &gumbel_considered, &symmetric)) {
+    return NULL;
+  }
+
+  if (rows <= 0 || columns <= 0 || k <= 0 ||
+      !ConnectKRules::valid((size_t)rows, (size_t)columns, (size_t)k)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "rows, columns and k must be positive, with (rows + 1) * "
+                    "columns <= 62");
+    return NULL;
+  }
+
+  if (trees <= 0 || evaluations <= 0 || leaves_per_tree <= 0 ||
+      max_turns <= 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "trees, evaluations, leaves_per_tree and max_turns must "
+                    "be positive");
+    return NULL;
+  }
+
+  if (transpositions < 0 || node_budget < 0 || gumbel_considered < 0) {
+    PyErr_SetString(PyExc_ValueError, "transpositions, node_budget and "
+                                      "gumbel_considered must be non-negative");
+    return NULL;
+  }
+
+  if (reclaim_visits < 0 || (uint64_t)reclaim_visits > UINT32_MAX) {
+    PyErr_SetString(PyExc_ValueError,
+                    "reclaim_visits must be between 0 and 2**32 - 1");
+    return NULL;
+  }
+
+  config.evaluations = (size_t)evaluations;
+  config.leaves_per_tree = (size_t)leaves_per_tree;
+  config.max_turns = (size_t)max_turns;
+  config.stop_early = stop_early != 0;
+  config.gumbel_considered = (size_t)gumbel_considered;
+  config.transpositions = (size_t)transpositions;
+  config.node_budget = (size_t)node_budget;
+  config.reclaim_visits = (uint32_t)reclaim_visits;
+
+  PythonHandle self(PyObject_New(PyObject, type));
+
+  if (self.null()) {
+    return NULL;
+  }
+
+  auto py_engine = (PyConnectKEngine *)self.object;
+  py_engine->marshal_ns = 0;
+  new (&py_engine->book) std::unique_ptr<OpeningBook>();
+
+  new (&py_engine->rules) ConnectKRules((size_t)rows, (size_t)columns,
+                                        (size_t)k, symmetric != 0);
+
+  try {
+    new (&py_engine->engine) SelfPlayEngine<ConnectKRules>(
+        py_engine->rules, config, (size_t)trees, py_engine->rules.initial());
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  } catch (std::system_error &) {
+    PyErr_SetString(PyExc_RuntimeError, "failed to start reclaimer thread");
+    return NULL;
+  }
+
+  return self.steal();
+}
+
+static void connectk_engine_destroy(PyObject *self) {
+  auto py_engine = (PyConnectKEngine *)self;
+  py_engine->engine.~SelfPlayEngine();
+  py_engine->book.~unique_ptr();
+  py_engine->rules.~ConnectKRules();
+  Py_TYPE(self)->tp_free(self);
+}
+
+static PyObject *connectk_engine_step(PyObject *self, PyObject *args,
+                                      PyObject *kwargs) {
+  static char values_str[] = "values";
+  static char policies_str[] = "policies";
+  static char *keyword_names[] = {values_str, policies_str, NULL};
+
+  PyObject *values_object = Py_None;
+  PyObject *policies_object = Py_None;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OO", keyword_names,
+                                   &values_object, &policies_object)) {
+    return NULL;
+  }
+
+  auto py_engine = (PyConnectKEngine *)self;
+  auto &engine = py_engine->engine;
+
+  const size_t n = engine.batch().size();
+  const size_t columns = py_engine->rules.n_columns();
+
+  BufferView values;
+  BufferView policies;
+
+  if (n != 0 || values_object != Py_None || policies_object != Py_None) {
+    if (!get_float_buffer(values_object, false, n, values) ||
+        !get_float_buffer(policies_object, false, n * columns, policies)) {
+      return NULL;
+    }
+  }
+
+  bool out_of_memory = false;
+
+  // Priors are read in place, and the buffers stay exported (so cannot be
+  // resized) until the step returns
+  Py_BEGIN_ALLOW_THREADS;
+
+  try {
+    PhaseTimer marshalling(engine.timing(), py_engine->marshal_ns);
+
+    std::vector<SelfPlayEngine<ConnectKRules>::Evaluation> evaluations(n);
+
+    for (size_t i = 0; i < n; i++) {
+      evaluations[i].av = values.floats()[i];
+      evaluations[i].policy = policies.floats() + i * columns;
+    }
+
+    marshalling.stop();
+
+    engine.step(std::move(evaluations));
+  } catch (std::bad_alloc &) {
+    out_of_memory = true;
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  if (out_of_memory) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  return PyLong_FromSize_t(engine.batch().size());
+}
+
+static PyObject *connectk_engine_features(PyObject *self, PyObject *args,
+                                          PyObject *kwargs) {
+  static char out_str[] = "out";
+  static char *keyword_names[] = {out_str, NULL};
+
+  PyObject *out_object;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", keyword_names,
+                                   &out_object)) {
+    return NULL;
+  }
+
+  auto py_engine = (PyConnectKEngine *)self;
+  const ConnectKRules &rules = py_engine->rules;
+  const auto &batch = py_engine->engine.batch();
+
+  const size_t n_features = rules.n_features();
+
+  BufferView out;
+
+  if (!get_float_buffer(out_object, true, batch.size() * n_features, out)) {
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  PhaseTimer marshalling(py_engine->engine.timing(), py_engine->marshal_ns);
+
+  for (size_t i = 0; i < batch.size(); i++) {
+    rules.features(batch[i]->state(), out.floats() + i * n_features);
+  }
+
+  marshalling.stop();
+
+  Py_END_ALLOW_THREADS;
+
+  return PyLong_FromSize_t(batch.size());
+}
+
+static PyObject *connectk_engine_batch_size(PyObject *self, PyObject *args) {
+  (void)args;
+  auto py_engine = (PyConnectKEngine *)self;
+  return PyLong_FromSize_t(py_engine->engine.batch().size());
+}
+
+static PyObject *connectk_engine_feature_shape(PyObject *self,
+                                               PyObject *args) {
+  (void)args;
+  const ConnectKRules &rules = ((PyConnectKEngine *)self)->rules;
+  return Py_BuildValue("(inn)", 2, (Py_ssize_t)rules.n_rows(),
+                       (Py_ssize_t)rules.n_columns());
+}
+
+static PyObject *connectk_engine_results(PyObject *self, PyObject *args) {
+  (void)args;
+  auto py_engine = (PyConnectKEngine *)self;
+  const ConnectKRules &rules = py_engine->rules;
+
+  std::vector<SelfPlayEngine<ConnectKRules>::Result> results;
+
+  try {
+    results = py_engine->engine.take_results();
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  PhaseTimer marshalling(py_engine->engine.timing(), py_engine->marshal_ns);
+
+  return iterator_to_list(
+             results.begin(), results.end(),
+             [&rules](SelfPlayEngine<ConnectKRules>::Result &result) {
+               PythonHandle score(PyFloat_FromDouble(result.score));
+
+               if (score.null()) {
+                 return PythonHandle(NULL);
+               }
+
+               PythonHandle history_list = iterator_to_list(
+                   result.history.begin(), result.history.end(),
+                   [&rules](SelfPlayEngine<ConnectKRules>::HistoryEntry
+                                &entry) {
+                     PythonHandle features(
+                         features_to_bytes(rules, entry.game_state));
+
+                     if (features.null()) {
+                       return PythonHandle(NULL);
+                     }
+
+                     PythonHandle search_probabilities = iterator_to_list(
+                         entry.search_probabilities.begin(),
+                         entry.search_probabilities.end(),
+                         [](std::pair<uint8_t, double> &move_and_probability) {
+                           return PythonHandle(
+                               Py_BuildValue("id", move_and_probability.first,
+                                             move_and_probability.second));
+                         });
+
+                     if (search_probabilities.null()) {
+                       return PythonHandle(NULL);
+                     }
+
+                     PythonHandle tuple(PyTuple_New(2));
+
+                     if (tuple.null()) {
+                       return PythonHandle(NULL);
+                     }
+
+                     PyTuple_SET_ITEM(tuple.object, 0, features.steal());
+                     PyTuple_SET_ITEM(tuple.object, 1,
+                                      search_probabilities.steal());
+
+                     return tuple;
+                   });
+
+               if (history_list.null()) {
+                 return PythonHandle(NULL);
+               }
+
+               PythonHandle tuple(PyTuple_New(2));
+
+               if (tuple.null()) {
+                 return PythonHandle(NULL);
+               }
+
+               PyTuple_SET_ITEM(tuple.object, 0, score.steal());
+               PyTuple_SET_ITEM(tuple.object, 1, history_list.steal());
+
+               return tuple;
+             })
+      .steal();
+}
+
+static PyObject *connectk_engine_results_packed(PyObject *self,
+                                                PyObject *args) {
+  (void)args;
+  auto py_engine = (PyConnectKEngine *)self;
+  const ConnectKRules &rules = py_engine->rules;
+
+  std::vector<SelfPlayEngine<ConnectKRules>::Result> results;
+
+  try {
+    results = py_engine->engine.take_results();
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  PhaseTimer marshalling(py_engine->engine.timing(), py_engine->marshal_ns);
+
+  return iterator_to_list(
+             results.begin(), results.end(),
+             [&rules](SelfPlayEngine<ConnectKRules>::Result &result) {
+               return result_to_records(rules, result);
+             })
+      .steal();
+}
+
+static PyObject *connectk_engine_set_generation(PyObject *self,
+                                                PyObject *args,
+                                                PyObject *kwargs) {
+  static char generation_str[] = "generation";
+  static char *keyword_names[] = {generation_str, NULL};
+
+  unsigned long long generation;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "K", keyword_names,
+                                   &generation)) {
+    return NULL;
+  }
+
+  ((PyConnectKEngine *)self)->engine.set_generation((uint64_t)generation);
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *connectk_engine_set_opening_book(PyObject *self,
+                                                  PyObject *args,
+                                                  PyObject *kwargs) {
+  auto py_engine = (PyConnectKEngine *)self;
+  return set_opening_book(py_engine->engine, py_engine->book, args, kwargs);
+}
+
+static PyObject *connectk_engine_transposition_stats(PyObject *self,
+                                                     PyObject *args) {
+  (void)args;
+  const auto stats = ((PyConnectKEngine *)self)->engine.transposition_stats();
+
+  return Py_BuildValue(
+      "{s:n,s:K,s:K,s:K,s:K,s:K}", "capacity", (Py_ssize_t)stats.capacity,
+      "generation", (unsigned long long)stats.generation, "hits",
+      (unsigned long long)stats.hits, "misses",
+      (unsigned long long)stats.misses, "shared",
+      (unsigned long long)stats.shared, "evictions",
+      (unsigned long long)stats.evictions);
+}
+
+static PyObject *connectk_engine_memory_stats(PyObject *self, PyObject *args) {
+  (void)args;
+  return memory_stats_to_dict(
+      ((PyConnectKEngine *)self)->engine.memory_stats());
+}
+
+static PyObject *connectk_engine_set_timing(PyObject *self, PyObject *args,
+                                            PyObject *kwargs) {
+  bool timing;
+
+  if (!parse_timing(args, kwargs, timing)) {
+    return NULL;
+  }
+
+  ((PyConnectKEngine *)self)->engine.set_timing(timing);
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *connectk_engine_search_stats(PyObject *self,
+                                              PyObject *args) {
+  (void)args;
+  auto py_engine = (PyConnectKEngine *)self;
+  return search_stats_to_dict(py_engine->engine.search_stats(),
+                              py_engine->engine.game_ns(),
+                              py_engine->marshal_ns);
+}
+
+static PyObject *runtime_create(PyTypeObject *type, PyObject *args,
+                                PyObject *kwargs) {
+  PyObject *channel_object;
+  Py_ssize_t first_slot;
+  Py_ssize_t slots;
+  Py_ssize_t threads;
+  Py_ssize_t rows;
+  Py_ssize_t columns;
+  Py_ssize_t k;
+  Py_ssize_t trees;
+  SelfPlayRuntime<ConnectKRules>::Config config;
+  Py_ssize_t evaluations;
+  Py_ssize_t leaves_per_tree = 1;
+  Py_ssize_t max_turns = PY_SSIZE_T_MAX;
+  Py_ssize_t transpositions = 0;
+  Py_ssize_t node_budget = 0;
+  Py_ssize_t reclaim_visits = 0;
+  int stop_early = 0;
+  Py_ssize_t gumbel_considered = 0;
+  int symmetric = 0;
+
+  static char channel_str[] = "channel";
+  static char first_slot_str[] = "first_slot";
+  static char slots_str[] = "slots";
+  static char threads_str[] = "threads";
+  static char rows_str[] = "rows";
+  static char columns_str[] = "columns";
+  static char k_str[] = "k";
+  static char trees_str[] = "trees";
+  static char c_init_str[] = "c_init";
+  static char c_base_str[] = "c_base";
+  static char evaluations_str[] = "evaluations";
+  static char noise_alpha_str[] = "noise_alpha";
+  static char noise_fraction_str[] = "noise_fraction";
+  static char leaves_per_tree_str[] = "leaves_per_tree";
+  static char max_turns_str[] = "max_turns";
+  static char transpositions_str[] = "transpositions";
+  static char node_budget_str[] = "node_budget";
+  static char reclaim_visits_str[] = "reclaim_visits";
+  static char stop_early_str[] = "stop_early";
+  static char gumbel_considered_str[] = "gumbel_considered";
+  static char symmetric_str[] = "symmetric";
+
+  static char *keyword_names[] = {
+      channel_str,         first_slot_str,     slots_str,
+      threads_str,         rows_str,           columns_str,
+      k_str,               trees_str,          c_init_str,
+      c_base_str,          evaluations_str,    noise_alpha_str,
+      noise_fraction_str,  leaves_per_tree_str, max_turns_str,
+      transpositions_str,  node_budget_str,    reclaim_visits_str,
+      stop_early_str,      gumbel_considered_str, symmetric_str,
+      NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwargs, "O!nnnnnnnddndd|nnnnnpnp", keyword_names,
+          channel_type_object, &channel_object, &first_slot, &slots,
+          &threads, &rows, &columns, &k, &trees, &config.c_init,
+          &config.c_base, &evaluations, &config.noise_alpha,
+          &config.noise_fraction, &leaves_per_tree, &max_turns,
+          &transpositions, &node_budget, &reclaim_visits, &stop_early,
+          &gumbel_considered, &symmetric)) {
+    return NULL;
+  }
+
+  if (rows <= 0 || columns <= 0 || k <= 0 ||
+      !ConnectKRules::valid((size_t)rows, (size_t)columns, (size_t)k)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "rows, columns and k must be positive, with (rows + 1) * "
+                    "columns <= 62");
+    return NULL;
+  }
+
+  if (trees <= 0 || evaluations <= 0 || leaves_per_tree <= 0 ||
+      max_turns <= 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "trees, evaluations, leaves_per_tree and max_turns must "
+                    "be positive");
+    return NULL;
+  }
+
+  if (transpositions < 0 || node_budget < 0 || gumbel_considered < 0) {
+    PyErr_SetString(PyExc_ValueError, "transpositions, node_budget and "
+                                      "gumbel_considered must be non-negative");
+    return NULL;
+  }
+
+  if (reclaim_visits < 0 || (uint64_t)reclaim_visits > UINT32_MAX) {
+    PyErr_SetString(PyExc_ValueError,
+                    "reclaim_visits must be between 0 and 2**32 - 1");
+    return NULL;
+  }
+
+  const EvaluationChannel &channel =
+      ((PyEvaluationChannel *)channel_object)->channel;
+
+  if (threads <= 0 || slots <= threads) {
+    PyErr_SetString(PyExc_ValueError,
+                    "threads must be positive, and slots more than threads");
+    return NULL;
+  }
+
+  if (first_slot < 0 || (size_t)first_slot > channel.n_slots() ||
+      (size_t)slots > channel.n_slots() - (size_t)first_slot) {
+    PyErr_SetString(PyExc_IndexError, "slots are out of range");
+    return NULL;
+  }
+
+  ConnectKRules rules((size_t)rows, (size_t)columns, (size_t)k,
+                      symmetric != 0);
+
+  if (channel.features_per_position() != rules.n_features() ||
+      channel.priors_per_position() != rules.policy_width() ||
+      channel.batch_capacity() < (size_t)leaves_per_tree) {
+    PyErr_SetString(PyExc_ValueError,
+                    "channel doesn't fit the game's features and policies, "
+                    "or a tree's leaves");
+    return NULL;
+  }
+
+  config.evaluations = (size_t)evaluations;
+  config.leaves_per_tree = (size_t)leaves_per_tree;
+  config.max_turns = (size_t)max_turns;
+  config.stop_early = stop_early != 0;
+  config.gumbel_considered = (size_t)gumbel_considered;
+  config.transpositions = (size_t)transpositions;
+  config.node_budget = (size_t)node_budget;
+  config.reclaim_visits = (uint32_t)reclaim_visits;
+
+  PythonHandle self(PyObject_New(PyObject, type));
+
+  if (self.null()) {
+    return NULL;
+  }
+
+  auto py_runtime = (PyConnectKRuntime *)self.object;
+
+  new (&py_runtime->channel) PythonHandle(PythonHandle::copy(channel_object));
+  new (&py_runtime->rules) ConnectKRules(rules);
+  new (&py_runtime->runtime) std::unique_ptr<SelfPlayRuntime<ConnectKRules>>();
+  new (&py_runtime->book) std::unique_ptr<OpeningBook>();
+
+  try {
+    py_runtime->runtime.reset(new SelfPlayRuntime<ConnectKRules>(
+        rules, config, (size_t)trees, rules.initial(),
+        ((PyEvaluationChannel *)channel_object)->channel, (size_t)first_slot,
+        (size_t)slots, (size_t)threads));
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  } catch (std::system_error &) {
+    PyErr_SetString(PyExc_RuntimeError, "failed to start reclaimer thread");
+    return NULL;
+  }
+
+  return self.steal();
+}
+
+static void runtime_destroy(PyObject *self) {
+  auto py_runtime = (PyConnectKRuntime *)self;
+
+  // Joins the threads, which may be waiting out a response
+  Py_BEGIN_ALLOW_THREADS;
+  py_runtime->runtime.reset();
+  Py_END_ALLOW_THREADS;
+
+  py_runtime->runtime.~unique_ptr();
+  py_runtime->book.~unique_ptr();
+  py_runtime->rules.~ConnectKRules();
+  py_runtime->channel.~PythonHandle();
+  Py_TYPE(self)->tp_free(self);
+}
+
+static bool check_not_started(const SelfPlayRuntime<ConnectKRules> &runtime) {
+  if (runtime.started()) {
+    PyErr_SetString(PyExc_RuntimeError, "runtime has already started");
+    return false;
+  }
+
+  return true;
+}
+
+static PyObject *runtime_start(PyObject *self, PyObject *args) {
+  (void)args;
+  auto &runtime = *((PyConnectKRuntime *)self)->runtime;
+
+  if (!check_not_started(runtime)) {
+    return NULL;
+  }
+
+  try {
+    runtime.start();
+  } catch (std::system_error &) {
+    PyErr_SetString(PyExc_RuntimeError, "failed to start runtime threads");
+    return NULL;
+  }
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *runtime_stop(PyObject *self, PyObject *args) {
+  (void)args;
+  auto &runtime = *((PyConnectKRuntime *)self)->runtime;
+
+  Py_BEGIN_ALLOW_THREADS;
+  runtime.stop();
+  Py_END_ALLOW_THREADS;
+
+  Py_RETURN_NONE;
+}
+
+// Wait up to timeout seconds for the runtime to stop, and return whether it
+// has, raising if it stopped for a failure
+static PyObject *runtime_wait(PyObject *self, PyObject *args,
+                              PyObject *kwargs) {
+  static char timeout_str[] = "timeout";
+  static char *keyword_names[] = {timeout_str, NULL};
+
+  double timeout;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "d", keyword_names,
+                                   &timeout)) {
+    return NULL;
+  }
+
+  if (!(timeout >= 0.0)) {
+    PyErr_SetString(PyExc_ValueError, "timeout must be non-negative");
+    return NULL;
+  }
+
+  auto &runtime = *((PyConnectKRuntime *)self)->runtime;
+
+  bool stopped;
+
+  Py_BEGIN_ALLOW_THREADS;
+  stopped = runtime.wait_for(std::chrono::duration<double>(timeout));
+  Py_END_ALLOW_THREADS;
+
+  switch (runtime.failure()) {
+  case SelfPlayRuntime<ConnectKRules>::memory_failure:
+    PyErr_NoMemory();
+    return NULL;
+  case SelfPlayRuntime<ConnectKRules>::game_failure:
+    PyErr_SetString(PyExc_RuntimeError, "game failed");
+    return NULL;
+  default:
+    return PyBool_FromLong(stopped);
+  }
+}
+
+static PyObject *runtime_results_packed(PyObject *self, PyObject *args) {
+  (void)args;
+  auto py_runtime = (PyConnectKRuntime *)self;
+  const ConnectKRules &rules = py_runtime->rules;
+
+  std::vector<SelfPlayRuntime<ConnectKRules>::Result> results;
+
+  try {
+    results = py_runtime->runtime->take_results();
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  return iterator_to_list(
+             results.begin(), results.end(),
+             [&rules](SelfPlayRuntime<ConnectKRules>::Result &result) {
+               return result_to_records(rules, result);
+             })
+      .steal();
+}
+
+static PyObject *runtime_transposition_stats(PyObject *self, PyObject *args) {
+  (void)args;
+  const auto stats =
+      ((PyConnectKRuntime *)self)->runtime->transposition_stats();
+
+  return Py_BuildValue(
+      "{s:n,s:K,s:K,s:K,s:K,s:K}", "capacity", (Py_ssize_t)stats.capacity,
+      "generation", (unsigned long long)stats.generation, "hits",
+      (unsigned long long)stats.hits, "misses",
+      (unsigned long long)stats.misses, "shared",
+      (unsigned long long)stats.shared, "evictions",
+      (unsigned long long)stats.evictions);
+}
+
+static PyObject *runtime_memory_stats(PyObject *self, PyObject *args) {
+  (void)args;
+  return memory_stats_to_dict(
+      ((PyConnectKRuntime *)self)->runtime->memory_stats());
+}
+
+static PyObject *runtime_set_timing(PyObject *self, PyObject *args,
+                                    PyObject *kwargs) {
+  auto &runtime = *((PyConnectKRuntime *)self)->runtime;
+
+  bool timing;
+
+  if (!check_not_started(runtime) || !parse_timing(args, kwargs, timing)) {
+    return NULL;
+  }
+
+  runtime.set_timing(timing);
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *runtime_search_stats(PyObject *self, PyObject *args) {
+  (void)args;
+  const auto &runtime = *((PyConnectKRuntime *)self)->runtime;
+  return search_stats_to_dict(runtime.search_stats(), runtime.game_ns(),
+                              runtime.marshal_ns());
+}
+
+static PyObject *runtime_wait_ns(PyObject *self, PyObject *args) {
+  (void)args;
+  return PyLong_FromUnsignedLongLong(
+      (unsigned long long)((PyConnectKRuntime *)self)->runtime->wait_ns());
+}
+
+// Counts of positions by the latency of their batch, binned as
+// metrics.LatencyHistogram bins them
+static PyObject *runtime_latency_counts(PyObject *self, PyObject *args) {
+  (void)args;
+  std::vector<uint64_t> counts;
+
+  try {
+    counts = ((PyConnectKRuntime *)self)->runtime->latency_counts();
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  return iterator_to_list(counts.begin(), counts.end(),
+                          [](uint64_t count) {
+                            return PythonHandle(PyLong_FromUnsignedLongLong(
+                                (unsigned long long)count));
+                          })
+      .steal();
+}
+
+static PyObject *runtime_set_opening_book(PyObject *self, PyObject *args,
+                                          PyObject *kwargs) {
+  auto py_runtime = (PyConnectKRuntime *)self;
+
+  if (!check_not_started(*py_runtime->runtime)) {
+    return NULL;
+  }
+
+  return set_opening_book(*py_runtime->runtime, py_runtime->book, args,
+                          kwargs);
+}
+
+static PyObject *replay_buffer_create(PyTypeObject *type, PyObject *args,
+                                      PyObject *kwargs) {
+  Py_ssize_t capacity;
+  Py_ssize_t labels;
+  Py_ssize_t features;
+
+  static char capacity_str[] = "capacity";
+  static char labels_str[] = "labels";
+  static char features_str[] = "features";
+
+  static char *keyword_names[] = {capacity_str, labels_str, features_str,
+                                  NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "nnn", keyword_names,
+                                   &capacity, &labels, &features)) {
+    return NULL;
+  }
+
+  if (capacity <= 0 || labels < 0 || features < 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "capacity must be positive, and labels and features "
+                    "non-negative");
+    return NULL;
+  }
+
+  PythonHandle self(PyObject_New(PyObject, type));
+
+  if (self.null()) {
+    return NULL;
+  }
+
+  auto py_buffer = (PyReplayBuffer *)self.object;
+
+  try {
+    new (&py_buffer->ring)
+        ReplayRing((size_t)capacity, (size_t)labels, (size_t)features);
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  new (&py_buffer->generator_mutex) std::mutex();
+  new (&py_buffer->generator)
+      std::default_random_engine(std::random_device{}());
+
+  return self.steal();
+}
+
+static void replay_buffer_destroy(PyObject *self) {
+  auto py_buffer = (PyReplayBuffer *)self;
+  std::destroy_at(&py_buffer->generator);
+  py_buffer->generator_mutex.~mutex();
+  py_buffer->ring.~ReplayRing();
+  Py_TYPE(self)->tp_free(self);
+}
+
+static PyObject *replay_buffer_insert(PyObject *self, PyObject *args,
+                                      PyObject *kwargs) {
+  static char records_str[] = "records";
+  static char *keyword_names[] = {records_str, NULL};
+
+  PyObject *records_object;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", keyword_names,
+                                   &records_object)) {
+    return NULL;
+  }
+
+  ReplayRing &ring = ((PyReplayBuffer *)self)->ring;
+
+  BufferView records;
+
+  if (PyObject_GetBuffer(records_object, &records.view, PyBUF_C_CONTIGUOUS) <
+      0) {
+    return NULL;
+  }
+
+  records.acquired = true;
+
+  const size_t length = (size_t)records.view.len;
+
+  if (length % ring.record_size() != 0) {
+    PyErr_Format(PyExc_ValueError,
+                 "expected a whole number of %zu-byte records, got %zu "
+                 "byte(s)",
+                 ring.record_size(), length);
+    return NULL;
+  }
+
+  const size_t n = length / ring.record_size();
+
+  Py_BEGIN_ALLOW_THREADS;
+  ring.insert((const uint8_t *)records.view.buf, n);
+  Py_END_ALLOW_THREADS;
+
+  return PyLong_FromSize_t(n);
+}
+
+static PyObject *replay_buffer_sample(PyObject *self, PyObject *args,
+                                      PyObject *kwargs) {
+  static char n_str[] = "n";
+  static char features_str[] = "features";
+  static char labels_str[] = "labels";
+  static char *keyword_names[] = {n_str, features_str, labels_str, NULL};
+
+  Py_ssize_t n;
+  PyObject *features_object;
+  PyObject *labels_object;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "nOO", keyword_names, &n,
+                                   &features_object, &labels_object)) {
+    return NULL;
+  }
+
+  auto py_buffer = (PyReplayBuffer *)self;
+  const ReplayRing &ring = py_buffer->ring;
+
+  if (n < 0) {
+    PyErr_SetString(PyExc_ValueError, "n must be non-negative");
+    return NULL;
+  }
+
+  if (n > 0 && ring.size() == 0) {
+    PyErr_SetString(PyExc_IndexError, "sample from an empty replay buffer");
+    return NULL;
+  }
+
+  BufferView features;
+  BufferView labels;
+
+  if (!get_float_buffer(features_object, true,
+                        (size_t)n * ring.features_per_record(), features) ||
+      !get_float_buffer(labels_object, true,
+                        (size_t)n * ring.labels_per_record(), labels)) {
+    return NULL;
+  }
+
+  bool failed = false;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  try {
+    // Concurrent samples draw from generators of their own, seeded from the
+    // buffer's
+    std::default_random_engine::result_type seed;
+
+    {
+      std::lock_guard<std::mutex> lock(py_buffer->generator_mutex);
+      seed = py_buffer->generator();
+    }
+
+    std::default_random_engine generator(seed);
+    ring.sample((size_t)n, generator, features.floats(), labels.floats());
+  } catch (std::bad_alloc &) {
+    failed = true;
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  if (failed) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  return PyLong_FromSsize_t(n);
+}
+
+static PyObject *replay_buffer_size(PyObject *self, PyObject *args) {
+  (void)args;
+  return PyLong_FromSize_t(((PyReplayBuffer *)self)->ring.size());
+}
+
+static PyObject *replay_buffer_record_size(PyObject *self, PyObject *args) {
+  (void)args;
+  return PyLong_FromSize_t(((PyReplayBuffer *)self)->ring.record_size());
+}
+
+static PyObject *channel_create(PyTypeObject *type, PyObject *args,
+                                PyObject *kwargs) {
+  PyObject *memory_object;
+  Py_ssize_t slots;
+  Py_ssize_t capacity;
+  Py_ssize_t features;
+  Py_ssize_t policy_width;
+
+  static char memory_str[] = "memory";
+  static char slots_str[] = "slots";
+  static char capacity_str[] = "capacity";
+  static char features_str[] = "features";
+  static char policy_width_str[] = "policy_width";
+
+  static char *keyword_names[] = {memory_str,   slots_str,
+                                  capacity_str, features_str,
+                                  policy_width_str, NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Onnnn", keyword_names,
+                                   &memory_object, &slots, &capacity,
+                                   &features, &policy_width)) {
+    return NULL;
+  }
+
+  if (slots <= 0 || capacity <= 0 || features < 0 || policy_width < 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "slots and capacity must be positive, and features and "
+                    "policy_width non-negative");
+    return NULL;
+  }
+
+  BufferView memory;
+
+  if (PyObject_GetBuffer(memory_object, &memory.view,
+                         PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE) < 0) {
+    return NULL;
+  }
+
+  memory.acquired = true;
+
+  const size_t size =
+      EvaluationChannel::size((size_t)slots, (size_t)capacity,
+                              (size_t)features, (size_t)policy_width);
+
+  if ((size_t)memory.view.len < size) {
+    PyErr_Format(PyExc_ValueError,
+                 "expected a buffer of at least %zu byte(s), got %zu", size,
+                 (size_t)memory.view.len);
+    return NULL;
+  }
+
+  if (((uintptr_t)memory.view.buf & (EvaluationChannel::alignment - 1)) != 0) {
+    PyErr_Format(PyExc_ValueError, "expected a buffer aligned to %zu bytes",
+                 EvaluationChannel::alignment);
+    return NULL;
+  }
+
+  PythonHandle self(PyObject_New(PyObject, type));
+
+  if (self.null()) {
+    return NULL;
+  }
+
+  auto py_channel = (PyEvaluationChannel *)self.object;
+
+  try {
+    new (&py_channel->channel)
+        EvaluationChannel(memory.view.buf, (size_t)slots, (size_t)capacity,
+                          (size_t)features, (size_t)policy_width);
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  // The export passes to the channel
+  new (&py_channel->memory) BufferView();
+  py_channel->memory.view = memory.view;
+  py_channel->memory.acquired = true;
+  memory.acquired = false;
+
+  return self.steal();
+}
+
+static void channel_destroy(PyObject *self) {
+  auto py_channel = (PyEvaluationChannel *)self;
+  py_channel->channel.~EvaluationChannel();
+  py_channel->memory.~BufferView();
+  Py_TYPE(self)->tp_free(self);
+}
+
+static PyObject *channel_nbytes(PyObject *self, PyObject *args,
+                                PyObject *kwargs) {
+  (void)self;
+
+  Py_ssize_t slots;
+  Py_ssize_t capacity;
+  Py_ssize_t features;
+  Py_ssize_t policy_width;
+
+  static char slots_str[] = "slots";
+  static char capacity_str[] = "capacity";
+  static char features_str[] = "features";
+  static char policy_width_str[] = "policy_width";
+
+  static char *keyword_names[] = {slots_str, capacity_str, features_str,
+                                  policy_width_str, NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "nnnn", keyword_names,
+                                   &slots, &capacity, &features,
+                                   &policy_width)) {
+    return NULL;
+  }
+
+  if (slots < 0 || capacity < 0 || features < 0 || policy_width < 0) {
+    PyErr_SetString(PyExc_ValueError, "arguments must be non-negative");
+    return NULL;
+  }
+
+  return PyLong_FromSize_t(EvaluationChannel::size(
+      (size_t)slots, (size_t)capacity, (size_t)features, (size_t)policy_width));
+}
+
+static PyObject *channel_offsets(PyObject *self, PyObject *args,
+                                 PyObject *kwargs) {
+  static char slot_str[] = "slot";
+  static char *keyword_names[] = {slot_str, NULL};
+
+  Py_ssize_t slot;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n", keyword_names, &slot)) {
+    return NULL;
+  }
+
+  const EvaluationChannel &channel = ((PyEvaluationChannel *)self)->channel;
+
+  if (!parse_slot(channel, slot)) {
+    return NULL;
+  }
+
+  return Py_BuildValue("(nnn)", (Py_ssize_t)channel.features_offset(slot),
+                       (Py_ssize_t)channel.values_offset(slot),
+                       (Py_ssize_t)channel.policies_offset(slot));
+}
+
+static PyObject *channel_request(PyObject *self, PyObject *args,
+                                 PyObject *kwargs) {
+  static char slot_str[] = "slot";
+  static char n_str[] = "n";
+  static char *keyword_names[] = {slot_str, n_str, NULL};
+
+  Py_ssize_t slot;
+  Py_ssize_t n;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "nn", keyword_names, &slot,
+                                   &n)) {
+    return NULL;
+  }
+
+  EvaluationChannel &channel = ((PyEvaluationChannel *)self)->channel;
+
+  if (!parse_slot(channel, slot)) {
+    return NULL;
+  }
+
+  if (n < 0 || (size_t)n > channel.batch_capacity()) {
+    PyErr_Format(PyExc_ValueError,
+                 "expected at most %zu position(s) per request, got %zd",
+                 channel.batch_capacity(), n);
+    return NULL;
+  }
+
+  channel.request((size_t)slot, (size_t)n);
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *channel_wait_response(PyObject *self, PyObject *args,
+                                       PyObject *kwargs) {
+  static char slot_str[] = "slot";
+  static char *keyword_names[] = {slot_str, NULL};
+
+  Py_ssize_t slot;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n", keyword_names, &slot)) {
+    return NULL;
+  }
+
+  EvaluationChannel &channel = ((PyEvaluationChannel *)self)->channel;
+
+  if (!parse_slot(channel, slot)) {
+    return NULL;
+  }
+
+  bool responded;
+  uint64_t generation;
+
+  Py_BEGIN_ALLOW_THREADS;
+  responded = channel.wait_response((size_t)slot, generation);
+  Py_END_ALLOW_THREADS;
+
+  if (!responded) {
+    Py_RETURN_NONE;
+  }
+
+  return PyLong_FromUnsignedLongLong((unsigned long long)generation);
+}
+
+static PyObject *channel_wait_requests(PyObject *self, PyObject *args,
+                                       PyObject *kwargs) {
+  static char timeout_str[] = "timeout";
+  static char *keyword_names[] = {timeout_str, NULL};
+
+  double timeout;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "d", keyword_names,
+                                   &timeout)) {
+    return NULL;
+  }
+
+  if (!(timeout >= 0.0)) {
+    PyErr_SetString(PyExc_ValueError, "timeout must be non-negative");
+    return NULL;
+  }
+
+  EvaluationChannel &channel = ((PyEvaluationChannel *)self)->channel;
+
+  std::vector<std::pair<size_t, size_t>> requests;
+  bool failed = false;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  try {
+    channel.wait_requests(std::chrono::duration<double>(timeout), requests);
+  } catch (std::bad_alloc &) {
+    failed = true;
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  if (failed) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  return iterator_to_list(requests.begin(), requests.end(),
+                          [](std::pair<size_t, size_t> &request) {
+                            return PythonHandle(Py_BuildValue(
+                                "(nn)", (Py_ssize_t)request.first,
+                                (Py_ssize_t)request.second));
+                          })
+      .steal();
+}
+
+static PyObject *channel_respond(PyObject *self, PyObject *args,
+                                 PyObject *kwargs) {
+  static char slot_str[] = "slot";
+  static char generation_str[] = "generation";
+  static char *keyword_names[] = {slot_str, generation_str, NULL};
+
+  Py_ssize_t slot;
+  unsigned long long generation = 0;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|K", keyword_names, &slot,
+                                   &generation)) {
+    return NULL;
+  }
+
+  EvaluationChannel &channel = ((PyEvaluationChannel *)self)->channel;
+
+  if (!parse_slot(channel, slot)) {
+    return NULL;
+  }
+
+  channel.respond((size_t)slot, (uint64_t)generation);
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *channel_close(PyObject *self, PyObject *args) {
+  (void)args;
+  ((PyEvaluationChannel *)self)->channel.close();
+  Py_RETURN_NONE;
+}
+
+static PyObject *channel_closed(PyObject *self, PyObject *args) {
+  (void)args;
+  return PyBool_FromLong(((PyEvaluationChannel *)self)->channel.closed());
+}
+
+static bool assert_tuple_length(PyObject *tuple, size_t length) {
+  if (PyTuple_Check(tuple) && (size_t)PyTuple_Size(tuple) == length) {
+    return true;
+  }
+
+  PyErr_Format(PyExc_TypeError, "expected a tuple of length %u",
+               (unsigned int)length);
+  return false;
+}
+
+static PythonHandle leaf_to_tuple(PyMCTS *tree,
+                                  MCTS<PythonHandle, PythonHandle>::Node *leaf) {
+  PythonHandle handle(PyObject_New(PyObject, leaf_type_object));
+
+  if (handle.null()) {
+    return PythonHandle(NULL);
+  }
+
+  ((PyLeaf *)handle.object)->tree = tree;
+  ((PyLeaf *)handle.object)->node = leaf;
+
+  auto game_state = PythonHandle::copy(leaf->state().object);
+
+  PythonHandle tuple(PyTuple_New(2));
+
+  if (tuple.null()) {
+    return PythonHandle(NULL);
+  }
+
+  PyTuple_SET_ITEM(tuple.object, 0, handle.steal());
+  PyTuple_SET_ITEM(tuple.object, 1, game_state.steal());
+
+  return tuple;
+}
+
+// Point the tuple select_leaf last returned at leaf, if nothing else holds
+// the tuple, nor its leaf unless spent; otherwise make a new one to keep
+static PythonHandle
+reuse_leaf_tuple(PyMCTS *tree, MCTS<PythonHandle, PythonHandle>::Node *leaf) {
+  PyObject *tuple = tree->selected.object;
+
+  if (tuple != NULL && Py_REFCNT(tuple) == 1) {
+    auto handle = (PyLeaf *)PyTuple_GET_ITEM(tuple, 0);
+
+    if (Py_REFCNT(handle) == 1 || handle->node == NULL) {
+      handle->node = leaf;
+
+      PythonHandle previous_state(PyTuple_GET_ITEM(tuple, 1));
+      PyTuple_SET_ITEM(tuple, 1,
+                       PythonHandle::copy(leaf->state().object).steal());
+
+      return PythonHandle::copy(tuple);
+    }
+  }
+
+  PythonHandle fresh = leaf_to_tuple(tree, leaf);
+
+  if (!fresh.null()) {
+    tree->selected = PythonHandle::copy(fresh.object);
+  }
+
+  return fresh;
+}
+
+static PyLeaf *parse_leaf(PyMCTS *tree, PyObject *leaf_object) {
+  if (Py_TYPE(leaf_object) != leaf_type_object) {
+    PyErr_SetString(PyExc_TypeError, "bad leaf argument");
+    return NULL;
+  }
+
+  auto leaf = (PyLeaf *)leaf_object;
+
+  if (leaf->tree != tree) {
+    PyErr_SetString(PyExc_ValueError, "leaf was selected from another tree");
+    return NULL;
+  }
+
+  if (leaf->node == NULL) {
+    PyErr_SetString(PyExc_ValueError, "leaf was already expanded");
+    return NULL;
+  }
+
+  return leaf;
+}
+
+// Gather the arguments of a METH_FASTCALL | METH_KEYWORDS call into values,
+// in the order of keyword_names, each required; as "O" for each would with
+// PyArg_ParseTupleAndKeywords
+static bool parse_fastcall(PyObject *const *args, Py_ssize_t nargs,
+                           PyObject *kwnames, const char *const *keyword_names,
+                           PyObject **values) {
+  Py_ssize_t n = 0;
+
+  while (keyword_names[n] != NULL) {
+    n++;
+  }
+
+  if (nargs > n) {
+    PyErr_Format(PyExc_TypeError,
+                 "expected at most %zd argument(s), got %zd", n, nargs);
+    return false;
+  }
+
+  for (Py_ssize_t i = 0; i < n; i++) {
+    values[i] = (i < nargs) ? args[i] : NULL;
+  }
+
+  const Py_ssize_t n_keywords =
+      (kwnames == NULL) ? 0 : PyTuple_GET_SIZE(kwnames);
+
+  for (Py_ssize_t k = 0; k < n_keywords; k++) {
+    PyObject *name = PyTuple_GET_ITEM(kwnames, k);
+
+    Py_ssize_t i = 0;
+
+    while (i < n &&
+           PyUnicode_CompareWithASCIIString(name, keyword_names[i]) != 0) {
+      i++;
+    }
+
+    if (i == n) {
+      PyErr_Format(PyExc_TypeError, "'%U' is an invalid keyword argument",
+                   name);
+      return false;
+    }
+
+    if (values[i] != NULL) {
+      PyErr_Format(PyExc_TypeError, "argument '%s' given twice",
+                   keyword_names[i]);
+      return false;
+    }
+
+    values[i] = args[nargs + k];
+  }
+
+  for (Py_ssize_t i = 0; i < n; i++) {
+    if (values[i] == NULL) {
+      PyErr_Format(PyExc_TypeError, "missing required argument '%s'",
+                   keyword_names[i]);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Parse a sequence of (move, game state, prior probability) tuples
+static bool parse_expansion(
+    PyObject *expansion_sequence,
+    std::vector<MCTS<PythonHandle, PythonHandle>::ExpansionEntry> &expansion) {
+  PythonHandle expansion_fast(
+      PySequence_Fast(expansion_sequence, "expansion must be iterable"));
+
+  if (expansion_fast.null()) {
+    return false;
+  }
+
+  const Py_ssize_t n = PySequence_Fast_GET_SIZE(expansion_fast.object);
+  PyObject **expansion_elems = PySequence_Fast_ITEMS(expansion_fast.object);
+
+  try {
+    expansion.reserve(expansion.size() + (size_t)n);
+
+    for (Py_ssize_t i = 0; i < n; i++) {
+      PyObject *expansion_elem = expansion_elems[i];
+
+      if (!assert_tuple_length(expansion_elem, 3)) {
+        return false;
+      }
+
+      const double prior_probability =
+          PyFloat_AsDouble(PyTuple_GET_ITEM(expansion_elem, 2));
+
+      if (prior_probability == -1.0 && PyErr_Occurred()) {
+        return false;
+      }
+
+      MCTS<PythonHandle, PythonHandle>::ExpansionEntry expansion_entry = {
+          PythonHandle::copy(PyTuple_GET_ITEM(expansion_elem, 0)),
+          PythonHandle::copy(PyTuple_GET_ITEM(expansion_elem, 1)),
+          prior_probability};
+
+      expansion.emplace_back(std::move(expansion_entry));
+    }
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return false;
+  }
+
+  return true;
+}
+
+static PythonHandle history_to_list(
+    std::vector<MCTS<PythonHandle, PythonHandle>::HistoryEntry> &history) {
+  return iterator_to_list(
+      history.begin(), history.end(),
+      [](MCTS<PythonHandle, PythonHandle>::HistoryEntry &entry) {
+        const auto lambda =
+            [](std::pair<PythonHandle, double> &move_and_probability) {
+              PythonHandle tuple(
+                  Py_BuildValue("Nd", move_and_probability.first.object,
+                                move_and_probability.second));
+
+              if (tuple.null()) {
+                return PythonHandle(NULL);
+              }
+
+              move_and_probability.first.steal();
+
+              return tuple;
+            };
+
+        PythonHandle search_probabilities =
+            iterator_to_list(entry.search_probabilities.begin(),
+                             entry.search_probabilities.end(), lambda);
+
+        PythonHandle tuple(PyTuple_New(2));
+
+        if (tuple.null()) {
+          return PythonHandle(NULL);
+        }
+
+        PyTuple_SET_ITEM(tuple.object, 0, entry.game_state.steal());
+        PyTuple_SET_ITEM(tuple.object, 1, search_probabilities.steal());
+
+        return tuple;
+      });
+}
+
+bool PythonGame::outcome(const State &state, bool &terminal, double &av) {
+  PythonHandle outcome(PyObject_CallMethod(state.object, "outcome", NULL));
+
+  if (outcome.null()) {
+    return false;
+  }
+
+  terminal = (outcome.object != Py_None);
+
+  if (terminal) {
+    av = PyFloat_AsDouble(outcome.object);
+
+    if (av == -1.0 && PyErr_Occurred()) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template <class Entry>
+bool PythonGame::expand(const State &state, const Policy &policy,
+                        std::vector<Entry> &expansion) {
+  PythonHandle moves(PyObject_CallMethod(state.object, "moves", NULL));
+
+  if (moves.null()) {
+    return false;
+  }
+
+  PythonHandle moves_iter(PyObject_GetIter(moves.object));
+
+  if (moves_iter.null()) {
+    return false;
+  }
+
+  double sum = 0.0;
+
+  for (;;) {
+    PythonHandle move(PyIter_Next(moves_iter.object));
+
+    if (move.null()) {
+      break;
+    }
+
+    PythonHandle prior_object(PyObject_GetItem(policy.object, move.object));
+
+    if (prior_object.null()) {
+      return false;
+    }
+
+    const double prior = PyFloat_AsDouble(prior_object.object);
+
+    if (prior == -1.0 && PyErr_Occurred()) {
+      return false;
+    }
+
+    expansion.push_back({std::move(move), prior});
+    sum += prior;
+  }
+
+  if (PyErr_Occurred()) {
+    return false;
+  }
+
+  // Renormalize over the legal moves, falling back to uniform priors if the
+  // policy puts no mass on any of them
+  for (auto &entry : expansion) {
+    entry.prior_probability = (sum > 0.0) ? (entry.prior_probability / sum)
+                                          : (1.0 / expansion.size());
+  }
+
+  return true;
+}
+
+static PythonHandle features_to_bytes(const ConnectKRules &rules,
+                                      const BitboardConnectK &state) {
+  PythonHandle bytes(PyBytes_FromStringAndSize(
+      NULL, (Py_ssize_t)(rules.n_features() * sizeof(float))));
+
+  if (bytes.null()) {
+    return PythonHandle(NULL);
+  }
+
+  rules.position(state, (float *)PyBytes_AS_STRING(bytes.object));
+
+  return bytes;
+}
+
+// The records of each position of a finished game in turn (and of its
+// mirror image, if the rules are symmetric), with the outcome from the
+// perspective of the player to move in each
+static PythonHandle
+result_to_records(const ConnectKRules &rules,
+                  const SelfPlayEngine<ConnectKRules>::Result &result) {
+  const size_t record_size =
+      rules.records_per_position() * rules.record_size();
+
+  PythonHandle bytes(PyBytes_FromStringAndSize(
+      NULL, (Py_ssize_t)(result.history.size() * record_size)));
+
+  if (bytes.null()) {
+    return PythonHandle(NULL);
+  }
+
+  auto out = (uint8_t *)PyBytes_AS_STRING(bytes.object);
+  double outcome = result.score;
+
+  for (const auto &entry : result.history) {
+    rules.write_records(entry.game_state, outcome,
+                        entry.search_probabilities, out);
+
+    out += record_size;
+    outcome = -outcome;
+  }
+
+  return bytes;
+}
+
+// Export a C-contiguous buffer of native float32 holding at least length
+// elements; any shape is accepted
+static bool get_float_buffer(PyObject *object, bool writable, size_t length,
+                             BufferView &buffer) {
+  const int flags =
+      PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0);
+
+  if (PyObject_GetBuffer(object, &buffer.view, flags) < 0) {
+    return false;
+  }
+
+  buffer.acquired = true;
+
+  const char *format = (buffer.view.format == NULL) ? "B" : buffer.view.format;
+
+  if (format[0] == '@' || format[0] == '=' ||
+      (format[0] == '<' && PY_LITTLE_ENDIAN) ||
+      (format[0] == '>' && !PY_LITTLE_ENDIAN)) {
+    format++;
+  }
+
+  if (strcmp(format, "f") != 0 || buffer.view.itemsize != sizeof(float)) {
+    PyErr_SetString(PyExc_TypeError, "expected a buffer of float32");
+    return false;
+  }
+
+  if ((size_t)buffer.view.len < length * sizeof(float)) {
+    PyErr_Format(PyExc_ValueError,
+                 "expected a buffer of at least %zu float32 element(s)",
+                 length);
+    return false;
+  }
+
+  return true;
+}
+
+bool PythonGame::play(const State &parent, const Move &move, State &state) {
+  state = PythonHandle(
+      PyObject_CallMethod(parent.object, "play", "O", move.object));
+  return !state.null();
+}
+
+bool PythonGame::encode_move(const Move &move, uint32_t &code) {
+  const unsigned long value = PyLong_AsUnsignedLong(move.object);
+
+  if (value == (unsigned long)-1 && PyErr_Occurred()) {
+    return false;
+  }
+
+  if (value > UINT32_MAX) {
+    PyErr_SetString(PyExc_OverflowError,
+                    "moves must be below 2**32 to be saved in an image");
+    return false;
+  }
+
+  code = (uint32_t)value;
+  return true;
+}
+
+bool PythonGame::decode_move(uint32_t code, Move &move) {
+  move = PythonHandle(PyLong_FromUnsignedLong(code));
+  return !move.null();
+}
+
+// View the buffer exported by object as a tree image, held by book
+static bool open_book(PyObject *object, OpeningBook &book) {
+  if (PyObject_GetBuffer(object, &book.buffer.view, PyBUF_C_CONTIGUOUS) < 0) {
+    return false;
+  }
+
+  book.buffer.acquired = true;
+
+  if (!book.image.view(book.buffer.view.buf, (size_t)book.buffer.view.len)) {
+    PyErr_SetString(PyExc_ValueError, "expected a tree image");
+    return false;
+  }
+
+  return true;
+}
+
+// Replace the opening book of engine, held in book, with the tree image
+// exported by the argument, or with none given None
+template <class Engine>
+static PyObject *set_opening_book(Engine &engine,
+                                  std::unique_ptr<OpeningBook> &book,
+                                  PyObject *args, PyObject *kwargs) {
+  static char book_str[] = "book";
+  static char *keyword_names[] = {book_str, NULL};
+
+  PyObject *book_object;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", keyword_names,
+                                   &book_object)) {
+    return NULL;
+  }
+
+  std::unique_ptr<OpeningBook> opened;
+
+  try {
+    if (book_object != Py_None) {
+      opened.reset(new OpeningBook());
+
+      if (!open_book(book_object, *opened)) {
+        return NULL;
+      }
+    }
+
+    if (!engine.set_opening_book(opened ? &opened->image : nullptr)) {
+      book.reset();
+
+      if (!PyErr_Occurred()) {
+        PyErr_SetString(PyExc_ValueError,
+                        "opening book holds a move the game doesn't have");
+      }
+
+      return NULL;
+    }
+  } catch (std::bad_alloc &) {
+    engine.set_opening_book(nullptr);
+    book.reset();
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  book = std::move(opened);
+
+  Py_RETURN_NONE;
+}
+
+// Build the state of node, or of the root if node is NULL, if it was
+// expanded lazily
+static bool materialize(MCTS<PythonHandle, PythonHandle> &mcts,
+                        MCTS<PythonHandle, PythonHandle>::Node *node) {
+  PythonGame game;
+
+  const auto play = [&game](const PythonHandle &parent,
+                            const PythonHandle &move, PythonHandle &state) {
+    return game.play(parent, move, state);
+  };
+
+  try {
+    return (node == NULL) ? mcts.materialize_root(play)
+                          : mcts.materialize(node, play);
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return false;
+  }
+}
+
+// Check that slot indexes one of the channel's slots, or set an exception
+static bool parse_slot(const EvaluationChannel &channel, Py_ssize_t slot) {
+  if (slot < 0 || (size_t)slot >= channel.n_slots()) {
+    PyErr_Format(PyExc_IndexError, "slot %zd is out of range", slot);
+    return false;
+  }
+
+  return true;
+}
+
+static PyObject *scheduler_create(PyTypeObject *type, PyObject *args,
+                                  PyObject *kwargs) {
+  PyObject *channel_object;
+  PyObject *evaluate;
+  Py_ssize_t streams = 1;
+  Py_ssize_t max_batch = 0;
+  double max_delay = 0.001;
+
+  static char channel_str[] = "channel";
+  static char evaluate_str[] = "evaluate";
+  static char streams_str[] = "streams";
+  static char max_batch_str[] = "max_batch";
+  static char max_delay_str[] = "max_delay";
+
+  static char *keyword_names[] = {channel_str,   evaluate_str,
+                                  streams_str,   max_batch_str,
+                                  max_delay_str, NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O|nnd", keyword_names,
+                                   channel_type_object, &channel_object,
+                                   &evaluate, &streams, &max_batch,
+                                   &max_delay)) {
+    return NULL;
+  }
+
+  if (!PyCallable_Check(evaluate)) {
+    PyErr_SetString(PyExc_TypeError, "evaluate must be callable");
+    return NULL;
+  }
+
+  if (streams <= 0 || max_batch < 0 || !(max_delay >= 0.0)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "streams must be positive, and max_batch and max_delay "
+                    "non-negative");
+    return NULL;
+  }
+
+  EvaluationChannel &channel = ((PyEvaluationChannel *)channel_object)->channel;
+
+  // By default, every position the channel can hold at once
+  if (max_batch == 0) {
+    max_batch = (Py_ssize_t)(channel.n_slots() * channel.batch_capacity());
+  }
+
+  if (max_batch == 0) {
+    PyErr_SetString(PyExc_ValueError, "channel holds no positions");
+    return NULL;
+  }
+
+  PythonHandle self(PyObject_New(PyObject, type));
+
+  if (self.null()) {
+    return NULL;
+  }
+
+  auto py_scheduler = (PyInferenceScheduler *)self.object;
+
+  new (&py_scheduler->channel) PythonHandle(PythonHandle::copy(channel_object));
+  new (&py_scheduler->backend)
+      PythonBackend(PythonHandle::copy(evaluate),
+                    channel.features_per_position(),
+                    channel.priors_per_position());
+  new (&py_scheduler->scheduler) std::unique_ptr<InferenceScheduler>();
+
+  try {
+    py_scheduler->scheduler.reset(new InferenceScheduler(
+        channel, py_scheduler->backend, (size_t)streams, (size_t)max_batch,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::duration<double>(max_delay))));
+  } catch (std::bad_alloc &) {
+    PyErr_NoMemory();
+    return NULL;
+  } catch (std::system_error &) {
+    PyErr_SetString(PyExc_RuntimeError, "failed to start scheduler threads");
+    return NULL;
+  }
+
+  return self.steal();
+}
+
+static void scheduler_destroy(PyObject *self) {
+  auto py_scheduler = (PyInferenceScheduler *)self;
+
+  // The streams take the GIL to evaluate
+  Py_BEGIN_ALLOW_THREADS;
+  py_scheduler->scheduler.reset();
+  Py_END_ALLOW_THREADS;
+
+  py_scheduler->scheduler.~unique_ptr();
+  py_scheduler->backend.~PythonBackend();
+  py_scheduler->channel.~PythonHandle();
+  Py_TYPE(self)->tp_free(self);
+}
+
+static PyObject *scheduler_set_generation(PyObject *self, PyObject *args,
+                                          PyObject *kwargs) {
+  static char generation_str[] = "generation";
+  static char *keyword_names[] = {generation_str, NULL};
+
+  unsigned long long generation;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "K", keyword_names,
+                                   &generation)) {
+    return NULL;
+  }
+
+  ((PyInferenceScheduler *)self)
+      ->scheduler->set_generation((uint64_t)generation);
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *scheduler_stats(PyObject *self, PyObject *args) {
+  (void)args;
+  const auto stats = ((PyInferenceScheduler *)self)->scheduler->stats();
+
+  return Py_BuildValue("{s:K,s:K,s:K,s:K}", "batches",
+                       (unsigned long long)stats.batches, "positions",
+                       (unsigned long long)stats.positions, "full_batches",
+                       (unsigned long long)stats.full_batches, "evaluate_ns",
+                       (unsigned long long)stats.evaluate_ns);
+}
+
+static PyObject *scheduler_failed(PyObject *self, PyObject *args) {
+  (void)args;
+  return PyBool_FromLong(((PyInferenceScheduler *)self)->scheduler->failed());
+}
+
+// Raise the exception that failed an evaluation, if any, once
+static PyObject *scheduler_check(PyObject *self, PyObject *args) {
+  (void)args;
+  PythonBackend &backend = ((PyInferenceScheduler *)self)->backend;
+
+  if (backend.error_type != NULL) {
+    PyErr_Restore(backend.error_type, backend.error_value,
+                  backend.error_traceback);
+
+    backend.error_type = NULL;
+    backend.error_value = NULL;
+    backend.error_traceback = NULL;
+
+    return NULL;
+  }
+
+  if (((PyInferenceScheduler *)self)->scheduler->failed()) {
+    PyErr_SetString(PyExc_RuntimeError, "evaluation failed");
+    return NULL;
+  }
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *scheduler_stop(PyObject *self, PyObject *args) {
+  (void)args;
+  InferenceScheduler &scheduler = *((PyInferenceScheduler *)self)->scheduler;
+
+  Py_BEGIN_ALLOW_THREADS;
+  scheduler.stop();
+  Py_END_ALLOW_THREADS;
+
+  Py_RETURN_NONE;
+}
+
+bool PythonBackend::evaluate(size_t stream, size_t n, const float *features,
+                             float *values, float *policies) {
+  PyGILState_STATE state = PyGILState_Ensure();
+
+  const bool ok = evaluate_locked(stream, n, features, values, policies);
+
+  PyGILState_Release(state);
+
+  return ok;
+}
+
+bool PythonBackend::evaluate_locked(size_t stream, size_t n,
+                                    const float *features, float *values,
+                                    float *policies) {
+  PythonHandle views[3] = {float_view(features, n, n_features, false),
+                           float_view(values, n, 0, true),
+                           float_view(policies, n, policy_width, true)};
+
+  bool ok = !views[0].null() && !views[1].null() && !views[2].null();
+
+  if (ok) {
+    PythonHandle result(PyObject_CallFunction(
+        evaluate_.object, "nOOO", (Py_ssize_t)stream, views[0].object,
+        views[1].object, views[2].object));
+
+    ok = !result.null();
+  }
+
+  if (!ok) {
+    keep_error();
+  }
+
+  // The memory is only valid for the call, so a view still exported fails
+  // the evaluation
+  for (PythonHandle &view : views) {
+    if (view.null()) {
+      continue;
+    }
+
+    PythonHandle released(PyObject_CallMethod(view.object, "release", NULL));
+
+    if (released.null()) {
+      ok = false;
+      keep_error();
+    }
+  }
+
+  return ok;
+}
+
+void PythonBackend::keep_error() {
+  if (error_type == NULL) {
+    PyErr_Fetch(&error_type, &error_value, &error_traceback);
+  } else {
+    PyErr_Clear();
+  }
+}
+
+// A memoryview of float32 over rows by columns floats, or of rows floats
+// given no columns
+static PythonHandle float_view(const float *floats, size_t rows,
+                               size_t columns, bool writable) {
+  static char format[] = "f";
+
+  Py_ssize_t shape[2] = {(Py_ssize_t)rows, (Py_ssize_t)columns};
+  Py_ssize_t strides[2] = {(Py_ssize_t)(columns * sizeof(float)),
+                           (Py_ssize_t)sizeof(float)};
+
+  if (columns == 0) {
+    strides[0] = (Py_ssize_t)sizeof(float);
+  }
+
+  Py_buffer buffer;
+  memset(&buffer, 0, sizeof(buffer));
+
+  buffer.buf = (void *)floats;
+  buffer.len = (Py_ssize_t)(rows * std::max(columns, (size_t)1) *
+                            sizeof(float));
+  buffer.itemsize = sizeof(float);
+  buffer.readonly = !writable;
+  buffer.ndim = (columns == 0) ? 1 : 2;
+  buffer.format = format;
+  buffer.shape = shape;
+  buffer.strides = strides;
+
+  return PythonHandle(PyMemoryView_FromBuffer(&buffer));
 }
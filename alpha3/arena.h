@@ -0,0 +1,298 @@
+#ifndef ALPHA3_ARENA_H
+#define ALPHA3_ARENA_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Slab allocator backing MCTS nodes. Each size class is served from large,
+// chunk-aligned slabs of equally sized slots; consecutive allocations take
+// the lowest free slot of the current slab, so blocks allocated together
+// (e.g. by successive expansions) are adjacent, and freed slots are refilled
+// in address order rather than scattered LIFO. Blocks too large for a slab
+// come straight from the heap. Slabs are returned to the system by trim,
+// once empty, and when the arena is destroyed.
+class NodeArena {
+public:
+  static constexpr size_t granule = alignof(std::max_align_t);
+
+  explicit NodeArena(size_t chunk_size_ = (size_t)1 << 20)
+      : chunk_size(chunk_size_) {
+    assert((chunk_size & (chunk_size - 1)) == 0);
+  }
+
+  NodeArena(const NodeArena &) = delete;
+
+  NodeArena(NodeArena &&other)
+      : chunk_size(other.chunk_size), classes(std::move(other.classes)),
+        live_bytes_(other.live_bytes_), reserved_bytes_(other.reserved_bytes_),
+        allocations_(other.allocations_), recycled_(other.recycled_) {
+    other.classes.clear();
+    other.live_bytes_ = 0;
+    other.reserved_bytes_ = 0;
+  }
+
+  NodeArena &operator=(const NodeArena &) = delete;
+
+  ~NodeArena() {
+    for (auto &size_class : classes) {
+      for (Slab *slab : size_class.slabs) {
+        free(slab);
+      }
+    }
+  }
+
+  // Bytes of the blocks allocated and not yet deallocated
+  size_t live_bytes() const { return live_bytes_; }
+
+  // Bytes held from the system but not allocated
+  size_t free_bytes() const { return reserved_bytes_ - live_bytes_; }
+
+  // Blocks allocated over the arena's lifetime, and those of them placed in
+  // slots freed by earlier blocks
+  uint64_t allocations() const { return allocations_; }
+
+  uint64_t recycled() const { return recycled_; }
+
+  void *allocate(size_t size) {
+    size = round_up(size);
+
+    allocations_++;
+
+    if (size > max_slot_size()) {
+      void *block = ::operator new(size);
+      live_bytes_ += size;
+      reserved_bytes_ += size;
+      return block;
+    }
+
+    SizeClass &size_class = lookup(size);
+
+    for (;;) {
+      if (size_class.current < size_class.slabs.size()) {
+        Slab *slab = size_class.slabs[size_class.current];
+        bool recycled;
+        void *block = slab->take(size, recycled);
+
+        if (block != nullptr) {
+          live_bytes_ += size;
+          recycled_ += recycled;
+          return block;
+        }
+
+        size_class.current++;
+        continue;
+      }
+
+      Slab *slab = new_slab(size, size_class.slabs.size());
+      size_class.current = size_class.slabs.size();
+      size_class.slabs.push_back(slab);
+      reserved_bytes_ += chunk_size;
+    }
+  }
+
+  void deallocate(void *block, size_t size) {
+    size = round_up(size);
+
+    live_bytes_ -= size;
+
+    if (size > max_slot_size()) {
+      ::operator delete(block);
+      reserved_bytes_ -= size;
+      return;
+    }
+
+    Slab *slab = (Slab *)((uintptr_t)block & ~(uintptr_t)(chunk_size - 1));
+    slab->give(block, size);
+
+    SizeClass &size_class = lookup(size);
+
+    if (slab->index < size_class.current) {
+      size_class.current = slab->index;
+    }
+  }
+
+  // Return every empty slab to the system
+  void trim() {
+    for (auto &size_class : classes) {
+      size_t kept = 0;
+
+      for (Slab *slab : size_class.slabs) {
+        if (slab->live == 0) {
+          free(slab);
+          reserved_bytes_ -= chunk_size;
+          continue;
+        }
+
+        slab->index = kept;
+        size_class.slabs[kept++] = slab;
+      }
+
+      size_class.slabs.resize(kept);
+      size_class.current = 0;
+    }
+  }
+
+private:
+  struct Slab {
+    // Position in the size class's list of slabs
+    size_t index;
+
+    size_t capacity;
+    size_t live;
+
+    // Slots below cursor are all occupied, and those from high_water on have
+    // never been
+    size_t cursor;
+    size_t high_water;
+
+    char *slots;
+    uint64_t *free_bits;
+
+    void *take(size_t size, bool &recycled) {
+      const size_t words = (capacity + 63) / 64;
+
+      for (size_t word = cursor / 64; word < words; word++) {
+        if (free_bits[word] == 0) {
+          continue;
+        }
+
+        const size_t bit = (size_t)__builtin_ctzll(free_bits[word]);
+        free_bits[word] &= free_bits[word] - 1;
+
+        const size_t slot = word * 64 + bit;
+        cursor = slot;
+        live++;
+
+        recycled = (slot < high_water);
+        high_water = std::max(high_water, slot + 1);
+
+        return slots + slot * size;
+      }
+
+      cursor = capacity;
+      return nullptr;
+    }
+
+    void give(void *block, size_t size) {
+      const size_t slot = (size_t)((char *)block - slots) / size;
+      assert(slot < capacity);
+
+      free_bits[slot / 64] |= (uint64_t)1 << (slot % 64);
+      live--;
+
+      if (slot < cursor) {
+        cursor = slot;
+      }
+    }
+  };
+
+  struct SizeClass {
+    std::vector<Slab *> slabs;
+
+    // No slab before this one has a free slot
+    size_t current = 0;
+  };
+
+  const size_t chunk_size;
+
+  std::vector<SizeClass> classes;
+
+  size_t live_bytes_ = 0;
+  size_t reserved_bytes_ = 0;
+
+  uint64_t allocations_ = 0;
+  uint64_t recycled_ = 0;
+
+  static size_t round_up(size_t size) {
+    return (size + granule - 1) / granule * granule;
+  }
+
+  size_t max_slot_size() const { return chunk_size / 8; }
+
+  SizeClass &lookup(size_t size) {
+    const size_t index = size / granule;
+
+    if (index >= classes.size()) {
+      classes.resize(index + 1);
+    }
+
+    return classes[index];
+  }
+
+  Slab *new_slab(size_t size, size_t index) {
+    void *memory = aligned_alloc(chunk_size, chunk_size);
+
+    if (memory == nullptr) {
+      throw std::bad_alloc();
+    }
+
+    const size_t header = round_up(sizeof(Slab));
+
+    // Solve header + capacity * size + ceil(capacity / 64) * 8 <= chunk_size
+    size_t capacity = (chunk_size - header) / size;
+
+    while (header + capacity * size + (capacity + 63) / 64 * 8 > chunk_size) {
+      capacity--;
+    }
+
+    Slab *slab = new (memory) Slab;
+
+    slab->index = index;
+    slab->capacity = capacity;
+    slab->live = 0;
+    slab->cursor = 0;
+    slab->high_water = 0;
+    slab->slots = (char *)memory + header;
+    slab->free_bits = (uint64_t *)(slab->slots + capacity * size);
+
+    const size_t words = (capacity + 63) / 64;
+
+    for (size_t word = 0; word < words; word++) {
+      const size_t remaining = capacity - word * 64;
+      slab->free_bits[word] =
+          (remaining >= 64) ? ~(uint64_t)0 : (((uint64_t)1 << remaining) - 1);
+    }
+
+    return slab;
+  }
+};
+
+// Allocates every block straight from the global heap.
+class HeapAllocator {
+public:
+  size_t live_bytes() const { return live_bytes_; }
+
+  size_t free_bytes() const { return 0; }
+
+  // Whether the heap reused memory is not known, so no block counts as
+  // recycled
+  uint64_t allocations() const { return allocations_; }
+
+  uint64_t recycled() const { return 0; }
+
+  void *allocate(size_t size) {
+    void *block = ::operator new(size);
+    live_bytes_ += size;
+    allocations_++;
+    return block;
+  }
+
+  void deallocate(void *block, size_t size) {
+    live_bytes_ -= size;
+    ::operator delete(block);
+  }
+
+  void trim() {}
+
+private:
+  size_t live_bytes_ = 0;
+  uint64_t allocations_ = 0;
+};
+
+#endif
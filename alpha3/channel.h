@@ -0,0 +1,312 @@
+#ifndef ALPHA3_CHANNEL_H
+#define ALPHA3_CHANNEL_H
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifdef __linux__
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <thread>
+#endif
+
+// Exchanges batches of features and evaluations between processes through a
+// region of shared memory, without serializing them. The region holds one
+// slot per client (a self-play worker, say), each with room for a batch of
+// features and of evaluations. A client writes its features into its slot
+// and posts a request; the server collects every posted request, writes the
+// evaluations back into the slots and responds to each. Each slot carries
+// one request at a time, and each request is collected once, so the server
+// may respond to the requests it has collected in any order (or from other
+// threads) while it collects more.
+//
+// Waiting is done on futexes in the region itself (or by polling, off
+// Linux): the server waits on a doorbell rung by every request, and each
+// client on its slot's response count. The region is laid out as
+//
+//   Header, then for each slot
+//     SlotHeader
+//     float features[capacity * n_features]
+//     float values[capacity]
+//     float policies[capacity * policy_width]
+//
+// with each part aligned to a cache line. The memory must start out zeroed,
+// as fresh shared memory is.
+class EvaluationChannel {
+public:
+  static constexpr size_t alignment = 64;
+
+  EvaluationChannel(void *memory_, size_t slots_, size_t capacity_,
+                    size_t n_features_, size_t policy_width_)
+      : memory((uint8_t *)memory_), slots(slots_), capacity(capacity_),
+        n_features(n_features_), policy_width(policy_width_),
+        taken(slots_, 0) {
+    assert(((uintptr_t)memory & (alignment - 1)) == 0);
+  }
+
+  static size_t size(size_t slots, size_t capacity, size_t n_features,
+                     size_t policy_width) {
+    return round_up(sizeof(Header)) +
+           slots * slot_size(capacity, n_features, policy_width);
+  }
+
+  size_t size() const {
+    return size(slots, capacity, n_features, policy_width);
+  }
+
+  size_t n_slots() const { return slots; }
+
+  size_t batch_capacity() const { return capacity; }
+
+  size_t features_per_position() const { return n_features; }
+
+  size_t priors_per_position() const { return policy_width; }
+
+  // Byte offsets of the features, values and policies of slot within the
+  // region
+  size_t features_offset(size_t slot) const {
+    return slot_offset(slot) + round_up(sizeof(SlotHeader));
+  }
+
+  size_t values_offset(size_t slot) const {
+    return features_offset(slot) +
+           round_up(capacity * n_features * sizeof(float));
+  }
+
+  size_t policies_offset(size_t slot) const {
+    return values_offset(slot) + round_up(capacity * sizeof(float));
+  }
+
+  float *features(size_t slot) const {
+    return (float *)(memory + features_offset(slot));
+  }
+
+  float *values(size_t slot) const {
+    return (float *)(memory + values_offset(slot));
+  }
+
+  float *policies(size_t slot) const {
+    return (float *)(memory + policies_offset(slot));
+  }
+
+  bool closed() const {
+    return __atomic_load_n(&header().closed, __ATOMIC_ACQUIRE) != 0;
+  }
+
+  // Wake every waiter, and fail every wait from now on
+  void close() {
+    __atomic_store_n(&header().closed, (uint32_t)1, __ATOMIC_RELEASE);
+
+    wake(&header().doorbell);
+
+    for (size_t slot = 0; slot < slots; slot++) {
+      wake(&slot_header(slot).response);
+    }
+  }
+
+  // Client: post the n features written into slot
+  void request(size_t slot, size_t n) {
+    assert(n <= capacity);
+
+    SlotHeader &slot_header_ = slot_header(slot);
+    slot_header_.n = (uint32_t)n;
+
+    __atomic_fetch_add(&slot_header_.request, 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&header().doorbell, 1, __ATOMIC_RELEASE);
+
+    wake(&header().doorbell);
+  }
+
+  // Client: wait for the response to the request posted on slot, and set
+  // the generation it was tagged with. Fails once the channel is closed
+  bool wait_response(size_t slot, uint64_t &generation) {
+    for (;;) {
+      if (wait_response_for(slot, generation, client_timeout)) {
+        return true;
+      }
+
+      if (closed()) {
+        return false;
+      }
+    }
+  }
+
+  // Client: as wait_response, but failing once timeout passes, too
+  template <class Rep, class Period>
+  bool wait_response_for(size_t slot, uint64_t &generation,
+                         std::chrono::duration<Rep, Period> timeout) {
+    SlotHeader &slot_header_ = slot_header(slot);
+
+    const uint32_t request =
+        __atomic_load_n(&slot_header_.request, __ATOMIC_RELAXED);
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    for (;;) {
+      const uint32_t response =
+          __atomic_load_n(&slot_header_.response, __ATOMIC_ACQUIRE);
+
+      if (response == request) {
+        generation = slot_header_.generation;
+        return true;
+      }
+
+      const auto now = std::chrono::steady_clock::now();
+
+      if (closed() || now >= deadline) {
+        return false;
+      }
+
+      // A close may land between the check and the wait, so the wait is
+      // bounded
+      wait(&slot_header_.response, response,
+           std::min<std::chrono::steady_clock::duration>(deadline - now,
+                                                         client_timeout));
+    }
+  }
+
+  // Server: wait up to timeout for posted requests, and append those not
+  // yet collected as (slot, n) pairs. Returns nothing once closed
+  template <class Rep, class Period>
+  void wait_requests(std::chrono::duration<Rep, Period> timeout,
+                     std::vector<std::pair<size_t, size_t>> &requests) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    for (;;) {
+      const uint32_t doorbell =
+          __atomic_load_n(&header().doorbell, __ATOMIC_ACQUIRE);
+
+      if (closed()) {
+        return;
+      }
+
+      for (size_t slot = 0; slot < slots; slot++) {
+        SlotHeader &slot_header_ = slot_header(slot);
+
+        const uint32_t request =
+            __atomic_load_n(&slot_header_.request, __ATOMIC_ACQUIRE);
+
+        if (request != taken[slot]) {
+          taken[slot] = request;
+          requests.emplace_back(slot, (size_t)slot_header_.n);
+        }
+      }
+
+      const auto now = std::chrono::steady_clock::now();
+
+      if (!requests.empty() || now >= deadline) {
+        return;
+      }
+
+      wait(&header().doorbell, doorbell,
+           std::chrono::duration_cast<std::chrono::nanoseconds>(deadline -
+                                                                now));
+    }
+  }
+
+  // Server: respond to the request collected from slot, once its
+  // evaluations are written
+  void respond(size_t slot, uint64_t generation) {
+    SlotHeader &slot_header_ = slot_header(slot);
+
+    slot_header_.generation = generation;
+
+    __atomic_store_n(&slot_header_.response, taken[slot], __ATOMIC_RELEASE);
+    wake(&slot_header_.response);
+  }
+
+private:
+  struct Header {
+    // Rung by every request
+    uint32_t doorbell;
+    uint32_t closed;
+  };
+
+  struct SlotHeader {
+    // Requests posted and responded to; a request is pending while they
+    // differ
+    uint32_t request;
+    uint32_t response;
+
+    uint32_t n;
+    uint64_t generation;
+  };
+
+  static constexpr std::chrono::milliseconds client_timeout{100};
+
+  uint8_t *const memory;
+
+  const size_t slots;
+  const size_t capacity;
+  const size_t n_features;
+  const size_t policy_width;
+
+  // The last request collected from each slot. Each entry changes only once
+  // the previous request has been responded to, when the client posts again
+  std::vector<uint32_t> taken;
+
+  static size_t round_up(size_t size) {
+    return (size + alignment - 1) / alignment * alignment;
+  }
+
+  static size_t slot_size(size_t capacity, size_t n_features,
+                          size_t policy_width) {
+    return round_up(sizeof(SlotHeader)) +
+           round_up(capacity * n_features * sizeof(float)) +
+           round_up(capacity * sizeof(float)) +
+           round_up(capacity * policy_width * sizeof(float));
+  }
+
+  size_t slot_offset(size_t slot) const {
+    assert(slot < slots);
+    return round_up(sizeof(Header)) +
+           slot * slot_size(capacity, n_features, policy_width);
+  }
+
+  Header &header() const { return *(Header *)memory; }
+
+  SlotHeader &slot_header(size_t slot) const {
+    return *(SlotHeader *)(memory + slot_offset(slot));
+  }
+
+  // Sleep until *word may no longer hold value, or timeout passes. Futexes
+  // are shared between processes unless FUTEX_PRIVATE_FLAG is given
+  template <class Rep, class Period>
+  static void wait(uint32_t *word, uint32_t value,
+                   std::chrono::duration<Rep, Period> timeout) {
+    const auto nanoseconds =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+
+#ifdef __linux__
+    struct timespec relative;
+    relative.tv_sec = (time_t)(nanoseconds / 1000000000);
+    relative.tv_nsec = (long)(nanoseconds % 1000000000);
+
+    syscall(SYS_futex, word, FUTEX_WAIT, value, &relative, NULL, 0);
+#else
+    (void)nanoseconds;
+
+    if (__atomic_load_n(word, __ATOMIC_ACQUIRE) == value) {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+#endif
+  }
+
+  static void wake(uint32_t *word) {
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+  }
+};
+
+#endif
@@ -0,0 +1,359 @@
+#ifndef ALPHA3_CONNECTK_H
+#define ALPHA3_CONNECTK_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// A Connect-K position as a pair of bitboards. Cells are numbered column by
+// column from the bottom, bit (column * (rows + 1) + row), so that every
+// column has one always-empty bit above its top row; lines shifted along any
+// direction then never wrap into a neighbouring column. The two bits above
+// the board record whether the game is over and whether it was won.
+struct BitboardConnectK {
+  // Stones of the player to move
+  uint64_t current;
+
+  // Every stone on the board, plus the outcome bits
+  uint64_t mask;
+};
+
+static_assert(sizeof(BitboardConnectK) == 16, "unexpected padding");
+
+// The rules of Connect-K on a given board, operating on BitboardConnectK.
+// Also serves as the game adaptor of SelfPlayEngine, with policies given as
+// one prior per column.
+//
+// The board is mirror symmetric, so symmetric rules evaluate a position and
+// its mirror image as one: features, hash and expand all work on whichever
+// of the two has the lesser bitboards (the canonical position), so that
+// mirror images share a transposition, and policies evaluated on it are
+// mirrored back. Training records are then written in both orientations.
+class ConnectKRules {
+public:
+  typedef BitboardConnectK State;
+  typedef uint8_t Move;
+  typedef const float *Policy;
+
+  static constexpr bool transposable = true;
+
+  static constexpr uint64_t over_bit = (uint64_t)1 << 63;
+  static constexpr uint64_t won_bit = (uint64_t)1 << 62;
+
+  static bool valid(size_t rows, size_t columns, size_t k) {
+    return rows != 0 && columns != 0 && columns <= 255 && k != 0 &&
+           (rows + 1) * columns <= 62;
+  }
+
+  ConnectKRules(size_t rows_, size_t columns_, size_t k_,
+                bool symmetric_ = false)
+      : rows(rows_), columns(columns_), k(k_), height(rows_ + 1),
+        symmetric(symmetric_), bottom(0), board(0) {
+    assert(valid(rows, columns, k));
+
+    for (size_t column = 0; column < columns; column++) {
+      bottom |= (uint64_t)1 << (column * height);
+    }
+
+    board = bottom * column_cells();
+  }
+
+  size_t n_rows() const { return rows; }
+
+  size_t n_columns() const { return columns; }
+
+  // Features per position, as two planes of rows x columns
+  size_t n_features() const { return 2 * rows * columns; }
+
+  State initial() const { return {0, 0}; }
+
+  bool over(const State &state) const { return (state.mask & over_bit) != 0; }
+
+  // From the perspective of the player to move, who can only have lost
+  double outcome(const State &state) const {
+    assert(over(state));
+    return (state.mask & won_bit) ? -1.0 : 0.0;
+  }
+
+  bool legal(const State &state, size_t column) const {
+    return !over(state) && column < columns &&
+           (state.mask & top(column)) == 0;
+  }
+
+  State play(const State &state, size_t column) const {
+    assert(legal(state, column));
+
+    const uint64_t stones = state.mask & board;
+    const uint64_t moved = (stones + ((uint64_t)1 << (column * height))) &
+                           (column_cells() << (column * height));
+
+    const uint64_t next_stones = stones | moved;
+    const uint64_t mover = state.current | moved;
+
+    uint64_t flags = 0;
+
+    if (connected(mover)) {
+      flags = over_bit | won_bit;
+    } else if (next_stones == board) {
+      flags = over_bit;
+    }
+
+    return {stones ^ state.current, next_stones | flags};
+  }
+
+  // The position with its columns reversed
+  State mirror(const State &state) const {
+    return {mirror_cells(state.current),
+            mirror_cells(state.mask & board) | (state.mask & ~board)};
+  }
+
+  // Planes for the player to move and for their opponent, with row 0 at the
+  // top of the board
+  void position(const State &state, float *out) const {
+    const uint64_t stones = state.mask & board;
+    const uint64_t planes[2] = {state.current, stones ^ state.current};
+
+    for (size_t plane = 0; plane < 2; plane++) {
+      for (size_t row = 0; row < rows; row++) {
+        for (size_t column = 0; column < columns; column++) {
+          const size_t bit = column * height + (rows - 1 - row);
+          *(out++) = (float)((planes[plane] >> bit) & 1);
+        }
+      }
+    }
+  }
+
+  // The planes of the position to evaluate state by: its canonical one, if
+  // symmetric
+  void features(const State &state, float *out) const {
+    position(mirrored(state) ? mirror(state) : state, out);
+  }
+
+  // Training examples are packed into fixed-size records of
+  //
+  //   float outcome, for the player to move
+  //   float probabilities[columns], the search probabilities
+  //   uint8 features[], one bit per feature in the order of features, from
+  //         the least significant bit of each byte, padded with zeros to a
+  //         multiple of four bytes
+  //
+  // in native byte order, so that a run of records is an array of structs.
+  size_t record_size() const {
+    return (1 + columns) * sizeof(float) + (n_features() + 31) / 32 * 4;
+  }
+
+  // Records written for each position: two if symmetric, of the position and
+  // of its mirror image
+  size_t records_per_position() const { return symmetric ? 2 : 1; }
+
+  // Write the record of state into out, given its search probabilities as
+  // (column, probability) pairs, or none for uniform probabilities
+  template <class Probabilities>
+  void write_record(const State &state, double outcome,
+                    const Probabilities &probabilities, uint8_t *out) const {
+    const bool uniform = probabilities.begin() == probabilities.end();
+    const float fill = uniform ? (float)(1.0 / (double)columns) : 0.0f;
+    const float value = (float)outcome;
+
+    memcpy(out, &value, sizeof(float));
+
+    for (size_t column = 0; column < columns; column++) {
+      memcpy(out + (1 + column) * sizeof(float), &fill, sizeof(float));
+    }
+
+    for (const auto &probability : probabilities) {
+      const float p = (float)probability.second;
+      memcpy(out + (1 + (size_t)probability.first) * sizeof(float), &p,
+             sizeof(float));
+    }
+
+    pack(state, out + (1 + columns) * sizeof(float));
+  }
+
+  // Write the records_per_position records of state into out, as
+  // write_record, the mirror image's with its probabilities mirrored too
+  template <class Probabilities>
+  void write_records(const State &state, double outcome,
+                     const Probabilities &probabilities, uint8_t *out) const {
+    write_record(state, outcome, probabilities, out);
+
+    if (!symmetric) {
+      return;
+    }
+
+    uint8_t *image = out + record_size();
+
+    memcpy(image, out, sizeof(float));
+
+    for (size_t column = 0; column < columns; column++) {
+      memcpy(image + (1 + column) * sizeof(float),
+             out + (columns - column) * sizeof(float), sizeof(float));
+    }
+
+    pack(mirror(state), image + (1 + columns) * sizeof(float));
+  }
+
+  State copy(const State &state) const { return state; }
+
+  // The whole position fits in the two bitboards, so rather than maintain a
+  // Zobrist key alongside them, they are hashed directly (those of the
+  // canonical position, if symmetric)
+  uint64_t hash(const State &state) const {
+    const State canonical = mirrored(state) ? mirror(state) : state;
+
+    uint64_t x = canonical.current * 0x9e3779b97f4a7c15ULL ^ canonical.mask;
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93ULL;
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93ULL;
+    x ^= x >> 32;
+    return x;
+  }
+
+  size_t policy_width() const { return columns; }
+
+  // Moves are saved in tree images as their columns
+  bool encode_move(Move move, uint32_t &code) const {
+    code = move;
+    return true;
+  }
+
+  bool decode_move(uint32_t code, Move &move) const {
+    if (code >= columns) {
+      return false;
+    }
+
+    move = (Move)code;
+    return true;
+  }
+
+  bool play(const State &parent, Move move, State &state) const {
+    state = play(parent, move);
+    return true;
+  }
+
+  bool outcome(const State &state, bool &terminal, double &av) const {
+    terminal = over(state);
+
+    if (terminal) {
+      av = outcome(state);
+    }
+
+    return true;
+  }
+
+  // Policies carry a prior for every column, of the position features were
+  // taken from, and are renormalized over the legal ones
+  template <class Entry>
+  bool expand(const State &state, Policy policy,
+              std::vector<Entry> &expansion) const {
+    const bool flip = mirrored(state);
+
+    double sum = 0.0;
+
+    for (size_t column = 0; column < columns; column++) {
+      if (!legal(state, column)) {
+        continue;
+      }
+
+      const float prior = policy[flip ? columns - 1 - column : column];
+
+      expansion.push_back({(Move)column, (double)prior});
+      sum += prior;
+    }
+
+    for (auto &entry : expansion) {
+      entry.prior_probability = (sum > 0.0) ? (entry.prior_probability / sum)
+                                            : (1.0 / expansion.size());
+    }
+
+    return true;
+  }
+
+private:
+  size_t rows;
+  size_t columns;
+  size_t k;
+  size_t height;
+  bool symmetric;
+
+  // The bottom cell of every column, and every cell on the board
+  uint64_t bottom;
+  uint64_t board;
+
+  uint64_t column_cells() const { return ((uint64_t)1 << rows) - 1; }
+
+  uint64_t top(size_t column) const {
+    return (uint64_t)1 << (column * height + rows - 1);
+  }
+
+  uint64_t mirror_cells(uint64_t cells) const {
+    uint64_t mirrored = 0;
+
+    for (size_t column = 0; column < columns; column++) {
+      const uint64_t cells_ = (cells >> (column * height)) & column_cells();
+      mirrored |= cells_ << ((columns - 1 - column) * height);
+    }
+
+    return mirrored;
+  }
+
+  // Whether the canonical position of state is its mirror image: if
+  // symmetric, and the image orders first
+  bool mirrored(const State &state) const {
+    if (!symmetric) {
+      return false;
+    }
+
+    const State image = mirror(state);
+
+    return image.mask < state.mask ||
+           (image.mask == state.mask && image.current < state.current);
+  }
+
+  // Pack the planes of state one bit per feature into out, in the layout of
+  // write_record
+  void pack(const State &state, uint8_t *out) const {
+    const size_t packed = (n_features() + 31) / 32 * 4;
+    memset(out, 0, packed);
+
+    const uint64_t stones = state.mask & board;
+    const uint64_t planes[2] = {state.current, stones ^ state.current};
+
+    size_t i = 0;
+
+    for (size_t plane = 0; plane < 2; plane++) {
+      for (size_t row = 0; row < rows; row++) {
+        for (size_t column = 0; column < columns; column++, i++) {
+          const size_t bit = column * height + (rows - 1 - row);
+          out[i / 8] |= (uint8_t)(((planes[plane] >> bit) & 1) << (i % 8));
+        }
+      }
+    }
+  }
+
+  // Whether stones hold k in a row along any direction, by AND-ing the
+  // bitboard with itself shifted along that direction k - 1 times
+  bool connected(uint64_t stones) const {
+    const size_t directions[4] = {1, height, height - 1, height + 1};
+
+    for (size_t direction : directions) {
+      uint64_t run = stones;
+
+      for (size_t i = 1; i < k && run != 0; i++) {
+        const size_t shift = i * direction;
+        run = (shift < 64) ? (run & (stones >> shift)) : 0;
+      }
+
+      if (run != 0) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+};
+
+#endif
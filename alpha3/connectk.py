@@ -10,6 +10,18 @@ class ConnectK:
         self._position = np.zeros((2, rows, columns), dtype=bool)
         self._outcome = None
 
+    @property
+    def rows(self):
+        return self._rows
+
+    @property
+    def columns(self):
+        return self._columns
+
+    @property
+    def k(self):
+        return self._k
+
     def moves(self):
         if self._outcome is not None:
             return []
@@ -0,0 +1,222 @@
+#ifndef ALPHA3_HALVING_H
+#define ALPHA3_HALVING_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <vector>
+
+// A root policy for small visit budgets: Gumbel top-k sampling with
+// sequential halving, after Danihelka et al., "Policy improvement by planning
+// with Gumbel" (2022). Gumbel noise added to the log priors draws the
+// candidates, without replacement. The budget is then split evenly over
+// rounds, and within each round over the candidates left, the worse half of
+// which is dropped at its end. Candidates are ranked by their noisy log
+// prior plus
+//
+//   sigma(q) = (c_visit + max N) * c_scale * q
+//
+// of their value q, rescaled to [0, 1], so that values count for more as
+// visits grow. The best candidate left is the move to play, and the softmax
+// of the log priors plus sigma of every child's value (the root's, for
+// those unvisited) is an improved policy to train on.
+//
+// Works on a block of children of any layout, from one thread.
+class SequentialHalving {
+public:
+  static constexpr double c_visit = 50.0;
+  static constexpr double c_scale = 1.0;
+
+  SequentialHalving() : remaining(0), rounds(0), budget(0), target(0) {}
+
+  bool active() const { return remaining != 0; }
+
+  void clear() { remaining = 0; }
+
+  // Draw considered candidates (at least one) among children, to share
+  // budget visits
+  template <class Children, class Generator>
+  void start(Children &children, size_t budget_, size_t considered,
+             Generator &generator) {
+    const size_t n = children.size;
+
+    std::uniform_real_distribution<double> uniform(
+        std::numeric_limits<double>::min(), 1.0);
+
+    logits.resize(n);
+    scores.resize(n);
+    order.resize(n);
+
+    for (size_t i = 0; i < n; i++) {
+      logits[i] = std::log(std::max((double)children.prior(i),
+                                    std::numeric_limits<double>::min()));
+      scores[i] = logits[i] - std::log(-std::log(uniform(generator)));
+    }
+
+    remaining = std::min(std::max(considered, (size_t)1), n);
+
+    std::iota(order.begin(), order.end(), (size_t)0);
+    std::partial_sort(order.begin(), order.begin() + remaining, order.end(),
+                      [this](size_t a, size_t b) {
+                        return scores[a] > scores[b];
+                      });
+
+    rounds = std::max((size_t)std::ceil(std::log2((double)remaining)),
+                      (size_t)1);
+    budget = budget_;
+    target = 0;
+
+    extend_target();
+  }
+
+  // The candidate to visit next, given the root's value: the one least
+  // visited, counting pending visits, while it is under the round's target.
+  // Otherwise the round ends, and the worse half of the candidates is
+  // dropped first, unless some have visits pending, which are waited for
+  // (visiting the least visited past the target meanwhile) so that none is
+  // ranked before its value is known
+  template <class Children>
+  size_t select(Children &children, double value) {
+    for (;;) {
+      size_t best = order[0];
+      size_t least = visits(children, best);
+      bool pending = children.n_virtual(best) != 0;
+
+      for (size_t k = 1; k < remaining; k++) {
+        const size_t count = visits(children, order[k]);
+
+        if (count < least) {
+          best = order[k];
+          least = count;
+        }
+
+        pending = pending || children.n_virtual(order[k]) != 0;
+      }
+
+      if (remaining == 1 || least < target || pending) {
+        return best;
+      }
+
+      halve(children, value);
+    }
+  }
+
+  // The best of the candidates left, given the root's value
+  template <class Children> size_t best(Children &children, double value) {
+    const double scale = sigma_scale(children);
+
+    size_t best = order[0];
+    double best_score = -HUGE_VAL;
+
+    for (size_t k = 0; k < remaining; k++) {
+      const double score =
+          scores[order[k]] + scale * completed_q(children, order[k], value);
+
+      if (score > best_score) {
+        best = order[k];
+        best_score = score;
+      }
+    }
+
+    return best;
+  }
+
+  // The improved policy over every child, given the root's value
+  template <class Children>
+  void policy(Children &children, double value,
+              std::vector<double> &probabilities) {
+    const double scale = sigma_scale(children);
+    const size_t n = children.size;
+
+    probabilities.resize(n);
+
+    double max_logit = -HUGE_VAL;
+
+    for (size_t i = 0; i < n; i++) {
+      probabilities[i] = logits[i] + scale * completed_q(children, i, value);
+      max_logit = std::max(max_logit, probabilities[i]);
+    }
+
+    double sum = 0.0;
+
+    for (double &probability : probabilities) {
+      probability = std::exp(probability - max_logit);
+      sum += probability;
+    }
+
+    for (double &probability : probabilities) {
+      probability /= sum;
+    }
+  }
+
+private:
+  // Log priors, and those plus the Gumbel noise, by child
+  std::vector<double> logits;
+  std::vector<double> scores;
+
+  // Children by rank, the first remaining of which are the candidates left
+  std::vector<size_t> order;
+  size_t remaining;
+
+  size_t rounds;
+  size_t budget;
+
+  // Visits each candidate takes by the end of the round
+  size_t target;
+
+  void extend_target() {
+    target += std::max(budget / (rounds * remaining), (size_t)1);
+  }
+
+  template <class Children> void halve(Children &children, double value) {
+    const double scale = sigma_scale(children);
+
+    std::vector<double> ranked(children.size);
+
+    for (size_t k = 0; k < remaining; k++) {
+      ranked[order[k]] =
+          scores[order[k]] + scale * completed_q(children, order[k], value);
+    }
+
+    std::stable_sort(order.begin(), order.begin() + remaining,
+                     [&ranked](size_t a, size_t b) {
+                       return ranked[a] > ranked[b];
+                     });
+
+    remaining = (remaining + 1) / 2;
+
+    extend_target();
+  }
+
+  template <class Children>
+  static size_t visits(Children &children, size_t i) {
+    return (size_t)children.n_visits(i) + (size_t)children.n_virtual(i);
+  }
+
+  template <class Children> static double sigma_scale(Children &children) {
+    uint32_t max_visits = 0;
+
+    for (size_t i = 0; i < children.size; i++) {
+      max_visits = std::max(max_visits, (uint32_t)children.n_visits(i));
+    }
+
+    return (c_visit + max_visits) * c_scale;
+  }
+
+  // The mean value of child i for the root's player, in [0, 1], or the
+  // root's if it is unvisited
+  template <class Children>
+  static double completed_q(Children &children, size_t i, double value) {
+    const uint32_t n_visits = children.n_visits(i);
+    const double q =
+        (n_visits == 0) ? value : (double)children.total_av(i) / n_visits;
+
+    return (q + 1.0) / 2.0;
+  }
+};
+
+#endif
@@ -0,0 +1,337 @@
+#ifndef ALPHA3_INFERENCE_H
+#define ALPHA3_INFERENCE_H
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "channel.h"
+
+// Evaluates batches of positions for an InferenceScheduler, over an exported
+// model (a TensorRT engine or ONNX Runtime session, say). Calls for different
+// streams may run concurrently, so each stream can have a CUDA stream, device
+// or session of its own; calls for one stream never overlap.
+class InferenceBackend {
+public:
+  virtual ~InferenceBackend() {}
+
+  // Write a value and a row of priors for each of n rows of features, or
+  // return false on failure
+  virtual bool evaluate(size_t stream, size_t n, const float *features,
+                        float *values, float *policies) = 0;
+};
+
+// Serves the requests posted to an EvaluationChannel from a dispatcher thread
+// and a thread per stream. The dispatcher gathers requests until they fill a
+// batch of max_batch positions or the oldest has waited max_delay, then hands
+// the batch to an idle stream, which copies its features together, evaluates
+// them, copies the evaluations back into the slots and responds. Up to one
+// batch per stream is in flight at once; while every stream is busy,
+// requests queue in the channel. A request is never split between batches,
+// so one larger than max_batch makes a batch by itself.
+//
+// A failed evaluation stops the scheduler and closes the channel, failing
+// every client's wait.
+class InferenceScheduler {
+public:
+  struct Stats {
+    uint64_t batches;
+    uint64_t positions;
+
+    // Batches dispatched for being full, rather than for their deadline
+    uint64_t full_batches;
+
+    // Nanoseconds spent in the backend, summed over the streams
+    uint64_t evaluate_ns;
+  };
+
+  InferenceScheduler(EvaluationChannel &channel_, InferenceBackend &backend_,
+                     size_t n_streams, size_t max_batch_,
+                     std::chrono::nanoseconds max_delay_)
+      : channel(channel_), backend(backend_), max_batch(max_batch_),
+        max_delay(max_delay_), streams(n_streams), stopping(false),
+        failed_(false), generation(0), stats_{0, 0, 0, 0} {
+    assert(n_streams != 0 && max_batch != 0);
+
+    const size_t positions = std::max(max_batch, channel.batch_capacity());
+
+    for (Stream &stream : streams) {
+      stream.features.resize(positions * channel.features_per_position());
+      stream.values.resize(positions);
+      stream.policies.resize(positions * channel.priors_per_position());
+
+      // A batch holds at most one request per slot
+      stream.batch.reserve(channel.n_slots());
+    }
+
+    try {
+      for (size_t i = 0; i < n_streams; i++) {
+        streams[i].thread = std::thread([this, i]() { serve(i); });
+      }
+
+      dispatcher = std::thread([this]() { dispatch(); });
+    } catch (...) {
+      stop();
+      throw;
+    }
+  }
+
+  InferenceScheduler(const InferenceScheduler &) = delete;
+
+  InferenceScheduler &operator=(const InferenceScheduler &) = delete;
+
+  ~InferenceScheduler() { stop(); }
+
+  // Tag the responses sent from now on
+  void set_generation(uint64_t generation_) {
+    __atomic_store_n(&generation, generation_, __ATOMIC_RELAXED);
+  }
+
+  bool failed() const { return __atomic_load_n(&failed_, __ATOMIC_ACQUIRE); }
+
+  Stats stats() const {
+    return {__atomic_load_n(&stats_.batches, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats_.positions, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats_.full_batches, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats_.evaluate_ns, __ATOMIC_RELAXED)};
+  }
+
+  // Stop dispatching, finish the batches in flight and join every thread.
+  // Requests not yet dispatched are left in the channel
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+
+    changed.notify_all();
+
+    if (dispatcher.joinable()) {
+      dispatcher.join();
+    }
+
+    for (Stream &stream : streams) {
+      if (stream.thread.joinable()) {
+        stream.thread.join();
+      }
+    }
+  }
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Request {
+    size_t slot;
+    size_t n;
+    Clock::time_point posted_at;
+  };
+
+  struct Stream {
+    // Set while batch awaits evaluation on this stream
+    bool busy = false;
+    std::vector<Request> batch;
+
+    std::vector<float> features;
+    std::vector<float> values;
+    std::vector<float> policies;
+
+    std::thread thread;
+  };
+
+  // How long the dispatcher waits for a first request before checking
+  // whether it was stopped
+  static constexpr std::chrono::milliseconds idle_timeout{100};
+
+  EvaluationChannel &channel;
+  InferenceBackend &backend;
+
+  const size_t max_batch;
+  const std::chrono::nanoseconds max_delay;
+
+  // Guards stopping and the streams' batches
+  std::mutex mutex;
+  std::condition_variable changed;
+
+  std::vector<Stream> streams;
+  bool stopping;
+
+  bool failed_;
+  uint64_t generation;
+  Stats stats_;
+
+  std::thread dispatcher;
+
+  bool stopped() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stopping;
+  }
+
+  void dispatch() {
+    std::vector<Request> pending;
+    size_t pending_n = 0;
+
+    std::vector<std::pair<size_t, size_t>> posted;
+
+    while (!stopped() && !channel.closed()) {
+      Clock::duration timeout = idle_timeout;
+
+      if (!pending.empty()) {
+        timeout = std::max(Clock::duration::zero(),
+                           pending.front().posted_at + max_delay -
+                               Clock::now());
+      }
+
+      posted.clear();
+      channel.wait_requests(timeout, posted);
+
+      const Clock::time_point now = Clock::now();
+
+      for (const auto &request : posted) {
+        pending.push_back({request.first, request.second, now});
+        pending_n += request.second;
+      }
+
+      while (!pending.empty() &&
+             (pending_n >= max_batch ||
+              Clock::now() >= pending.front().posted_at + max_delay)) {
+        const bool full = (pending_n >= max_batch);
+
+        size_t count = 0;
+        size_t n = 0;
+
+        while (count < pending.size() &&
+               (count == 0 || n + pending[count].n <= max_batch)) {
+          n += pending[count].n;
+          count++;
+        }
+
+        if (!submit(pending.begin(), pending.begin() + count, full)) {
+          return;
+        }
+
+        pending.erase(pending.begin(), pending.begin() + count);
+        pending_n -= n;
+      }
+    }
+  }
+
+  // Wait for an idle stream and hand it the requests in [begin, end), unless
+  // stopped first
+  bool submit(std::vector<Request>::iterator begin,
+              std::vector<Request>::iterator end, bool full) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    Stream *idle = nullptr;
+
+    changed.wait(lock, [&]() {
+      for (Stream &stream : streams) {
+        if (!stream.busy) {
+          idle = &stream;
+          return true;
+        }
+      }
+
+      return stopping;
+    });
+
+    if (stopping) {
+      return false;
+    }
+
+    idle->batch.assign(begin, end);
+    idle->busy = true;
+
+    if (full) {
+      __atomic_fetch_add(&stats_.full_batches, 1, __ATOMIC_RELAXED);
+    }
+
+    lock.unlock();
+    changed.notify_all();
+
+    return true;
+  }
+
+  void serve(size_t index) {
+    Stream &stream = streams[index];
+
+    const size_t n_features = channel.features_per_position();
+    const size_t policy_width = channel.priors_per_position();
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;) {
+      changed.wait(lock, [&]() { return stopping || stream.busy; });
+
+      if (!stream.busy) {
+        return;
+      }
+
+      lock.unlock();
+
+      size_t n = 0;
+
+      for (const Request &request : stream.batch) {
+        memcpy(&stream.features[n * n_features],
+               channel.features(request.slot),
+               request.n * n_features * sizeof(float));
+        n += request.n;
+      }
+
+      const Clock::time_point started_at = Clock::now();
+
+      const bool ok =
+          backend.evaluate(index, n, stream.features.data(),
+                           stream.values.data(), stream.policies.data());
+
+      const uint64_t evaluate_ns =
+          (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+              Clock::now() - started_at)
+              .count();
+
+      if (ok) {
+        const uint64_t tag = __atomic_load_n(&generation, __ATOMIC_RELAXED);
+
+        size_t offset = 0;
+
+        for (const Request &request : stream.batch) {
+          memcpy(channel.values(request.slot), &stream.values[offset],
+                 request.n * sizeof(float));
+          memcpy(channel.policies(request.slot),
+                 &stream.policies[offset * policy_width],
+                 request.n * policy_width * sizeof(float));
+
+          channel.respond(request.slot, tag);
+          offset += request.n;
+        }
+
+        __atomic_fetch_add(&stats_.batches, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats_.positions, n, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats_.evaluate_ns, evaluate_ns, __ATOMIC_RELAXED);
+      } else {
+        __atomic_store_n(&failed_, true, __ATOMIC_RELEASE);
+        channel.close();
+      }
+
+      lock.lock();
+
+      stream.busy = false;
+
+      if (!ok) {
+        stopping = true;
+      }
+
+      changed.notify_all();
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef ALPHA3_LAYOUT_H
+#define ALPHA3_LAYOUT_H
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include "puct.h"
+
+// Memory layouts for the children of an MCTS node. Each expansion allocates
+// one block: a header, the statistics of the edge leading into every child,
+// a pointer to every child's own block, and finally the child nodes. The
+// search itself only reads the header and the edge statistics, so a descent
+// touches nodes only once it reaches a leaf. The root lives alone in a block
+// with no parent.
+//
+// Every layout exposes the same interface to MCTS; they differ only in how the
+// per-edge statistics are arranged, and in the selection kernel.
+
+namespace layout_detail {
+
+static inline size_t align_up(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+} // namespace layout_detail
+
+// Per-edge statistics stored contiguously as an array of structs. An edge is
+// 32 bytes, so selection and backup touch few cache lines at small branching
+// factors such as Connect-4's.
+template <class Node> struct EdgeLayout {
+  struct Children {
+    // The block and index holding the node that owns these children
+    Children *parent;
+    uint32_t parent_index;
+
+    uint32_t size;
+
+    struct Edge {
+      double prior;
+      double total_av;
+      uint32_t n_visits;
+      uint32_t n_virtual;
+      Children *child_block;
+    };
+
+    static size_t nodes_offset(size_t n) {
+      return layout_detail::align_up(sizeof(Children) + n * sizeof(Edge),
+                                     alignof(Node));
+    }
+
+    static size_t bytes(size_t n) { return nodes_offset(n) + n * sizeof(Node); }
+
+    Edge *edges() { return (Edge *)(this + 1); }
+
+    const Edge *edges() const { return (const Edge *)(this + 1); }
+
+    double &prior(size_t i) { return edges()[i].prior; }
+
+    double &total_av(size_t i) { return edges()[i].total_av; }
+
+    uint32_t &n_visits(size_t i) { return edges()[i].n_visits; }
+
+    uint32_t &n_virtual(size_t i) { return edges()[i].n_virtual; }
+
+    Children *&child_block(size_t i) { return edges()[i].child_block; }
+
+    Node &node(size_t i) {
+      return ((Node *)((char *)this + nodes_offset(size)))[i];
+    }
+
+    template <class Sync> size_t select(double exploration) const {
+      size_t best = 0;
+      double best_score = 0.0;
+
+      for (size_t i = 0; i < size; i++) {
+        const Edge &edge = edges()[i];
+
+        const double n_visits = (double)Sync::load_relaxed(edge.n_visits);
+        const double n_virtual = (double)Sync::load_relaxed(edge.n_virtual);
+
+        const double visits = n_visits + n_virtual;
+        const double q = (Sync::load_relaxed(edge.total_av) - n_virtual) /
+                         ((visits < 1.0) ? 1.0 : visits);
+        const double u = exploration * edge.prior / (1.0 + visits);
+        const double score = q + u;
+
+        if (i == 0 || score > best_score) {
+          best = i;
+          best_score = score;
+        }
+      }
+
+      return best;
+    }
+  };
+
+  static_assert(sizeof(typename Children::Edge) == 32, "unexpected padding");
+  static_assert(sizeof(Children) % alignof(typename Children::Edge) == 0,
+                "edges must follow the header without padding");
+};
+
+// Per-edge statistics for games of at most MaxChildren moves (7 for
+// Connect-4), as FixedEdgeLayout<7>::Layout. Edges hold single precision
+// priors and values, making them 24 bytes rather than 32, and are stored
+// inline in an array of MaxChildren, so that nodes sit at the same offset in
+// every block and the selection loop has a constant bound to unroll over.
+template <size_t MaxChildren> struct FixedEdgeLayout {
+  static_assert(MaxChildren != 0, "expected room for a child");
+
+  template <class Node> struct Layout {
+    struct Children {
+      struct Edge {
+        float prior;
+        float total_av;
+        uint32_t n_visits;
+        uint32_t n_virtual;
+        Children *child_block;
+      };
+
+      // The block and index holding the node that owns these children
+      Children *parent;
+      uint32_t parent_index;
+
+      uint32_t size;
+
+      std::array<Edge, MaxChildren> edges;
+
+      static size_t nodes_offset() {
+        return layout_detail::align_up(sizeof(Children), alignof(Node));
+      }
+
+      static size_t bytes(size_t n) {
+        assert(n <= MaxChildren);
+        return nodes_offset() + n * sizeof(Node);
+      }
+
+      float &prior(size_t i) { return edges[i].prior; }
+
+      float &total_av(size_t i) { return edges[i].total_av; }
+
+      uint32_t &n_visits(size_t i) { return edges[i].n_visits; }
+
+      uint32_t &n_virtual(size_t i) { return edges[i].n_virtual; }
+
+      Children *&child_block(size_t i) { return edges[i].child_block; }
+
+      Node &node(size_t i) {
+        return ((Node *)((char *)this + nodes_offset()))[i];
+      }
+
+      // Scored in single precision, like the statistics themselves
+      template <class Sync> size_t select(double exploration) const {
+        const float explore = (float)exploration;
+
+        size_t best = 0;
+        float best_score = 0.0f;
+
+        for (size_t i = 0; i < MaxChildren; i++) {
+          if (i == size) {
+            break;
+          }
+
+          const Edge &edge = edges[i];
+
+          const float n_visits = (float)Sync::load_relaxed(edge.n_visits);
+          const float n_virtual = (float)Sync::load_relaxed(edge.n_virtual);
+
+          const float visits = n_visits + n_virtual;
+          const float q = (Sync::load_relaxed(edge.total_av) - n_virtual) /
+                          ((visits < 1.0f) ? 1.0f : visits);
+          const float u = explore * edge.prior / (1.0f + visits);
+          const float score = q + u;
+
+          if (i == 0 || score > best_score) {
+            best = i;
+            best_score = score;
+          }
+        }
+
+        return best;
+      }
+    };
+
+    static_assert(sizeof(typename Children::Edge) == 24, "unexpected padding");
+  };
+};
+
+// Per-edge statistics stored as structure-of-arrays, so that the PUCT argmax
+// runs as a vectorized kernel over contiguous priors, visit counts and
+// values. Pays off at large branching factors, where that loop dominates.
+template <class Node> struct SoALayout {
+  struct Children {
+    // The block and index holding the node that owns these children
+    Children *parent;
+    uint32_t parent_index;
+
+    uint32_t size;
+
+    static size_t n_visits_offset(size_t n) {
+      return sizeof(Children) + n * sizeof(double);
+    }
+
+    static size_t prior_offset(size_t n) {
+      return layout_detail::align_up(
+          n_visits_offset(n) + 2 * n * sizeof(uint32_t), alignof(double));
+    }
+
+    static size_t child_blocks_offset(size_t n) {
+      return prior_offset(n) + n * sizeof(double);
+    }
+
+    static size_t nodes_offset(size_t n) {
+      return layout_detail::align_up(
+          child_blocks_offset(n) + n * sizeof(Children *), alignof(Node));
+    }
+
+    static size_t bytes(size_t n) { return nodes_offset(n) + n * sizeof(Node); }
+
+    template <class T> T *array(size_t offset) const {
+      return (T *)((char *)this + offset);
+    }
+
+    double *total_av_array() const { return (double *)(this + 1); }
+
+    uint32_t *n_visits_array() const { return array<uint32_t>(n_visits_offset(size)); }
+
+    uint32_t *n_virtual_array() const { return n_visits_array() + size; }
+
+    double *prior_array() const { return array<double>(prior_offset(size)); }
+
+    double &prior(size_t i) { return prior_array()[i]; }
+
+    double &total_av(size_t i) { return total_av_array()[i]; }
+
+    uint32_t &n_visits(size_t i) { return n_visits_array()[i]; }
+
+    uint32_t &n_virtual(size_t i) { return n_virtual_array()[i]; }
+
+    Children *&child_block(size_t i) {
+      return array<Children *>(child_blocks_offset(size))[i];
+    }
+
+    Node &node(size_t i) { return array<Node>(nodes_offset(size))[i]; }
+
+    // Vector loads are not atomic, so under a concurrent policy the kernel may
+    // see old and new statistics mixed across children, which only perturbs
+    // the choice of child.
+    template <class Sync> size_t select(double exploration) const {
+      return puct_argmax(prior_array(), total_av_array(), n_visits_array(), n_virtual_array(), size,
+                         exploration);
+    }
+  };
+
+  static_assert(sizeof(Children) % alignof(double) == 0,
+                "edge statistics must follow the header without padding");
+};
+
+#endif
@@ -1,39 +1,84 @@
+#ifndef ALPHA3_MCTS_H
+#define ALPHA3_MCTS_H
+
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <new>
 #include <random>
+#include <system_error>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#include "arena.h"
+#include "halving.h"
+#include "layout.h"
+#include "reclaim.h"
+#include "sync.h"
+#include "treeimage.h"
+
 template <class GameState, class Move,
-          class Generator = std::default_random_engine>
+          class Generator = std::default_random_engine,
+          class Allocator = NodeArena,
+          template <class> class Layout = EdgeLayout,
+          class Sync = SingleThreaded>
 class MCTS {
+public:
+  struct Node;
+
+private:
+  typedef typename Layout<Node>::Children Children;
+
 public:
   struct Node {
   private:
-    Move move;
     GameState game_state;
 
-    double prior_probability;
+    // The block holding this node, and the statistics of the edge leading
+    // into it at the given index
+    Children *block;
+    uint32_t index;
+
+    // False until the state of a lazily expanded node is materialized
+    bool has_state_;
+
+    // Last, where a small move packs in behind the index
+    Move move;
+
+    Children *&children() const { return block->child_block(index); }
 
-    Node *parent;
-    Node *child;
-    Node *sibling;
+    uint32_t n_visits() const { return Sync::load(block->n_visits(index)); }
 
-    size_t n_visits;
-    double total_av;
+    uint32_t n_virtual() const {
+      return Sync::load(block->n_virtual(index));
+    }
+
+    double total_av() const { return Sync::load(block->total_av(index)); }
+
+    bool expanded() const { return n_visits() != 0; }
 
-    bool expanded() const { return n_visits != 0; }
+    bool pending() const { return !expanded() && n_virtual() != 0; }
 
-    bool terminal() const { return expanded() && child == nullptr; }
+    bool terminal() const { return expanded() && children() == nullptr; }
 
     friend class MCTS;
 
   public:
     const Move &prev_move() { return move; }
 
-    const GameState &state() { return game_state; }
+    bool has_state() const { return has_state_; }
+
+    const GameState &state() {
+      assert(has_state_);
+      return game_state;
+    }
   };
 
   struct ExpansionEntry {
@@ -42,78 +87,497 @@ public:
     double prior_probability;
   };
 
+  // A child whose state is only built once it is first selected
+  struct MoveEntry {
+    Move move;
+    double prior_probability;
+  };
+
+  struct Evaluation {
+    Node *leaf;
+    double av;
+    std::vector<ExpansionEntry> expansion;
+  };
+
   struct HistoryEntry {
     GameState game_state;
     std::vector<std::pair<Move, double>> search_probabilities;
   };
 
+  struct MemoryStats {
+    size_t live_nodes;
+
+    // Nodes live just after the last move: those kept from the previous
+    // turn's tree, and any discarded ones not yet reclaimed
+    size_t reused_nodes;
+
+    // Nodes freed to keep within the node budget, over the tree's lifetime
+    size_t pruned_nodes;
+
+    // Bytes in use and held unused by the allocator
+    size_t live_bytes;
+    size_t free_bytes;
+
+    // Blocks of children allocated over the tree's lifetime, and those of
+    // them the allocator placed in memory freed by earlier blocks
+    uint64_t allocated_blocks;
+    uint64_t recycled_blocks;
+  };
+
+  // Counted over the tree's lifetime, across resets. Times are in
+  // nanoseconds, and only measured while timing is enabled, since reading
+  // the clock costs more than the rest of a search's bookkeeping.
+  struct SearchStats {
+    // Leaves expanded, and terminal nodes reached and backed up in place
+    uint64_t searches;
+
+    // Walks from the root, the edges they crossed, and those that ended at
+    // a terminal node or at a leaf already awaiting evaluation
+    uint64_t descents;
+    uint64_t depth;
+    uint64_t terminal_hits;
+    uint64_t collisions;
+
+    // Walking down the tree, adding children, and backing values up
+    uint64_t select_ns;
+    uint64_t expand_ns;
+    uint64_t backup_ns;
+  };
+
 private:
   const double c_init;
   const double c_base;
 
+  Allocator allocator;
+  typename Sync::Mutex allocator_mutex;
+
   Node *root;
-  Node *freelist;
 
   std::vector<HistoryEntry> history;
 
   size_t searches_this_turn_;
 
+  SearchStats search_stats_;
+  bool timing_;
+
   Generator generator;
 
-  Node *alloc_node() {
-    if (freelist != nullptr) {
-      Node *node = freelist;
-      freelist = node->sibling;
-      return node;
+  // The root's schedule this turn, if searched by sequential halving
+  SequentialHalving halving_;
+
+  // Searches between checks of whether the greedy move is decided
+  static constexpr size_t decision_interval = 16;
+
+  // Zero for no budget
+  size_t node_budget_;
+
+  size_t live_nodes_;
+  size_t reused_nodes_;
+  size_t pruned_nodes_;
+
+  // Frees discarded subtrees of at least reclaim_visits_ visits, if set
+  Reclaimer *reclaimer_;
+  uint32_t reclaim_visits_;
+
+  // Subtrees posted to the reclaimer and not yet freed, and a lock held
+  // around the allocator while the reclaimer may be freeing into it
+  size_t outstanding_;
+  mutable std::mutex reclaim_mutex;
+
+  // Searching in the background, until cancelled_ is set
+  std::thread ponder_thread;
+  bool cancelled_;
+  std::exception_ptr ponder_error;
+
+  std::unique_lock<std::mutex> lock_reclaim() const {
+    if (reclaimer_ == nullptr) {
+      return std::unique_lock<std::mutex>();
+    }
+
+    return std::unique_lock<std::mutex>(reclaim_mutex);
+  }
+
+  void wait_reclaimed() const {
+    while (__atomic_load_n(&outstanding_, __ATOMIC_ACQUIRE) != 0) {
+      std::this_thread::yield();
+    }
+  }
+
+  Children *alloc_children(Children *parent, size_t parent_index, size_t n) {
+    void *memory;
+
+    {
+      std::lock_guard<typename Sync::Mutex> lock(allocator_mutex);
+      const auto reclaim_lock = lock_reclaim();
+
+      memory = allocator.allocate(Children::bytes(n));
+      live_nodes_ += n;
+    }
+
+    Children *children = new (memory) Children;
+
+    children->parent = parent;
+    children->parent_index = (uint32_t)parent_index;
+    children->size = (uint32_t)n;
+
+    for (size_t i = 0; i < n; i++) {
+      children->prior(i) = 0.0;
+      children->total_av(i) = 0.0;
+      children->n_visits(i) = 0;
+      children->n_virtual(i) = 0;
+      children->child_block(i) = nullptr;
+
+      Node *node = new (&children->node(i)) Node;
+      node->block = children;
+      node->index = (uint32_t)i;
+      node->has_state_ = false;
     }
 
-    return new Node;
+    return children;
   }
 
-  void free_node(Node *node) {
-    node->sibling = freelist;
-    freelist = node;
+  void free_block(Children *children) {
+    const size_t n = children->size;
+
+    for (size_t i = 0; i < n; i++) {
+      children->node(i).~Node();
+    }
+
+    children->~Children();
+
+    std::lock_guard<typename Sync::Mutex> lock(allocator_mutex);
+    const auto reclaim_lock = lock_reclaim();
+
+    allocator.deallocate(children, Children::bytes(n));
+    live_nodes_ -= n;
   }
 
-  void free_subtree(Node *subtree) {
-    if (subtree == nullptr) {
+  // Free top and every block below it, and return the number of nodes freed.
+  // The walk goes down through child pointers and back up through parent
+  // links, so deep trees cost no stack; each block is freed once its last
+  // child block has been.
+  size_t free_subtree(Children *top) {
+    size_t freed = 0;
+
+    Children *block = top;
+    size_t i = 0;
+
+    for (;;) {
+      while (i < block->size && block->child_block(i) == nullptr) {
+        i++;
+      }
+
+      if (i < block->size) {
+        Children *child = block->child_block(i);
+        block->child_block(i) = nullptr;
+
+        block = child;
+        i = 0;
+        continue;
+      }
+
+      Children *parent = block->parent;
+      const size_t index = block->parent_index;
+      const bool done = (block == top);
+
+      freed += block->size;
+      free_block(block);
+
+      if (done) {
+        return freed;
+      }
+
+      block = parent;
+      i = index + 1;
+    }
+  }
+
+  size_t free_children(Node *node) {
+    Children *children = node->children();
+
+    if (children == nullptr) {
+      return 0;
+    }
+
+    node->children() = nullptr;
+    return free_subtree(children);
+  }
+
+  // Free the subtree under top, which took n_visits visits, on the reclaimer
+  // if it is large enough to be worth handing off
+  void discard(Children *top, uint32_t n_visits) {
+    if (reclaimer_ != nullptr && n_visits >= reclaim_visits_) {
+      __atomic_fetch_add(&outstanding_, (size_t)1, __ATOMIC_RELAXED);
+
+      try {
+        reclaimer_->post([this, top]() {
+          free_subtree(top);
+          __atomic_fetch_sub(&outstanding_, (size_t)1, __ATOMIC_RELEASE);
+        });
+
+        return;
+      } catch (std::exception &) {
+        __atomic_fetch_sub(&outstanding_, (size_t)1, __ATOMIC_RELAXED);
+      }
+    }
+
+    free_subtree(top);
+  }
+
+  void free_tree() {
+    if (root == nullptr) {
       return;
     }
 
-    free_subtree(subtree->child);
-    free_node(subtree);
+    discard(root->block, root->n_visits());
+    root = nullptr;
   }
 
-  void ascend_tree(Node *node, double av) {
-    while (node != nullptr) {
-      node->n_visits++;
-      node->total_av += av;
-      node = node->parent;
+  // Free the subtree below node and take back its visits, from its own edge
+  // and from every ancestor's, leaving it unexpanded. Its parent's value is
+  // then estimated from the remaining visits alone.
+  void forget(Node *node) {
+    Children *block = node->block;
+    size_t index = node->index;
+
+    pruned_nodes_ += free_children(node);
+
+    const uint32_t n_visits = block->n_visits(index);
+    double av = block->total_av(index);
+
+    while (block != nullptr) {
+      block->n_visits(index) -= n_visits;
+      block->total_av(index) -= av;
+      index = block->parent_index;
+      block = block->parent;
       av = -av;
     }
   }
 
-  const Move *play_move(Node *new_root) {
-    const size_t denom = root->n_visits - 1;
+  // Forget the expanded children (and then descendants) of node with at most
+  // threshold visits, until the tree has at most target nodes. Nodes with
+  // leaves awaiting evaluation below them are kept.
+  void prune(Node *node, uint32_t threshold, size_t target) {
+    Children *children = node->children();
+
+    if (children == nullptr) {
+      return;
+    }
+
+    for (size_t i = 0; i < children->size && live_nodes_ > target; i++) {
+      Node *child = &children->node(i);
+
+      if (child->children() == nullptr) {
+        continue;
+      }
+
+      if (children->n_visits(i) <= threshold && children->n_virtual(i) == 0) {
+        forget(child);
+      } else {
+        prune(child, threshold, target);
+      }
+    }
+  }
+
+  // Over budget, prune the subtrees with the fewest visits first, down to
+  // three quarters of the budget so that pruning is not repeated every
+  // search, and return the slabs freed to the system. Only called while no
+  // other thread is searching. The live count includes discarded subtrees
+  // until they are reclaimed, so the budget waits for the reclaimer.
+  void enforce_budget() {
+    if (node_budget_ == 0 || root == nullptr ||
+        __atomic_load_n(&outstanding_, __ATOMIC_ACQUIRE) != 0 ||
+        live_nodes_ <= node_budget_) {
+      return;
+    }
+
+    const size_t target = node_budget_ - node_budget_ / 4;
+
+    for (uint32_t threshold = 1; live_nodes_ > target; threshold *= 2) {
+      prune(root, threshold, target);
+
+      if (threshold >= root->n_visits()) {
+        break;
+      }
+    }
+
+    allocator.trim();
+  }
+
+  void cancel_pondering() {
+    __atomic_store_n(&cancelled_, true, __ATOMIC_RELAXED);
+    ponder_thread.join();
+    __atomic_store_n(&cancelled_, false, __ATOMIC_RELAXED);
+  }
+
+  // A timestamp to measure from, or zero unless timing
+  uint64_t clock() const {
+    if (!timing_) {
+      return 0;
+    }
+
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  void add_time(uint64_t &counter, uint64_t since) {
+    if (timing_) {
+      Sync::fetch_add(counter, clock() - since);
+    }
+  }
+
+  void ascend_tree(Children *block, size_t index, double av) {
+    while (block != nullptr) {
+      Sync::add(block->total_av(index), av);
+      Sync::fetch_add(block->n_visits(index), 1u);
+      index = block->parent_index;
+      block = block->parent;
+      av = -av;
+    }
+  }
+
+  // Claim leaf for evaluation by adding a virtual loss along its path. Fails,
+  // leaving the tree unchanged, if another thread has claimed or expanded the
+  // leaf since it was selected.
+  bool apply_virtual_loss(Node *leaf) {
+    Children *block = leaf->block;
+    size_t index = leaf->index;
+
+    if (Sync::fetch_add(block->n_virtual(index), 1u) != 0 ||
+        Sync::load(block->n_visits(index)) != 0) {
+      Sync::fetch_sub(block->n_virtual(index), 1u);
+      return false;
+    }
+
+    for (;;) {
+      index = block->parent_index;
+      block = block->parent;
+
+      if (block == nullptr) {
+        return true;
+      }
+
+      Sync::fetch_add(block->n_virtual(index), 1u);
+    }
+  }
+
+  void revert_virtual_loss(Node *leaf) {
+    size_t index = leaf->index;
+
+    for (Children *block = leaf->block; block != nullptr;) {
+      const uint32_t previous = Sync::fetch_sub(block->n_virtual(index), 1u);
+      assert(previous != 0);
+      (void)previous;
+      index = block->parent_index;
+      block = block->parent;
+    }
+  }
+
+  // Walk from the root to an unexpanded node by PUCT. Returns false without
+  // modifying the tree if that node is already awaiting evaluation; otherwise
+  // returns true, with leaf set to the node found, or to nullptr if the walk
+  // ended at a terminal node (which is then backed up in place). Pending
+  // visits are scored as losses.
+  bool descend(Node *&leaf) {
+    const uint64_t started_at = clock();
+
+    Children *block = root->block;
+    size_t index = root->index;
+
+    uint64_t depth = 0;
+
+    Sync::fetch_add(search_stats_.descents, (uint64_t)1);
+
+    for (;;) {
+      const uint32_t n_visits = Sync::load(block->n_visits(index));
+
+      if (n_visits == 0) {
+        break;
+      }
+
+      Children *children = Sync::load(block->child_block(index));
+
+      if (children == nullptr) {
+        Sync::fetch_add(block->n_visits(index), 1u);
+        ascend_tree(block->parent, block->parent_index,
+                    -Sync::load(block->total_av(index)));
+        Sync::fetch_add(searches_this_turn_, (size_t)1);
+
+        Sync::fetch_add(search_stats_.searches, (uint64_t)1);
+        Sync::fetch_add(search_stats_.terminal_hits, (uint64_t)1);
+        Sync::fetch_add(search_stats_.depth, depth);
+        add_time(search_stats_.select_ns, started_at);
+
+        leaf = nullptr;
+        return true;
+      }
+
+      if (depth == 0 && halving_.active()) {
+        index = halving_.select(
+            *children, -Sync::load(block->total_av(index)) / n_visits);
+      } else {
+        const double node_visits =
+            (double)n_visits +
+            (double)Sync::load_relaxed(block->n_virtual(index));
+        const double exploration =
+            (log((1 + node_visits + c_base) / c_base) + c_init) *
+            sqrt(node_visits);
+
+        index = children->template select<Sync>(exploration);
+      }
+
+      block = children;
+      depth++;
+    }
+
+    Sync::fetch_add(search_stats_.depth, depth);
+
+    Node *node = &block->node(index);
+    const bool pending = node->pending();
+
+    if (pending) {
+      Sync::fetch_add(search_stats_.collisions, (uint64_t)1);
+    }
+
+    add_time(search_stats_.select_ns, started_at);
+
+    if (pending) {
+      return false;
+    }
+
+    leaf = node;
+    return true;
+  }
+
+  // Play the move to new_root, or end the game given null, recording the
+  // root's search probabilities in the history: policy, by child, if given,
+  // and otherwise the children's shares of the visits
+  const Move *play_move(Node *new_root,
+                        const std::vector<double> *policy = nullptr) {
+    assert(root->n_virtual() == 0 && root->has_state_);
+
+    const size_t denom = root->n_visits() - 1;
+    uint32_t discarded = root->n_visits();
 
     std::vector<std::pair<Move, double>> search_probabilities;
 
-    size_t new_root_index = SIZE_MAX;
+    Children *children = root->children();
+    const size_t n_children = (children == nullptr) ? 0 : children->size;
 
-    for (Node *child = root->child; child != nullptr;) {
-      search_probabilities.emplace_back(
-          std::move(child->move),
-          (denom == 0) ? 0.0 : ((double)child->n_visits / denom));
+    for (size_t i = 0; i < n_children; i++) {
+      Node *child = &children->node(i);
 
-      Node *next = child->sibling;
+      double probability;
 
-      if (child == new_root) {
-        new_root_index = search_probabilities.size() - 1;
+      if (policy != nullptr) {
+        probability = (*policy)[i];
       } else {
-        free_subtree(child);
+        probability =
+            (denom == 0) ? 0.0 : ((double)children->n_visits(i) / denom);
       }
 
-      child = next;
+      search_probabilities.emplace_back(std::move(child->move), probability);
     }
 
     HistoryEntry entry = {std::move(root->game_state),
@@ -121,47 +585,165 @@ private:
     history.emplace_back(std::move(entry));
 
     const Move *move = nullptr;
+    Node *next_root = nullptr;
 
     if (new_root != nullptr) {
-      new_root->move = std::move(root->move);
-      new_root->parent = nullptr;
-      new_root->sibling = nullptr;
+      assert(new_root->block == children);
+      const size_t new_root_index = new_root->index;
+
+      // The new root is moved out of its sibling block, along with its edge
+      // statistics, so that the block can be released as a whole. Its
+      // parent_index keeps the move's place in the history, from which an
+      // unvisited root is materialized.
+      Children *block = alloc_children(nullptr, new_root_index, 1);
+      next_root = &block->node(0);
+
+      block->total_av(0) = children->total_av(new_root_index);
+      block->n_visits(0) = children->n_visits(new_root_index);
+      discarded -= block->n_visits(0);
+
+      next_root->move = std::move(root->move);
+      next_root->game_state = std::move(new_root->game_state);
+      next_root->has_state_ = new_root->has_state_;
+      next_root->children() = new_root->children();
+
+      if (next_root->children() != nullptr) {
+        next_root->children()->parent = block;
+        next_root->children()->parent_index = 0;
+      }
+
+      new_root->children() = nullptr;
 
-      assert(new_root_index != SIZE_MAX);
       move = &history.back().search_probabilities[new_root_index].first;
     }
 
-    free_node(root);
-    root = new_root;
+    // The new root's siblings, with their subtrees, go with their block
+    if (children != nullptr) {
+      discard(children, discarded);
+    }
+
+    free_block(root->block);
+    root = next_root;
 
     searches_this_turn_ = 0;
+    halving_.clear();
+
+    {
+      const auto reclaim_lock = lock_reclaim();
+      reused_nodes_ = live_nodes_;
+    }
+
+    enforce_budget();
 
     return move;
   }
 
+  // The children are published before the leaf's visit, so that a thread
+  // that sees the leaf as expanded also sees its children. A claimed leaf
+  // keeps its virtual loss until it is expanded, which stops other threads
+  // from claiming it in the meantime.
+  template <class Entry>
+  void expand(Node *leaf, double av, std::vector<Entry> &&expansion,
+              bool claimed) {
+    const uint64_t started_at = clock();
+
+    if (!expansion.empty()) {
+      Children *children =
+          alloc_children(leaf->block, leaf->index, expansion.size());
+
+      for (size_t i = 0; i < expansion.size(); i++) {
+        Node *child = &children->node(i);
+        Entry &entry = expansion[i];
+
+        child->move = std::move(entry.move);
+        assign_state(child, entry);
+        children->prior(i) = entry.prior_probability;
+      }
+
+      Sync::store(leaf->children(), children);
+    }
+
+    const uint64_t expanded_at = clock();
+
+    ascend_tree(leaf->block, leaf->index, av);
+
+    if (claimed) {
+      revert_virtual_loss(leaf);
+    }
+
+    Sync::fetch_add(searches_this_turn_, (size_t)1);
+    Sync::fetch_add(search_stats_.searches, (uint64_t)1);
+
+    if (timing_) {
+      Sync::fetch_add(search_stats_.expand_ns, expanded_at - started_at);
+      add_time(search_stats_.backup_ns, expanded_at);
+    }
+  }
+
+  static void assign_state(Node *child, ExpansionEntry &entry) {
+    child->game_state = std::move(entry.game_state);
+    child->has_state_ = true;
+  }
+
+  static void assign_state(Node *child, MoveEntry &entry) {
+    (void)child;
+    (void)entry;
+  }
+
+  bool claim_leaf(Node *&leaf) {
+    if (!descend(leaf)) {
+      return false;
+    }
+
+    return leaf == nullptr || apply_virtual_loss(leaf);
+  }
+
 public:
   MCTS(double c_init_, double c_base_, GameState initial_state = GameState(),
        Move phony_move = Move())
-      : c_init(c_init_), c_base(c_base_), root(nullptr), freelist(nullptr),
-        history(), generator(std::random_device{}()) {
+      : c_init(c_init_), c_base(c_base_), allocator(), allocator_mutex(),
+        root(nullptr), history(), search_stats_(), timing_(false),
+        generator(std::random_device{}()), halving_(), node_budget_(0),
+        live_nodes_(0), reused_nodes_(0), pruned_nodes_(0),
+        reclaimer_(nullptr), reclaim_visits_(0), outstanding_(0),
+        reclaim_mutex(), ponder_thread(), cancelled_(false), ponder_error() {
     reset(std::move(initial_state), std::move(phony_move));
   }
 
+  // Subtrees still being reclaimed free into other's allocator, so they are
+  // waited for before it moves. other must not be pondering.
   MCTS(MCTS &&other)
-      : c_init(other.c_init), c_base(other.c_base), root(other.root),
-        freelist(other.freelist), history(std::move(other.history)) {}
+      : c_init((other.wait_reclaimed(), other.c_init)), c_base(other.c_base),
+        allocator(std::move(other.allocator)), allocator_mutex(),
+        root(other.root),
+        history(std::move(other.history)),
+        searches_this_turn_(other.searches_this_turn_),
+        search_stats_(other.search_stats_), timing_(other.timing_),
+        generator(std::move(other.generator)),
+        halving_(std::move(other.halving_)),
+        node_budget_(other.node_budget_), live_nodes_(other.live_nodes_),
+        reused_nodes_(other.reused_nodes_),
+        pruned_nodes_(other.pruned_nodes_), reclaimer_(other.reclaimer_),
+        reclaim_visits_(other.reclaim_visits_), outstanding_(0),
+        reclaim_mutex(), ponder_thread(), cancelled_(false), ponder_error() {
+    assert(!other.pondering());
+    other.root = nullptr;
+    other.live_nodes_ = 0;
+  }
 
   ~MCTS() {
-    free_subtree(root);
-
-    for (Node *node = freelist; node != nullptr;) {
-      Node *next = node->sibling;
-      delete node;
-      node = next;
+    if (pondering()) {
+      cancel_pondering();
     }
+
+    free_tree();
+    wait_reclaimed();
   }
 
-  const GameState &game_state() const { return root->game_state; }
+  const GameState &game_state() const {
+    assert(root->has_state_);
+    return root->game_state;
+  }
 
   bool expanded() const { return root != nullptr && root->expanded(); }
 
@@ -178,15 +760,61 @@ public:
     return searches_this_turn_;
   }
 
+  // Cap the tree at budget nodes (or none, given zero) by pruning between
+  // searches: after each move, and before each selection or search
+  void set_node_budget(size_t budget) {
+    node_budget_ = budget;
+    enforce_budget();
+  }
+
+  size_t node_budget() const { return node_budget_; }
+
+  // Free discarded subtrees (of the siblings of each move played, and of the
+  // whole tree on reset) of at least min_visits visits on reclaimer, which
+  // must outlive the tree, or every subtree inline given null. Their states
+  // are then destroyed on the reclaimer's thread. Until a subtree is
+  // reclaimed, its nodes count as live.
+  void set_reclaimer(Reclaimer *reclaimer, uint32_t min_visits) {
+    wait_reclaimed();
+
+    reclaimer_ = reclaimer;
+    reclaim_visits_ = min_visits;
+  }
+
+  // Measure the time spent in each phase of the search from now on, or stop
+  void set_timing(bool timing) { timing_ = timing; }
+
+  bool timing() const { return timing_; }
+
+  SearchStats search_stats() const {
+    return {Sync::load(search_stats_.searches),
+            Sync::load(search_stats_.descents),
+            Sync::load(search_stats_.depth),
+            Sync::load(search_stats_.terminal_hits),
+            Sync::load(search_stats_.collisions),
+            Sync::load(search_stats_.select_ns),
+            Sync::load(search_stats_.expand_ns),
+            Sync::load(search_stats_.backup_ns)};
+  }
+
+  MemoryStats memory_stats() const {
+    const auto reclaim_lock = lock_reclaim();
+    return {live_nodes_, reused_nodes_, pruned_nodes_, allocator.live_bytes(),
+            allocator.free_bytes(), allocator.allocations(),
+            allocator.recycled()};
+  }
+
   void add_dirichlet_noise(double alpha, double fraction) {
     assert(expanded() && !complete());
 
     std::gamma_distribution<double> gamma(alpha, 1.0);
 
+    Children *children = root->children();
+
     std::vector<double> noise;
     double sum = 0.0;
 
-    for (Node *child = root->child; child != nullptr; child = child->sibling) {
+    for (size_t i = 0; i < children->size; i++) {
       const double value = gamma(generator);
       noise.push_back(value);
       sum += value;
@@ -196,148 +824,458 @@ public:
       value /= sum;
     }
 
-    auto it = noise.begin();
-
-    for (Node *child = root->child; child != nullptr; child = child->sibling) {
-      child->prior_probability = fraction * (*it) + (1 - fraction) * child->prior_probability;
-      ++it;
+    for (size_t i = 0; i < children->size; i++) {
+      children->prior(i) =
+          fraction * noise[i] + (1 - fraction) * children->prior(i);
     }
   }
 
-  Node *select_leaf() {
-    Node *node = root;
+  // Search the root by Gumbel top-k sampling and sequential halving (see
+  // SequentialHalving) for the rest of the turn, over considered of its
+  // children drawn at random and a budget of visits, rather than by PUCT.
+  // The turn is then ended by move_gumbel. Not for concurrent search.
+  void add_gumbel_noise(size_t considered, size_t budget) {
+    static_assert(!Sync::concurrent, "sequential halving is single-threaded");
+    assert(expanded() && !complete());
 
-    while (node->expanded()) {
-      if (node->terminal()) {
-        node->n_visits++;
-        ascend_tree(node->parent, -node->total_av);
-        searches_this_turn_++;
-        return nullptr;
-      }
+    halving_.start(*root->children(), budget, considered, generator);
+  }
 
-      Node *best_child = nullptr;
-      double best_score = 0.0;
+  bool halving() const { return halving_.active(); }
 
-      for (Node *child = node->child; child != nullptr;
-           child = child->sibling) {
-        const double average_av =
-            (child->n_visits == 0) ? 0.0 : (child->total_av / child->n_visits);
+  // Play the best candidate left by sequential halving, recording the
+  // improved policy as the root's search probabilities
+  const Move &move_gumbel() {
+    assert(expanded() && !complete() && halving_.active());
 
-        const double exploration =
-            log((1 + node->n_visits + c_base) / c_base) + c_init;
-        const double prior = child->prior_probability;
-        const double u =
-            exploration * prior * sqrt(node->n_visits) / (1 + child->n_visits);
+    Children *children = root->children();
+    const double value = -root->total_av() / root->n_visits();
 
-        const double score = average_av + u;
+    std::vector<double> policy;
+    halving_.policy(*children, value, policy);
 
-        if (best_child == nullptr || score > best_score) {
-          best_child = child;
-          best_score = score;
-        }
+    return *play_move(&children->node(halving_.best(*children, value)),
+                      &policy);
+  }
+
+  Node *select_leaf() {
+    enforce_budget();
+
+    Node *leaf = nullptr;
+    descend(leaf);
+    return leaf;
+  }
+
+  // Select up to n distinct leaves for evaluation. Each returned leaf holds a
+  // virtual loss along its path until it is passed to expand_leaf, so that
+  // subsequent descents are steered elsewhere. Descents that end at a terminal
+  // node are backed up immediately and count against n; selection stops early
+  // if a descent collides with a leaf that is already awaiting evaluation.
+  std::vector<Node *> select_leaves(size_t n) {
+    enforce_budget();
+
+    std::vector<Node *> leaves;
+
+    for (size_t i = 0; i < n; i++) {
+      Node *leaf = nullptr;
+
+      if (!claim_leaf(leaf)) {
+        break;
       }
 
-      assert(best_child != nullptr);
-      node = best_child;
+      if (leaf != nullptr) {
+        leaves.push_back(leaf);
+      }
     }
 
-    assert(!node->expanded());
-    return node;
+    return leaves;
   }
 
   void expand_leaf(Node *leaf, double av,
                    std::vector<ExpansionEntry> &&expansion) {
     assert(leaf != nullptr && !leaf->expanded());
 
-    if (expansion.empty()) {
-      leaf->child = nullptr;
+    expand(leaf, av, std::move(expansion), leaf->pending());
+  }
+
+  // Expand leaf without building the states of its children; each is built
+  // by materialize once the child is selected
+  void expand_leaf_lazy(Node *leaf, double av,
+                        std::vector<MoveEntry> &&expansion) {
+    assert(leaf != nullptr && !leaf->expanded());
+
+    expand(leaf, av, std::move(expansion), leaf->pending());
+  }
+
+  // Build the state of a lazily expanded node (the root, or a leaf returned
+  // by selection) from its parent's, by
+  //
+  //   play(const GameState &parent, const Move &, GameState &state)
+  //
+  // which returns false on failure. A node that already has its state is
+  // left as is. The nodes of a loaded image have none, so any ancestors
+  // without a state are built first, from the top down.
+  template <class Play> bool materialize(Node *node, Play &&play) {
+    if (node->has_state_) {
+      return true;
+    }
+
+    if (node->block->parent != nullptr) {
+      Node *parent_node = &node->block->parent->node(node->block->parent_index);
+
+      if (!parent_node->has_state_ && !materialize(parent_node, play)) {
+        return false;
+      }
+    }
+
+    const GameState *parent;
+    const Move *move;
+
+    if (node->block->parent == nullptr) {
+      // The root, whose parent and move were moved into the history
+      assert(node == root && !history.empty());
+      parent = &history.back().game_state;
+      move = &history.back()
+                  .search_probabilities[node->block->parent_index]
+                  .first;
     } else {
-      Node *prev_child = nullptr;
+      Node *parent_node = &node->block->parent->node(node->block->parent_index);
+      assert(parent_node->has_state_);
+      parent = &parent_node->game_state;
+      move = &node->move;
+    }
 
-      for (auto &&entry : expansion) {
-        Node *child = alloc_node();
+    if (!play(*parent, *move, node->game_state)) {
+      return false;
+    }
 
-        child->move = std::move(entry.move);
-        child->game_state = std::move(entry.game_state);
-        child->prior_probability = entry.prior_probability;
+    node->has_state_ = true;
+    return true;
+  }
+
+  template <class Play> bool materialize_root(Play &&play) {
+    return materialize(root, std::forward<Play>(play));
+  }
+
+  // Release a leaf returned by select_leaves without expanding it
+  void abandon_leaf(Node *leaf) {
+    if (leaf->pending()) {
+      revert_virtual_loss(leaf);
+    }
+  }
+
+  void expand_leaves(std::vector<Evaluation> &&evaluations) {
+    for (auto &&evaluation : evaluations) {
+      expand_leaf(evaluation.leaf, evaluation.av,
+                  std::move(evaluation.expansion));
+    }
+  }
+
+  // Whether the most visited child of the root stays the most visited
+  // however the next remaining visits fall, so that searching on cannot
+  // change the greedy move. True of a root with a single move, and false of
+  // one not yet expanded.
+  bool decided(size_t remaining) const {
+    if (!expanded()) {
+      return false;
+    }
+
+    Children *children = root->children();
+
+    if (children == nullptr) {
+      return true;
+    }
+
+    uint32_t first = 0;
+    uint32_t second = 0;
+
+    for (size_t i = 0; i < children->size; i++) {
+      const uint32_t n_visits = Sync::load(children->n_visits(i));
+
+      if (n_visits > first) {
+        second = first;
+        first = n_visits;
+      } else if (n_visits > second) {
+        second = n_visits;
+      }
+    }
+
+    return first - second > remaining;
+  }
+
+  // Run visits more searches from n_threads threads at once, calling
+  //
+  //   evaluate(const GameState &, double &av, std::vector<ExpansionEntry> &)
+  //
+  // to evaluate every leaf. It must be safe to call concurrently, and must
+  // expand eagerly, since leaves are never materialized. Threads that collide
+  // with a leaf awaiting evaluation yield and select again. The first
+  // exception thrown by evaluate stops the search and is rethrown once every
+  // thread has returned.
+  template <class Evaluate>
+  void search(size_t visits, size_t n_threads, Evaluate &&evaluate) {
+    search_until(visits, std::chrono::steady_clock::time_point::max(),
+                 n_threads, std::forward<Evaluate>(evaluate), false);
+  }
+
+  // As search, but for as long as fits before deadline; returns the number
+  // of leaves evaluated
+  template <class Rep, class Period, class Evaluate>
+  size_t search_for(std::chrono::duration<Rep, Period> duration,
+                    size_t n_threads, Evaluate &&evaluate,
+                    bool stop_early = true) {
+    return search_until(
+        std::numeric_limits<size_t>::max(),
+        std::chrono::steady_clock::now() +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                duration),
+        n_threads, std::forward<Evaluate>(evaluate), stop_early);
+  }
+
+  // As search, stopping at whichever comes first of visits searches and
+  // deadline, and (if stop_early) once the greedy move is decided by the
+  // searches that remain: the visits left, or, against a deadline, those the
+  // rate so far would fit in the time left. Returns the number of leaves
+  // handed to evaluate and expanded, which leaves out searches that ended on
+  // a terminal node. The deadline is checked before every search, so it is
+  // overrun by at most one evaluation per thread.
+  template <class Evaluate>
+  size_t search_until(size_t visits,
+                      std::chrono::steady_clock::time_point deadline,
+                      size_t n_threads, Evaluate &&evaluate,
+                      bool stop_early = true) {
+    typedef std::chrono::steady_clock Clock;
+
+    assert(n_threads != 0 && (Sync::concurrent || n_threads == 1));
+    assert(!collected());
+
+    enforce_budget();
+
+    const bool timed = (deadline != Clock::time_point::max());
+    const Clock::time_point started_at = timed ? Clock::now() : deadline;
+
+    // Whether to stop before the search reserved as number reserved
+    auto finished = [&](size_t reserved) {
+      if (__atomic_load_n(&cancelled_, __ATOMIC_RELAXED)) {
+        return true;
+      }
+
+      Clock::time_point now;
+
+      if (timed && (now = Clock::now()) >= deadline) {
+        return true;
+      }
+
+      if (!stop_early || reserved % decision_interval != 0 || reserved == 0) {
+        return false;
+      }
+
+      size_t remaining = visits - reserved;
 
-        child->parent = leaf;
-        child->child = nullptr;
+      if (timed) {
+        const double elapsed = std::chrono::duration<double>(now - started_at)
+                                   .count();
+        const double left = std::chrono::duration<double>(deadline - now)
+                                .count();
+        const double fits = (double)reserved / elapsed * left;
 
-        child->n_visits = 0;
-        child->total_av = 0.0;
+        if (fits < (double)remaining) {
+          remaining = (size_t)fits;
+        }
+      }
+
+      return decided(remaining);
+    };
+
+    size_t reserved = 0;
+    size_t evaluated = 0;
+    bool stopped = false;
+
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    auto work = [&]() {
+      std::vector<ExpansionEntry> expansion;
+
+      while (!Sync::load(stopped)) {
+        const size_t number = Sync::fetch_add(reserved, (size_t)1);
+
+        if (number >= visits) {
+          return;
+        }
+
+        if (finished(number)) {
+          Sync::store(stopped, true);
+          return;
+        }
+
+        Node *leaf = nullptr;
 
-        if (prev_child == nullptr) {
-          leaf->child = child;
-        } else {
-          prev_child->sibling = child;
+        while (!claim_leaf(leaf)) {
+          std::this_thread::yield();
         }
 
-        prev_child = child;
+        if (leaf == nullptr) {
+          continue;
+        }
+
+        double av = 0.0;
+        expansion.clear();
+
+        try {
+          evaluate(leaf->state(), av, expansion);
+          expand(leaf, av, std::move(expansion), true);
+          Sync::fetch_add(evaluated, (size_t)1);
+        } catch (...) {
+          if (leaf->pending()) {
+            revert_virtual_loss(leaf);
+          }
+
+          std::lock_guard<std::mutex> lock(error_mutex);
+
+          if (!error) {
+            error = std::current_exception();
+          }
+
+          Sync::store(stopped, true);
+          return;
+        }
       }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(n_threads - 1);
 
-      prev_child->sibling = nullptr;
+    try {
+      for (size_t i = 1; i < n_threads; i++) {
+        threads.emplace_back(work);
+      }
+    } catch (const std::system_error &) {
+      // Search with the threads that did start
     }
 
-    ascend_tree(leaf, av);
+    work();
 
-    searches_this_turn_++;
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    if (error) {
+      std::rethrow_exception(error);
+    }
+
+    return evaluated;
   }
 
-  const Move &move_greedy() {
-    assert(expanded() && !complete());
+  // Search from a background thread (and n_threads - 1 more) while waiting
+  // for the opponent's reply, as search does, until stop_pondering or
+  // commit_opponent_move. The tree must not be touched meanwhile, except to
+  // ask whether it is pondering.
+  template <class Evaluate> void ponder(size_t n_threads, Evaluate evaluate) {
+    assert(!pondering() && !collected());
+
+    ponder_error = nullptr;
+
+    ponder_thread = std::thread([this, n_threads, evaluate]() mutable {
+      try {
+        search_until(std::numeric_limits<size_t>::max(),
+                     std::chrono::steady_clock::time_point::max(), n_threads,
+                     evaluate, false);
+      } catch (...) {
+        ponder_error = std::current_exception();
+      }
+    });
+  }
+
+  bool pondering() const { return ponder_thread.joinable(); }
 
-    Node *best = root->child;
+  // Stop pondering, once every leaf being evaluated is expanded, and rethrow
+  // the exception that stopped the search early, if any
+  void stop_pondering() {
+    if (!pondering()) {
+      return;
+    }
+
+    cancel_pondering();
+
+    if (ponder_error) {
+      std::exception_ptr error = ponder_error;
+      ponder_error = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
 
-    for (Node *child = best->sibling; child != nullptr;
-         child = child->sibling) {
-      if (child->n_visits > best->n_visits) {
-        best = child;
+  // Stop pondering, and play the opponent's move, keeping the subtree
+  // searched under it. Returns false, leaving the tree as it was, if the
+  // root has no child for move (on a root that was never expanded, say),
+  // in which case the caller must reset the tree
+  bool commit_opponent_move(const Move &move) {
+    stop_pondering();
+
+    assert(!collected());
+
+    if (!expanded() || complete()) {
+      return false;
+    }
+
+    Children *children = root->children();
+
+    for (size_t i = 0; i < children->size; i++) {
+      if (children->node(i).move == move) {
+        play_move(&children->node(i));
+        return true;
       }
     }
 
-    return *play_move(best);
+    return false;
   }
 
-  const Move &move_proportional() {
+  const Move &move_greedy() {
     assert(expanded() && !complete());
 
-    if (root->n_visits == 1) {
-      size_t n_children = 1;
-      Node *chosen = root->child;
+    Children *children = root->children();
 
-      for (Node *child = chosen->sibling; child != nullptr;
-           child = child->sibling) {
-        std::uniform_int_distribution<size_t> distribution(0, n_children);
+    size_t best = 0;
 
-        if (distribution(generator) == 0) {
-          chosen = child;
-        }
-
-        n_children++;
+    for (size_t i = 1; i < children->size; i++) {
+      if (children->n_visits(i) > children->n_visits(best)) {
+        best = i;
       }
+    }
 
-      return *play_move(chosen);
+    return *play_move(&children->node(best));
+  }
+
+  const Move &move_proportional() {
+    assert(expanded() && !complete());
+
+    Children *children = root->children();
+
+    if (root->n_visits() == 1) {
+      std::uniform_int_distribution<size_t> distribution(0,
+                                                         children->size - 1);
+      return *play_move(&children->node(distribution(generator)));
     }
 
-    std::uniform_int_distribution<size_t> distribution(0, root->n_visits - 2);
+    std::uniform_int_distribution<size_t> distribution(0,
+                                                       root->n_visits() - 2);
     size_t selector = distribution(generator);
 
-    for (Node *child = root->child;; child = child->sibling) {
-      assert(child != nullptr);
+    for (size_t i = 0;; i++) {
+      assert(i < children->size);
 
-      if (selector < child->n_visits) {
-        return *play_move(child);
+      if (selector < children->n_visits(i)) {
+        return *play_move(&children->node(i));
       }
 
-      selector -= child->n_visits;
+      selector -= children->n_visits(i);
     }
 
     assert(false);
   }
 
   std::pair<double, std::vector<HistoryEntry>> collect_result() {
-    double score = root->terminal() ? root->total_av : 0.0;
+    double score = root->terminal() ? root->total_av() : 0.0;
 
     play_move(nullptr);
 
@@ -353,23 +1291,146 @@ public:
     return result;
   }
 
+  // Append an image of the root and the plies below it, down to plies, to
+  // nodes (see TreeImage), converting moves by
+  //
+  //   encode(const Move &, uint32_t &code)
+  //
+  // which returns false on failure. The tree must not be searching.
+  template <class Encode>
+  bool image(size_t plies, std::vector<TreeImage::Node> &nodes,
+             Encode &&encode) const {
+    assert(!collected());
+
+    // The block and index of each node's edge, its ply and the image index
+    // of its parent, by image index
+    struct Entry {
+      Children *block;
+      size_t index;
+      size_t ply;
+      size_t parent;
+    };
+
+    std::vector<Entry> entries;
+    const size_t offset = nodes.size();
+
+    entries.push_back({root->block, root->index, 0, SIZE_MAX});
+    nodes.push_back({0, 0, root->n_visits(), (float)root->total_av(), 0.0f, 0});
+
+    for (size_t i = 0; i < entries.size(); i++) {
+      const Entry entry = entries[i];
+      TreeImage::Node &node = nodes[offset + i];
+
+      Children *children = Sync::load(entry.block->child_block(entry.index));
+
+      if (children == nullptr) {
+        continue;
+      }
+
+      // The last ply is saved unexpanded, its visits taken back from every
+      // ancestor (as forget does)
+      if (entry.ply == plies) {
+        const uint32_t n_visits = node.n_visits;
+        float av = node.total_av;
+
+        node.n_visits = 0;
+        node.total_av = 0.0f;
+
+        for (size_t k = entry.parent; k != SIZE_MAX; k = entries[k].parent) {
+          av = -av;
+          nodes[offset + k].n_visits -= n_visits;
+          nodes[offset + k].total_av -= av;
+        }
+
+        continue;
+      }
+
+      node.first_child = (uint32_t)(nodes.size() - offset);
+      node.n_children = children->size;
+
+      for (size_t j = 0; j < children->size; j++) {
+        uint32_t code;
+
+        if (!encode(children->node(j).move, code)) {
+          return false;
+        }
+
+        nodes.push_back({0, 0, Sync::load(children->n_visits(j)),
+                         (float)Sync::load(children->total_av(j)),
+                         (float)children->prior(j), code});
+        entries.push_back({children, j, entry.ply + 1, i});
+      }
+    }
+
+    return true;
+  }
+
+  // Warm-start an unexpanded root with the statistics and children saved in
+  // image, which must have been taken at the root's state, converting moves
+  // by
+  //
+  //   decode(uint32_t code, Move &)
+  //
+  // which returns false on failure, leaving the tree in an unspecified (but
+  // destructible) state. Loaded nodes are expanded lazily, and searched as if
+  // the tree had found them itself.
+  template <class Decode>
+  bool load_image(const TreeImage &image, Decode &&decode) {
+    assert(!collected() && !expanded() && root->n_virtual() == 0);
+
+    std::vector<std::pair<size_t, Node *>> entries;
+
+    root->block->n_visits(root->index) = image.root().n_visits;
+    root->block->total_av(root->index) = image.root().total_av;
+    entries.emplace_back(0, root);
+
+    for (size_t i = 0; i < entries.size(); i++) {
+      const TreeImage::Node &saved = image.node(entries[i].first);
+      Node *node = entries[i].second;
+
+      // Children of an unvisited node would be expanded over
+      if (saved.n_children == 0 || saved.n_visits == 0) {
+        continue;
+      }
+
+      Children *children =
+          alloc_children(node->block, node->index, saved.n_children);
+      node->children() = children;
+
+      for (size_t j = 0; j < saved.n_children; j++) {
+        const TreeImage::Node &child = image.node(saved.first_child + j);
+
+        if (!decode(child.move, children->node(j).move)) {
+          return false;
+        }
+
+        children->prior(j) = child.prior;
+        children->total_av(j) = child.total_av;
+        children->n_visits(j) = child.n_visits;
+
+        entries.emplace_back(saved.first_child + j, &children->node(j));
+      }
+    }
+
+    enforce_budget();
+
+    return true;
+  }
+
   void reset(GameState initial_state = GameState(), Move phony_move = Move()) {
-    free_subtree(root);
+    free_tree();
 
-    root = alloc_node();
+    root = &alloc_children(nullptr, 0, 1)->node(0);
 
     root->move = std::move(phony_move);
     root->game_state = std::move(initial_state);
-
-    root->parent = nullptr;
-    root->child = nullptr;
-    root->sibling = nullptr;
-
-    root->n_visits = 0;
-    root->total_av = 0.0;
+    root->has_state_ = true;
 
     history.clear();
 
     searches_this_turn_ = 0;
+    halving_.clear();
   }
 };
+
+#endif
@@ -0,0 +1,131 @@
+import json
+import math
+import os
+
+# Exports the counters of search_stats, memory_stats and an
+# InferenceScheduler's stats, given as a dict of such dicts by group name (say
+# {'search': ..., 'memory': ..., 'inference': ...}). Every entry is a count
+# since the start, and so may be summed over trees, engines or workers,
+# except for these, which hold a current amount
+_GAUGES = frozenset(('live_nodes', 'live_bytes', 'free_bytes', 'capacity', 'generation'))
+
+# The derived rates of a group of search stats, counted over elapsed seconds
+def summarize(search, elapsed=None):
+    descents = max(search.get('descents', 0), 1)
+    summary = dict(mean_depth=search.get('depth', 0) / descents,
+                   terminal_hit_rate=search.get('terminal_hits', 0) / descents,
+                   collision_rate=search.get('collisions', 0) / descents)
+
+    if elapsed:
+        summary['searches_per_second'] = search.get('searches', 0) / elapsed
+
+    # The search's own phases are only measured while timing, and the shares
+    # would otherwise all go to those measured regardless
+    phases = {name[:-3]: value for name, value in search.items() if name.endswith('_ns')}
+    total = sum(phases.values())
+
+    if search.get('select_ns', 0) > 0:
+        for phase, value in phases.items():
+            summary[f'{phase}_share'] = value / total
+
+    return summary
+
+# Sums dicts of stats by key, as sent by each worker, say
+def total(stats):
+    summed = {}
+
+    for entry in stats:
+        for name, value in entry.items():
+            summed[name] = summed.get(name, 0) + value
+
+    return summed
+
+# Counts of durations in bins spaced evenly in log scale, from 1us to 100s at
+# ten per decade, with the first and last bins also taking anything shorter
+# or longer. Mergeable by adding counts, so workers can send theirs compactly
+class LatencyHistogram:
+    _MIN_EXPONENT = -6
+    _BINS_PER_DECADE = 10
+    _BINS = 8 * _BINS_PER_DECADE
+
+    def __init__(self, counts=None):
+        self.counts = list(counts) if counts is not None else [0] * self._BINS
+
+    def record(self, seconds, weight=1):
+        if seconds > 0:
+            index = int((math.log10(seconds) - self._MIN_EXPONENT) * self._BINS_PER_DECADE)
+        else:
+            index = 0
+
+        self.counts[min(max(index, 0), self._BINS - 1)] += weight
+
+    def merge(self, other):
+        for i, count in enumerate(other.counts):
+            self.counts[i] += count
+
+    def total(self):
+        return sum(self.counts)
+
+    # The upper bound of the bin holding the q-th quantile, or None if empty
+    def quantile(self, q):
+        target = q * self.total()
+        seen = 0
+
+        for i, count in enumerate(self.counts):
+            seen += count
+
+            if count > 0 and seen >= target:
+                return self._upper_bound(i)
+
+        return None
+
+    def _upper_bound(self, index):
+        return 10 ** (self._MIN_EXPONENT + (index + 1) / self._BINS_PER_DECADE)
+
+def to_json(groups, **labels):
+    return json.dumps(dict(labels, **groups), sort_keys=True)
+
+# In the text exposition format, with times in seconds
+def to_prometheus(groups, prefix='alpha3', **labels):
+    label_text = ','.join(f'{name}="{_escape(value)}"' for name, value in sorted(labels.items()))
+    label_text = f'{{{label_text}}}' if label_text else ''
+
+    lines = []
+
+    for group, stats in sorted(groups.items()):
+        for name, value in sorted(stats.items()):
+            if name.endswith('_ns'):
+                name = name[:-3] + '_seconds'
+                value = value / 1e9
+
+            if name in _GAUGES:
+                kind = 'gauge'
+            else:
+                kind = 'counter'
+                name += '_total'
+
+            metric = f'{prefix}_{group}_{name}'
+
+            lines.append(f'# TYPE {metric} {kind}')
+            lines.append(f'{metric}{label_text} {value}')
+
+    return '\n'.join(lines) + '\n'
+
+# Replaced whole, so that a scraper (or node_exporter's textfile collector)
+# never reads a partial file. Written as Prometheus text if path ends in
+# .prom, and as JSON otherwise
+def write(path, groups, **labels):
+    if path.endswith('.prom'):
+        text = to_prometheus(groups, **labels)
+    else:
+        text = to_json(groups, **labels) + '\n'
+
+    temporary = f'{path}.tmp'
+
+    with open(temporary, 'w') as file:
+        file.write(text)
+
+    os.replace(temporary, path)
+
+def _escape(value):
+    return str(value).replace('\\', '\\\\').replace('"', '\\"').replace('\n', '\\n')
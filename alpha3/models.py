@@ -1,3 +1,6 @@
+import numpy as np
+import tensorflow as tf
+
 from tensorflow import keras
 from tensorflow.keras import layers
 
@@ -67,3 +70,134 @@ class ConvNet3x3(keras.Model):
             policy = layer(policy)
 
         return self._concat([predicted_outcome, policy])
+
+
+# An inference-only copy of a ConvNet3x3, for self-play. Each convolutional
+# block's batch normalization is folded into its convolution's kernel and
+# bias, leaving a convolution, bias and ReLU that XLA fuses, and the weights
+# are kept in dtype (float16 or bfloat16), with the heads' activations taken
+# in float32. Batches are padded to the next power of two from min_batch, so
+# that the compiled function is traced once per bucket rather than per size.
+#
+# The weights are only read from the model by load, so the copy may be
+# evaluated while the model trains; load again to publish its latest
+class InferenceModel:
+    def __init__(self, model, dtype='float16', jit_compile=True, min_batch=16):
+        self._dtype = tf.as_dtype(dtype)
+        self._min_batch = min_batch
+
+        self._tower = [_fold(layer, self._dtype) for layer in model._tower]
+        self._outcome_head = [_fold(layer, self._dtype) for layer in model._outcome_head]
+        self._policy_head = [_fold(layer, self._dtype) for layer in model._policy_head]
+
+        self._call = tf.function(self._forward, jit_compile=jit_compile)
+
+        self.load(model)
+
+    def load(self, model):
+        for layer in (*self._tower, *self._outcome_head, *self._policy_head):
+            layer.load()
+
+    # Evaluations in float32, as the model returns them
+    def __call__(self, inputs):
+        inputs = np.asarray(inputs, dtype='float32')
+        n = inputs.shape[0]
+
+        bucket = max(self._min_batch, 1 << (n - 1).bit_length())
+
+        if bucket != n:
+            padded = np.zeros((bucket, *inputs.shape[1:]), dtype='float32')
+            padded[:n] = inputs
+            inputs = padded
+
+        return self._call(tf.constant(inputs))[:n]
+
+    def _forward(self, inputs):
+        features = tf.cast(inputs, self._dtype)
+
+        for layer in self._tower:
+            features = layer(features)
+
+        predicted_outcome = features
+
+        for layer in self._outcome_head:
+            predicted_outcome = layer(predicted_outcome)
+
+        policy = features
+
+        for layer in self._policy_head:
+            policy = layer(policy)
+
+        return tf.concat([predicted_outcome, policy], axis=-1)
+
+class _FoldedConvolution:
+    def __init__(self, block, dtype):
+        self._block = block
+        self._dtype = dtype
+
+        kernel = block._convolution.kernel
+        self._kernel = tf.Variable(tf.zeros(kernel.shape, dtype), trainable=False)
+        self._bias = tf.Variable(tf.zeros(kernel.shape[-1:], dtype), trainable=False)
+
+    def load(self):
+        convolution = self._block._convolution
+        batch_norm = self._block._batch_norm
+
+        scale = batch_norm.gamma * tf.math.rsqrt(batch_norm.moving_variance + batch_norm.epsilon)
+
+        self._kernel.assign(tf.cast(convolution.kernel * scale, self._dtype))
+        self._bias.assign(tf.cast((convolution.bias - batch_norm.moving_mean) * scale + batch_norm.beta,
+                                  self._dtype))
+
+    def __call__(self, inputs):
+        outputs = tf.nn.conv2d(inputs, self._kernel, strides=1, padding="SAME")
+        return tf.nn.relu(tf.nn.bias_add(outputs, self._bias))
+
+class _FoldedResidual:
+    def __init__(self, block, dtype):
+        self._first_conv = _FoldedConvolution(block._first_conv, dtype)
+        self._second_conv = _FoldedConvolution(block._second_conv, dtype)
+
+    def load(self):
+        self._first_conv.load()
+        self._second_conv.load()
+
+    def __call__(self, inputs):
+        return inputs + self._second_conv(self._first_conv(inputs))
+
+# Computed in dtype, and activated in float32 (for the heads' tanh and
+# softmax)
+class _FoldedDense:
+    def __init__(self, dense, dtype):
+        self._dense = dense
+        self._dtype = dtype
+
+        self._kernel = tf.Variable(tf.zeros(dense.kernel.shape, dtype), trainable=False)
+        self._bias = tf.Variable(tf.zeros(dense.bias.shape, dtype), trainable=False)
+
+    def load(self):
+        self._kernel.assign(tf.cast(self._dense.kernel, self._dtype))
+        self._bias.assign(tf.cast(self._dense.bias, self._dtype))
+
+    def __call__(self, inputs):
+        outputs = tf.matmul(tf.cast(inputs, self._dtype), self._kernel) + self._bias
+        return self._dense.activation(tf.cast(outputs, tf.float32))
+
+class _Flatten:
+    def load(self):
+        pass
+
+    def __call__(self, inputs):
+        return tf.reshape(inputs, (tf.shape(inputs)[0], -1))
+
+def _fold(layer, dtype):
+    if isinstance(layer, ConvolutionalBlock):
+        return _FoldedConvolution(layer, dtype)
+    elif isinstance(layer, ResidualBlock):
+        return _FoldedResidual(layer, dtype)
+    elif isinstance(layer, layers.Dense):
+        return _FoldedDense(layer, dtype)
+    elif isinstance(layer, layers.Flatten):
+        return _Flatten()
+    else:
+        raise TypeError(f"cannot fold {type(layer).__name__} for inference")
@@ -0,0 +1,206 @@
+#ifndef ALPHA3_PUCT_H
+#define ALPHA3_PUCT_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// x86 only converts signed 32-bit integers to doubles, so counts are
+// converted as themselves less 2^31 (flipping their top bit), then have 2^31
+// added back, both exactly
+#if defined(__AVX__)
+static inline __m256d puct_cvtepu32_pd(__m128i counts) {
+  const __m128i flipped = _mm_xor_si128(counts, _mm_set1_epi32(INT32_MIN));
+  return _mm256_add_pd(_mm256_cvtepi32_pd(flipped),
+                       _mm256_set1_pd(2147483648.0));
+}
+#elif defined(__SSE2__)
+static inline __m128d puct_cvtepu32_pd(__m128i counts) {
+  const __m128i flipped = _mm_xor_si128(counts, _mm_set1_epi32(INT32_MIN));
+  return _mm_add_pd(_mm_cvtepi32_pd(flipped), _mm_set1_pd(2147483648.0));
+}
+#endif
+
+// Index of the child maximizing the PUCT score
+//
+//   Q + exploration * P / (1 + N)
+//
+// over structure-of-arrays child statistics. N includes pending (virtual)
+// visits, each of which is scored as a loss; Q is zero for unvisited
+// children. exploration carries all of the factors that depend only on the
+// parent. Ties go to the lowest index, and every path rounds identically to
+// the scalar loop.
+static inline size_t puct_argmax(const double *prior, const double *total_av,
+                                 const uint32_t *n_visits,
+                                 const uint32_t *n_virtual, size_t n,
+                                 double exploration) {
+  size_t best = 0;
+  double best_score = 0.0;
+  size_t i = 0;
+
+#if defined(__AVX__)
+  if (n >= 4) {
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d four = _mm256_set1_pd(4.0);
+    const __m256d explore = _mm256_set1_pd(exploration);
+
+    __m256d lane_best = _mm256_set1_pd(-HUGE_VAL);
+    __m256d lane_index = _mm256_setzero_pd();
+    __m256d index = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+
+    for (; i + 4 <= n; i += 4) {
+      const __m256d visits = puct_cvtepu32_pd(
+          _mm_loadu_si128((const __m128i *)(n_visits + i)));
+      const __m256d pending = puct_cvtepu32_pd(
+          _mm_loadu_si128((const __m128i *)(n_virtual + i)));
+
+      const __m256d total = _mm256_add_pd(visits, pending);
+      const __m256d q =
+          _mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(total_av + i), pending),
+                        _mm256_max_pd(total, one));
+      const __m256d u = _mm256_div_pd(
+          _mm256_mul_pd(explore, _mm256_loadu_pd(prior + i)),
+          _mm256_add_pd(one, total));
+      const __m256d score = _mm256_add_pd(q, u);
+
+      const __m256d better = _mm256_cmp_pd(score, lane_best, _CMP_GT_OQ);
+      lane_best = _mm256_blendv_pd(lane_best, score, better);
+      lane_index = _mm256_blendv_pd(lane_index, index, better);
+
+      index = _mm256_add_pd(index, four);
+    }
+
+    double scores[4];
+    double indices[4];
+    _mm256_storeu_pd(scores, lane_best);
+    _mm256_storeu_pd(indices, lane_index);
+
+    best = (size_t)indices[0];
+    best_score = scores[0];
+
+    for (int lane = 1; lane < 4; lane++) {
+      const size_t lane_best_index = (size_t)indices[lane];
+
+      if (scores[lane] > best_score ||
+          (scores[lane] == best_score && lane_best_index < best)) {
+        best = lane_best_index;
+        best_score = scores[lane];
+      }
+    }
+  }
+#elif defined(__SSE2__)
+  if (n >= 2) {
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d two = _mm_set1_pd(2.0);
+    const __m128d explore = _mm_set1_pd(exploration);
+
+    __m128d lane_best = _mm_set1_pd(-HUGE_VAL);
+    __m128d lane_index = _mm_setzero_pd();
+    __m128d index = _mm_set_pd(1.0, 0.0);
+
+    for (; i + 2 <= n; i += 2) {
+      const __m128d visits =
+          puct_cvtepu32_pd(_mm_loadl_epi64((const __m128i *)(n_visits + i)));
+      const __m128d pending =
+          puct_cvtepu32_pd(_mm_loadl_epi64((const __m128i *)(n_virtual + i)));
+
+      const __m128d total = _mm_add_pd(visits, pending);
+      const __m128d q = _mm_div_pd(
+          _mm_sub_pd(_mm_loadu_pd(total_av + i), pending), _mm_max_pd(total, one));
+      const __m128d u = _mm_div_pd(_mm_mul_pd(explore, _mm_loadu_pd(prior + i)),
+                                   _mm_add_pd(one, total));
+      const __m128d score = _mm_add_pd(q, u);
+
+      const __m128d better = _mm_cmpgt_pd(score, lane_best);
+      lane_best = _mm_or_pd(_mm_and_pd(better, score),
+                            _mm_andnot_pd(better, lane_best));
+      lane_index = _mm_or_pd(_mm_and_pd(better, index),
+                             _mm_andnot_pd(better, lane_index));
+
+      index = _mm_add_pd(index, two);
+    }
+
+    double scores[2];
+    double indices[2];
+    _mm_storeu_pd(scores, lane_best);
+    _mm_storeu_pd(indices, lane_index);
+
+    best = (size_t)indices[0];
+    best_score = scores[0];
+
+    if (scores[1] > best_score ||
+        (scores[1] == best_score && (size_t)indices[1] < best)) {
+      best = (size_t)indices[1];
+      best_score = scores[1];
+    }
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  if (n >= 2) {
+    const float64x2_t one = vdupq_n_f64(1.0);
+    const float64x2_t two = vdupq_n_f64(2.0);
+    const float64x2_t explore = vdupq_n_f64(exploration);
+
+    float64x2_t lane_best = vdupq_n_f64(-HUGE_VAL);
+    float64x2_t lane_index = vdupq_n_f64(0.0);
+    float64x2_t index = {0.0, 1.0};
+
+    for (; i + 2 <= n; i += 2) {
+      const float64x2_t visits = vcvtq_f64_u64(vmovl_u32(vld1_u32(n_visits + i)));
+      const float64x2_t pending =
+          vcvtq_f64_u64(vmovl_u32(vld1_u32(n_virtual + i)));
+
+      const float64x2_t total = vaddq_f64(visits, pending);
+      const float64x2_t q = vdivq_f64(vsubq_f64(vld1q_f64(total_av + i), pending),
+                                      vmaxq_f64(total, one));
+      const float64x2_t u = vdivq_f64(vmulq_f64(explore, vld1q_f64(prior + i)),
+                                      vaddq_f64(one, total));
+      const float64x2_t score = vaddq_f64(q, u);
+
+      const uint64x2_t better = vcgtq_f64(score, lane_best);
+      lane_best = vbslq_f64(better, score, lane_best);
+      lane_index = vbslq_f64(better, index, lane_index);
+
+      index = vaddq_f64(index, two);
+    }
+
+    double scores[2];
+    double indices[2];
+    vst1q_f64(scores, lane_best);
+    vst1q_f64(indices, lane_index);
+
+    best = (size_t)indices[0];
+    best_score = scores[0];
+
+    if (scores[1] > best_score ||
+        (scores[1] == best_score && (size_t)indices[1] < best)) {
+      best = (size_t)indices[1];
+      best_score = scores[1];
+    }
+  }
+#endif
+
+  for (; i < n; i++) {
+    const double visits = (double)n_visits[i] + (double)n_virtual[i];
+    const double q = (total_av[i] - (double)n_virtual[i]) /
+                     ((visits < 1.0) ? 1.0 : visits);
+    const double u = exploration * prior[i] / (1.0 + visits);
+    const double score = q + u;
+
+    if (i == 0 || score > best_score) {
+      best = i;
+      best_score = score;
+    }
+  }
+
+  return best;
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef ALPHA3_RECLAIM_H
+#define ALPHA3_RECLAIM_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// A background thread that runs jobs posted to it in order, so that freeing
+// a large discarded subtree does not hold up the thread that discarded it.
+// One reclaimer may serve many trees. Jobs still queued when the reclaimer
+// is destroyed are run before its thread exits.
+class Reclaimer {
+public:
+  Reclaimer() : stopping(false), thread([this]() { run(); }) {}
+
+  Reclaimer(const Reclaimer &) = delete;
+
+  Reclaimer &operator=(const Reclaimer &) = delete;
+
+  ~Reclaimer() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+
+    wakeup.notify_one();
+    thread.join();
+  }
+
+  void post(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back(std::move(job));
+    }
+
+    wakeup.notify_one();
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  std::deque<std::function<void()>> jobs;
+  bool stopping;
+
+  // Started last, once the queue is ready
+  std::thread thread;
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;) {
+      wakeup.wait(lock, [this]() { return stopping || !jobs.empty(); });
+
+      if (jobs.empty()) {
+        return;
+      }
+
+      std::function<void()> job(std::move(jobs.front()));
+      jobs.pop_front();
+
+      lock.unlock();
+      job();
+      lock.lock();
+    }
+  }
+};
+
+#endif
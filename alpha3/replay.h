@@ -0,0 +1,161 @@
+#ifndef ALPHA3_REPLAY_H
+#define ALPHA3_REPLAY_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Bounded ring of training examples, each stored as a fixed-size record of
+//
+//   float labels[n_labels]
+//   uint8 features[], one bit per binary feature from the least significant
+//         bit of each byte, padded with zeros to a multiple of four bytes
+//
+// as written by ConnectKRules::write_record. Any number of threads may insert
+// and sample at once without locking: inserts reserve consecutive positions
+// with a single atomic add (overwriting the oldest records once the ring is
+// full), and every slot is guarded by a sequence lock, so that samplers skip
+// slots being written. A writer that finds its slot busy, which takes the
+// ring lapping a slower writer, drops its record.
+class ReplayRing {
+public:
+  ReplayRing(size_t capacity_, size_t n_labels_, size_t n_features_)
+      : capacity(capacity_), n_labels(n_labels_), n_features(n_features_),
+        words(n_labels_ + (n_features_ + 31) / 32), versions(capacity_, 0),
+        data(capacity_ * words), head(0), filled(0) {
+    assert(capacity != 0);
+  }
+
+  ReplayRing(const ReplayRing &) = delete;
+
+  ReplayRing &operator=(const ReplayRing &) = delete;
+
+  size_t record_size() const { return words * sizeof(uint32_t); }
+
+  size_t labels_per_record() const { return n_labels; }
+
+  size_t features_per_record() const { return n_features; }
+
+  // Records inserted and not yet overwritten
+  size_t size() const {
+    const uint64_t n = __atomic_load_n(&filled, __ATOMIC_ACQUIRE);
+    return (n < capacity) ? (size_t)n : capacity;
+  }
+
+  // Copy in n consecutive records
+  void insert(const uint8_t *records, size_t n) {
+    const uint64_t first = __atomic_fetch_add(&head, n, __ATOMIC_RELAXED);
+
+    // Of a batch larger than the ring, only the last capacity records would
+    // survive
+    for (size_t i = (n > capacity) ? (n - capacity) : 0; i < n; i++) {
+      write((size_t)((first + i) % capacity), records + i * record_size());
+    }
+  }
+
+  // Draw n records uniformly with replacement, unpacking them into n rows of
+  // features and of labels. Unless n is zero, the ring must not be empty
+  template <class Generator>
+  void sample(size_t n, Generator &generator, float *features,
+              float *labels) const {
+    if (n == 0) {
+      return;
+    }
+
+    assert(size() != 0);
+
+    std::vector<uint32_t> record(words);
+
+    for (size_t i = 0; i < n; i++) {
+      // A read only fails on a slot that an insert in progress has reserved
+      // and not yet finished writing. A non-empty ring always has some slot
+      // written, and every slot picked is readable again once its insert
+      // finishes, so the draws stop failing as soon as the inserts in
+      // progress do, however many there are
+      while (!read(pick(generator), record.data())) {
+      }
+
+      memcpy(labels + i * n_labels, record.data(), n_labels * sizeof(float));
+
+      const auto bits = (const uint8_t *)(record.data() + n_labels);
+      float *row = features + i * n_features;
+
+      for (size_t j = 0; j < n_features; j++) {
+        row[j] = (float)((bits[j / 8] >> (j % 8)) & 1);
+      }
+    }
+  }
+
+private:
+  const size_t capacity;
+  const size_t n_labels;
+  const size_t n_features;
+  const size_t words;
+
+  // Odd while a write is in progress, and zero until the first
+  std::vector<uint64_t> versions;
+  std::vector<uint32_t> data;
+
+  // Positions reserved by inserts, and records completely written
+  uint64_t head;
+  uint64_t filled;
+
+  void write(size_t slot, const uint8_t *record) {
+    uint64_t version = __atomic_load_n(&versions[slot], __ATOMIC_RELAXED);
+
+    if ((version & 1) != 0 ||
+        !__atomic_compare_exchange_n(&versions[slot], &version, version + 1,
+                                     false, __ATOMIC_ACQUIRE,
+                                     __ATOMIC_RELAXED)) {
+      return;
+    }
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    uint32_t *out = &data[slot * words];
+
+    for (size_t i = 0; i < words; i++) {
+      uint32_t word;
+      memcpy(&word, record + i * sizeof(uint32_t), sizeof(uint32_t));
+      __atomic_store_n(&out[i], word, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&versions[slot], version + 2, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&filled, 1, __ATOMIC_RELEASE);
+  }
+
+  // Copy out the record in slot, unless it is unwritten or being written
+  bool read(size_t slot, uint32_t *record) const {
+    const uint64_t version =
+        __atomic_load_n(&versions[slot], __ATOMIC_ACQUIRE);
+
+    if (version == 0 || (version & 1) != 0) {
+      return false;
+    }
+
+    const uint32_t *in = &data[slot * words];
+
+    for (size_t i = 0; i < words; i++) {
+      record[i] = __atomic_load_n(&in[i], __ATOMIC_RELAXED);
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&versions[slot], __ATOMIC_RELAXED) == version;
+  }
+
+  // Slots holding records lie below the number of positions reserved, if
+  // they have not all been filled yet
+  template <class Generator> size_t pick(Generator &generator) const {
+    const uint64_t reserved = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    const size_t bound = (reserved < capacity) ? (size_t)reserved : capacity;
+
+    std::uniform_int_distribution<size_t> distribution(0, bound - 1);
+    return distribution(generator);
+  }
+};
+
+#endif
@@ -24,3 +24,37 @@ class ReplayBuffer:
 
     def __len__(self):
         return self._size
+
+# Holds examples as the packed records of ConnectKSelfPlayEngine, with binary
+# features stored as bits. Samples are drawn with replacement, in time linear
+# in their size, into arrays that are reused by the next call to sample.
+class PackedReplayBuffer:
+    def __init__(self, max_size, features_shape, label_shape):
+        # Imported here, so that the pure-Python ReplayBuffer does not need
+        # the extension built
+        from alpha3.a3mcts import ReplayBuffer as _NativeReplayBuffer
+
+        self._ring = _NativeReplayBuffer(max_size, int(np.prod(label_shape)), int(np.prod(features_shape)))
+        self._features_shape = tuple(features_shape)
+        self._label_shape = tuple(label_shape)
+        self._features = np.empty((0, *features_shape), dtype='float32')
+        self._labels = np.empty((0, *label_shape), dtype='float32')
+
+    def insert_records(self, records):
+        self._ring.insert(records)
+
+    def record_size(self):
+        return self._ring.record_size()
+
+    def sample(self, size):
+        size = min(size, len(self))
+
+        if self._features.shape[0] != size:
+            self._features = np.empty((size, *self._features_shape), dtype='float32')
+            self._labels = np.empty((size, *self._label_shape), dtype='float32')
+
+        self._ring.sample(size, self._features, self._labels)
+        return (self._features, self._labels)
+
+    def __len__(self):
+        return self._ring.size()
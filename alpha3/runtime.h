@@ -0,0 +1,903 @@
+#ifndef ALPHA3_RUNTIME_H
+#define ALPHA3_RUNTIME_H
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "channel.h"
+#include "selfplay.h"
+
+// A deque of indices for work stealing, after Chase and Lev, "Dynamic
+// circular work-stealing deque" (2005), with the memory orderings of Lê et
+// al., "Correct and efficient work-stealing for weak memory models" (2013).
+// Its owner pushes and pops at the bottom, and any other thread steals from
+// the top, without locks. The capacity is fixed, so the deque must never
+// hold more items than it was made for.
+class StealingDeque {
+public:
+  explicit StealingDeque(size_t capacity)
+      : mask(round_up_pow2(std::max(capacity, (size_t)1)) - 1),
+        items(mask + 1), top(0), bottom(0) {}
+
+  StealingDeque(const StealingDeque &) = delete;
+
+  StealingDeque &operator=(const StealingDeque &) = delete;
+
+  // Owner only
+  void push(size_t item) {
+    const int64_t b = __atomic_load_n(&bottom, __ATOMIC_RELAXED);
+
+    assert(b - __atomic_load_n(&top, __ATOMIC_ACQUIRE) <= (int64_t)mask);
+
+    __atomic_store_n(&items[(size_t)b & mask], item, __ATOMIC_RELAXED);
+    __atomic_store_n(&bottom, b + 1, __ATOMIC_RELEASE);
+  }
+
+  // Owner only: take the item pushed last, unless empty
+  bool pop(size_t &item) {
+    const int64_t b = __atomic_load_n(&bottom, __ATOMIC_RELAXED) - 1;
+
+    // Claim the bottom item before reading the top, so that a thief racing
+    // for the same item either sees the claim or is seen
+    __atomic_store_n(&bottom, b, __ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&top, __ATOMIC_SEQ_CST);
+
+    if (t > b) {
+      __atomic_store_n(&bottom, b + 1, __ATOMIC_RELAXED);
+      return false;
+    }
+
+    item = __atomic_load_n(&items[(size_t)b & mask], __ATOMIC_RELAXED);
+
+    if (t < b) {
+      return true;
+    }
+
+    // The last item, which goes to whichever of the owner and a thief moves
+    // the top first
+    const bool won = __atomic_compare_exchange_n(
+        &top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&bottom, b + 1, __ATOMIC_RELAXED);
+    return won;
+  }
+
+  // Any thread: take the item pushed first, unless empty. Retries when
+  // another thread takes the item first, so only fails when none is left
+  bool steal(size_t &item) {
+    for (;;) {
+      int64_t t = __atomic_load_n(&top, __ATOMIC_SEQ_CST);
+      const int64_t b = __atomic_load_n(&bottom, __ATOMIC_SEQ_CST);
+
+      if (t >= b) {
+        return false;
+      }
+
+      item = __atomic_load_n(&items[(size_t)t & mask], __ATOMIC_RELAXED);
+
+      if (__atomic_compare_exchange_n(&top, &t, t + 1, false,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return true;
+      }
+    }
+  }
+
+private:
+  const size_t mask;
+  std::vector<size_t> items;
+
+  // Apart, so that thieves moving the top don't contend with the owner's
+  // pushes
+  alignas(64) int64_t top;
+  alignas(64) int64_t bottom;
+
+  static size_t round_up_pow2(size_t n) {
+    size_t rounded = 1;
+
+    while (rounded < n) {
+      rounded *= 2;
+    }
+
+    return rounded;
+  }
+};
+
+// Plays many games of self-play at once, as SelfPlayEngine does, but over
+// a pool of threads that exchange batches with an EvaluationChannel
+// themselves, rather than in steps that advance every tree in turn. Each
+// thread keeps a deque of the trees ready for selection, advances them one
+// at a time (choosing moves, adding noise and collecting finished games as
+// it goes) until each is blocked on new leaves or finishes a game, and
+// writes the leaves' features into a slot of the channel of its own. It
+// posts the slot's batch once full, or once out of trees, and the batch's
+// trees park with it in a completion queue. Threads out of trees take the
+// oldest batch from the queue and wait for its evaluations, which they copy
+// out to free the slot, then push its trees back onto their own deque, to be
+// expanded by whichever thread takes each next. Threads still out of trees
+// steal them from the top of the others' deques, so that none sits idle
+// while trees are ready elsewhere.
+//
+// Game is as for SelfPlayEngine, with policies as arrays of policy_width()
+// floats, and
+//
+//   size_t n_features();
+//   void features(const State &, float *out);
+//
+// writing features as the channel carries them. Its methods are called
+// from every thread at once. Positions are looked up in the transposition
+// table, which every thread shares, but repeats of a position already in
+// flight are evaluated again rather than waiting on it. Entries are tagged
+// with the generation of the response that brought them.
+//
+// Runs from start until stop, or until the channel is closed or a game
+// fails, either of which stops every thread.
+template <class Game, class Tree = MCTS<typename Game::State,
+                                        typename Game::Move>>
+class SelfPlayRuntime {
+public:
+  typedef SelfPlayEngine<Game, Tree> Engine;
+  typedef typename Engine::Config Config;
+  typedef typename Engine::Result Result;
+  typedef typename Engine::TranspositionStats TranspositionStats;
+  typedef typename Game::State State;
+  typedef typename Tree::Node Node;
+  typedef typename Tree::MemoryStats MemoryStats;
+  typedef typename Tree::SearchStats SearchStats;
+
+  enum Failure { no_failure, game_failure, memory_failure };
+
+  // Batches' latencies, from posting to the response, are counted in bins
+  // spaced evenly in log scale from 1us to 100s, by their positions
+  static constexpr size_t latency_bins = 80;
+  static constexpr int latency_min_exponent = -6;
+  static constexpr int latency_bins_per_decade = 10;
+
+  // Drives n_trees trees from n_threads threads, through the n_slots slots
+  // of channel from first_slot, which are left to the runtime. Needs a slot
+  // more than threads, so that a batch is in flight while each thread
+  // builds another; twice as many keeps one in flight per thread.
+  SelfPlayRuntime(Game game_, const Config &config_, size_t n_trees,
+                  State initial_state_, EvaluationChannel &channel_,
+                  size_t first_slot_, size_t n_slots, size_t n_threads)
+      : game(std::move(game_)), config(config_),
+        initial_state(std::move(initial_state_)), channel(channel_),
+        first_slot(first_slot_), n_features(game.n_features()),
+        policy_width(game.policy_width()), batches(n_slots),
+        search_snapshots(n_trees), memory_snapshots(n_trees),
+        latencies(latency_bins, 0) {
+    assert(n_trees != 0 && config.evaluations != 0 &&
+           config.leaves_per_tree != 0 && n_threads != 0 &&
+           n_slots > n_threads && first_slot + n_slots <= channel.n_slots() &&
+           channel.batch_capacity() >= config.leaves_per_tree &&
+           channel.features_per_position() == n_features &&
+           channel.priors_per_position() == policy_width);
+
+    if (config.reclaim_visits != 0) {
+      reclaimer.reset(new Reclaimer());
+    }
+
+    searches.reserve(n_trees);
+
+    for (size_t i = 0; i < n_trees; i++) {
+      searches.emplace_back(config.c_init, config.c_base,
+                            game.copy(initial_state));
+      searches.back().tree.set_node_budget(config.node_budget);
+      searches.back().tree.set_reclaimer(reclaimer.get(),
+                                         config.reclaim_visits);
+    }
+
+    if constexpr (Game::transposable) {
+      if (config.transpositions != 0) {
+        table.reset(new TranspositionTable(config.transpositions,
+                                           policy_width));
+      }
+    }
+
+    workers.reserve(n_threads);
+
+    for (size_t i = 0; i < n_threads; i++) {
+      workers.emplace_back(new Worker(n_trees, policy_width, i));
+    }
+
+    // Dealt out evenly, to be stolen if uneven; the threads start later
+    for (size_t i = 0; i < n_trees; i++) {
+      workers[i % n_threads]->ready.push(i);
+    }
+
+    for (size_t slot = 0; slot < n_slots; slot++) {
+      batches[slot].searches.reserve(channel.batch_capacity());
+      free_slots.push_back(slot);
+    }
+  }
+
+  SelfPlayRuntime(const SelfPlayRuntime &) = delete;
+
+  SelfPlayRuntime &operator=(const SelfPlayRuntime &) = delete;
+
+  ~SelfPlayRuntime() { stop(); }
+
+  // As SelfPlayEngine::set_opening_book, but only before start
+  bool set_opening_book(const TreeImage *book_) {
+    assert(!started_);
+
+    book = book_;
+
+    if (book == nullptr) {
+      return true;
+    }
+
+    for (Search &search : searches) {
+      if (!search.tree.expanded() &&
+          !load_opening_book(game, search.tree, *book)) {
+        book = nullptr;
+        search.tree.reset(game.copy(initial_state));
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // As SelfPlayEngine::set_timing, but only before start
+  void set_timing(bool timing) {
+    assert(!started_);
+
+    timing_ = timing;
+
+    for (Search &search : searches) {
+      search.tree.set_timing(timing);
+    }
+  }
+
+  bool timing() const { return timing_; }
+
+  bool started() const { return started_; }
+
+  // Start every thread. Throws std::system_error, with none running, if one
+  // can't be started
+  void start() {
+    assert(!started_);
+
+    started_ = true;
+
+    try {
+      for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->thread = std::thread([this, i]() { run(i); });
+      }
+    } catch (...) {
+      stop();
+      throw;
+    }
+  }
+
+  // Stop every thread, once done with the tree in hand, and join them.
+  // Batches in flight are left unanswered in the channel
+  void stop() {
+    halt(no_failure);
+
+    for (auto &worker : workers) {
+      if (worker->thread.joinable()) {
+        worker->thread.join();
+      }
+    }
+  }
+
+  // Wait up to timeout for the runtime to stop, and return whether it has
+  template <class Rep, class Period>
+  bool wait_for(std::chrono::duration<Rep, Period> timeout) {
+    std::unique_lock<std::mutex> lock(idle_mutex);
+    return wakeup.wait_for(lock, timeout, [this]() { return stopping(); });
+  }
+
+  // Why the runtime stopped, if it stopped of itself
+  Failure failure() const {
+    return (Failure)__atomic_load_n(&failure_, __ATOMIC_ACQUIRE);
+  }
+
+  // Games finished since the last call to take_results
+  std::vector<Result> take_results() {
+    std::lock_guard<std::mutex> lock(results_mutex);
+
+    std::vector<Result> taken(std::move(results));
+    results.clear();
+    return taken;
+  }
+
+  TranspositionStats transposition_stats() const {
+    const uint64_t generation_ =
+        __atomic_load_n(&generation, __ATOMIC_RELAXED);
+
+    if (!table) {
+      return {0, generation_, 0, 0, 0, 0};
+    }
+
+    const TranspositionTable::Stats stats = table->stats();
+    return {table->capacity(), generation_, stats.hits, stats.misses, 0,
+            stats.evictions};
+  }
+
+  // Summed over every tree, as of the last batch each joined
+  MemoryStats memory_stats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+
+    MemoryStats total = {0, 0, 0, 0, 0, 0, 0};
+
+    for (const MemoryStats &stats : memory_snapshots) {
+      total.live_nodes += stats.live_nodes;
+      total.reused_nodes += stats.reused_nodes;
+      total.pruned_nodes += stats.pruned_nodes;
+      total.live_bytes += stats.live_bytes;
+      total.free_bytes += stats.free_bytes;
+      total.allocated_blocks += stats.allocated_blocks;
+      total.recycled_blocks += stats.recycled_blocks;
+    }
+
+    return total;
+  }
+
+  // Summed over every tree, as of the last batch each joined
+  SearchStats search_stats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+
+    SearchStats total = {0, 0, 0, 0, 0, 0, 0, 0};
+
+    for (const SearchStats &stats : search_snapshots) {
+      total.searches += stats.searches;
+      total.descents += stats.descents;
+      total.depth += stats.depth;
+      total.terminal_hits += stats.terminal_hits;
+      total.collisions += stats.collisions;
+      total.select_ns += stats.select_ns;
+      total.expand_ns += stats.expand_ns;
+      total.backup_ns += stats.backup_ns;
+    }
+
+    return total;
+  }
+
+  // Nanoseconds spent, summed over the threads, in the game while timing,
+  // writing features while timing, and waiting on evaluations regardless
+  uint64_t game_ns() const { return sum(&Worker::game_ns); }
+
+  uint64_t marshal_ns() const { return sum(&Worker::marshal_ns); }
+
+  uint64_t wait_ns() const { return sum(&Worker::wait_ns); }
+
+  std::vector<uint64_t> latency_counts() const {
+    std::vector<uint64_t> counts(latency_bins);
+
+    for (size_t i = 0; i < latency_bins; i++) {
+      counts[i] = __atomic_load_n(&latencies[i], __ATOMIC_RELAXED);
+    }
+
+    return counts;
+  }
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  static constexpr size_t no_slot = (size_t)-1;
+
+  // How long an idle thread sleeps before checking whether the channel was
+  // closed
+  static constexpr std::chrono::milliseconds idle_timeout{100};
+
+  struct Search {
+    Tree tree;
+    bool noised;
+
+    // The leaves awaiting evaluation in a batch, from offset on, and their
+    // keys if looked up in the table
+    std::vector<Node *> leaves;
+    std::vector<uint64_t> keys;
+    size_t offset;
+
+    // Once answered, a value and a row of priors for each leaf, and the
+    // generation they were tagged with
+    std::vector<float> evaluations;
+    uint64_t generation;
+
+    Search(double c_init, double c_base, State state)
+        : tree(c_init, c_base, std::move(state)), noised(false), offset(0),
+          generation(0) {}
+  };
+
+  struct Batch {
+    // Searches with leaves in the batch, and the number of leaves
+    std::vector<size_t> searches;
+    size_t n = 0;
+
+    Clock::time_point posted_at;
+  };
+
+  struct Worker {
+    StealingDeque ready;
+    std::vector<float> priors;
+    std::vector<size_t> answered;
+    std::thread thread;
+
+    // Starts off the thread's choice of victim
+    uint64_t random;
+
+    uint64_t game_ns = 0;
+    uint64_t marshal_ns = 0;
+    uint64_t wait_ns = 0;
+
+    Worker(size_t capacity, size_t policy_width, size_t index)
+        : ready(capacity), priors(policy_width),
+          random(0x9e3779b97f4a7c15ULL * (index + 1)) {}
+  };
+
+  Game game;
+  const Config config;
+  const State initial_state;
+
+  EvaluationChannel &channel;
+  const size_t first_slot;
+  const size_t n_features;
+  const size_t policy_width;
+
+  // Outlives the trees, which wait for their subtrees on destruction
+  std::unique_ptr<Reclaimer> reclaimer;
+
+  std::vector<Search> searches;
+  std::vector<Batch> batches;
+
+  std::unique_ptr<TranspositionTable> table;
+  uint64_t generation = 0;
+
+  const TreeImage *book = nullptr;
+  bool timing_ = false;
+  bool started_ = false;
+
+  std::vector<std::unique_ptr<Worker>> workers;
+
+  // Guards the free slots and the completion queue of posted batches,
+  // oldest first
+  std::mutex queue_mutex;
+  std::vector<size_t> free_slots;
+  std::deque<size_t> completions;
+
+  // Idle threads sleep until the epoch moves on, which it does whenever a
+  // batch is posted or answered, or a slot freed. Signalling only takes the
+  // mutex while some thread sleeps
+  std::mutex idle_mutex;
+  std::condition_variable wakeup;
+  uint64_t epoch = 0;
+  uint32_t sleepers = 0;
+  bool stopping_ = false;
+  int failure_ = no_failure;
+
+  std::mutex results_mutex;
+  std::vector<Result> results;
+
+  // The stats of each tree, as of the last batch it joined
+  mutable std::mutex stats_mutex;
+  std::vector<SearchStats> search_snapshots;
+  std::vector<MemoryStats> memory_snapshots;
+
+  std::vector<uint64_t> latencies;
+
+  bool stopping() const {
+    return __atomic_load_n(&stopping_, __ATOMIC_ACQUIRE);
+  }
+
+  void halt(Failure failure) {
+    {
+      std::lock_guard<std::mutex> lock(idle_mutex);
+
+      if (!stopping_ && failure != no_failure) {
+        __atomic_store_n(&failure_, (int)failure, __ATOMIC_RELEASE);
+      }
+
+      __atomic_store_n(&stopping_, true, __ATOMIC_RELEASE);
+    }
+
+    wakeup.notify_all();
+  }
+
+  void signal() {
+    __atomic_fetch_add(&epoch, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&sleepers, __ATOMIC_SEQ_CST) != 0) {
+      // Taken so that no sleeper is between its check and its wait
+      { std::lock_guard<std::mutex> lock(idle_mutex); }
+
+      wakeup.notify_all();
+    }
+  }
+
+  // Sleep until the epoch moves on from seen, or for idle_timeout
+  void idle(uint64_t seen) {
+    std::unique_lock<std::mutex> lock(idle_mutex);
+
+    __atomic_fetch_add(&sleepers, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&epoch, __ATOMIC_SEQ_CST) == seen && !stopping_) {
+      wakeup.wait_for(lock, idle_timeout);
+    }
+
+    __atomic_fetch_sub(&sleepers, 1, __ATOMIC_SEQ_CST);
+  }
+
+  uint64_t sum(uint64_t Worker::*counter) const {
+    uint64_t total = 0;
+
+    for (const auto &worker : workers) {
+      total += __atomic_load_n(&((*worker).*counter), __ATOMIC_RELAXED);
+    }
+
+    return total;
+  }
+
+  // Call fn, counting the time it takes towards counter if timing
+  template <class Fn> bool timed(uint64_t &counter, Fn &&fn) {
+    if (!timing_) {
+      return fn();
+    }
+
+    const auto started_at = Clock::now();
+    const bool ok = fn();
+
+    __atomic_fetch_add(
+        &counter,
+        (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - started_at)
+            .count(),
+        __ATOMIC_RELAXED);
+
+    return ok;
+  }
+
+  void run(size_t index) {
+    try {
+      if (!work(*workers[index], index)) {
+        halt(game_failure);
+      }
+    } catch (std::bad_alloc &) {
+      halt(memory_failure);
+    }
+  }
+
+  // Returns false if a game fails
+  bool work(Worker &worker, size_t index) {
+    size_t building = no_slot;
+
+    while (!stopping()) {
+      if (channel.closed()) {
+        halt(no_failure);
+        break;
+      }
+
+      const uint64_t seen = __atomic_load_n(&epoch, __ATOMIC_SEQ_CST);
+
+      size_t i;
+
+      if (take(worker, index, i)) {
+        Search &search = searches[i];
+
+        if (!search.leaves.empty() && !expand(worker, search)) {
+          return false;
+        }
+
+        if (building == no_slot) {
+          building = acquire_slot();
+        }
+
+        if (building != no_slot) {
+          if (!advance(worker, i, building)) {
+            return false;
+          }
+
+          if (batches[building].n + config.leaves_per_tree >
+              channel.batch_capacity()) {
+            post(building);
+            building = no_slot;
+          }
+
+          continue;
+        }
+
+        // Every slot is taken, so the tree waits for one to be freed
+        worker.ready.push(i);
+      } else if (building != no_slot && batches[building].n != 0) {
+        post(building);
+        building = no_slot;
+        continue;
+      }
+
+      size_t slot;
+
+      if (take_completion(slot)) {
+        complete(worker, slot);
+        continue;
+      }
+
+      idle(seen);
+    }
+
+    return true;
+  }
+
+  // Pop a tree from the worker's deque, or else steal one from another's
+  bool take(Worker &worker, size_t index, size_t &i) {
+    if (worker.ready.pop(i)) {
+      return true;
+    }
+
+    const size_t n = workers.size();
+
+    worker.random ^= worker.random << 13;
+    worker.random ^= worker.random >> 7;
+    worker.random ^= worker.random << 17;
+
+    const size_t start = (size_t)(worker.random % n);
+
+    for (size_t k = 0; k < n; k++) {
+      const size_t victim = (start + k) % n;
+
+      if (victim != index && workers[victim]->ready.steal(i)) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  size_t acquire_slot() {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+
+    if (free_slots.empty()) {
+      return no_slot;
+    }
+
+    const size_t slot = free_slots.back();
+    free_slots.pop_back();
+    return slot;
+  }
+
+  void release_slot(size_t slot) {
+    batches[slot].searches.clear();
+    batches[slot].n = 0;
+
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex);
+      free_slots.push_back(slot);
+    }
+
+    signal();
+  }
+
+  bool take_completion(size_t &slot) {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+
+    if (completions.empty()) {
+      return false;
+    }
+
+    slot = completions.front();
+    completions.pop_front();
+    return true;
+  }
+
+  // Post the batch of slot, remembering the stats of its trees
+  void post(size_t slot) {
+    Batch &batch = batches[slot];
+
+    {
+      std::lock_guard<std::mutex> lock(stats_mutex);
+
+      for (size_t i : batch.searches) {
+        search_snapshots[i] = searches[i].tree.search_stats();
+        memory_snapshots[i] = searches[i].tree.memory_stats();
+      }
+    }
+
+    batch.posted_at = Clock::now();
+    channel.request(first_slot + slot, batch.n);
+
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex);
+      completions.push_back(slot);
+    }
+
+    signal();
+  }
+
+  // Wait for the response to the batch of slot, copy out its evaluations
+  // to free the slot, and hand its trees to the worker, unless the runtime
+  // stops first
+  void complete(Worker &worker, size_t slot) {
+    Batch &batch = batches[slot];
+
+    const Clock::time_point started_at = Clock::now();
+
+    uint64_t generation_;
+
+    while (!channel.wait_response_for(first_slot + slot, generation_,
+                                      idle_timeout)) {
+      if (channel.closed() || stopping()) {
+        halt(no_failure);
+        return;
+      }
+    }
+
+    const Clock::time_point now = Clock::now();
+
+    __atomic_fetch_add(
+        &worker.wait_ns,
+        (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            now - started_at)
+            .count(),
+        __ATOMIC_RELAXED);
+
+    record_latency(now - batch.posted_at, batch.n);
+
+    __atomic_store_n(&generation, generation_, __ATOMIC_RELAXED);
+
+    const float *values = channel.values(first_slot + slot);
+    const float *policies = channel.policies(first_slot + slot);
+
+    for (size_t i : batch.searches) {
+      Search &search = searches[i];
+
+      search.evaluations.resize(search.leaves.size() * (1 + policy_width));
+      search.generation = generation_;
+
+      float *out = search.evaluations.data();
+
+      for (size_t k = 0; k < search.leaves.size(); k++) {
+        const size_t offset = search.offset + k;
+
+        *(out++) = values[offset];
+        out = std::copy(policies + offset * policy_width,
+                        policies + (offset + 1) * policy_width, out);
+      }
+    }
+
+    worker.answered.swap(batch.searches);
+    release_slot(slot);
+
+    // Published to other threads by the pushes
+    for (size_t i : worker.answered) {
+      worker.ready.push(i);
+    }
+
+    worker.answered.clear();
+
+    signal();
+  }
+
+  void record_latency(Clock::duration latency, size_t n) {
+    const double seconds = std::chrono::duration<double>(latency).count();
+
+    long bin = 0;
+
+    if (seconds > 0) {
+      bin = (long)std::floor((std::log10(seconds) - latency_min_exponent) *
+                             latency_bins_per_decade);
+    }
+
+    bin = std::min(std::max(bin, 0L), (long)latency_bins - 1);
+
+    __atomic_fetch_add(&latencies[(size_t)bin], (uint64_t)n,
+                       __ATOMIC_RELAXED);
+  }
+
+  // Expand the leaves of search with their evaluations
+  bool expand(Worker &worker, Search &search) {
+    std::vector<typename Tree::MoveEntry> expansion;
+
+    for (size_t k = 0; k < search.leaves.size(); k++) {
+      Node *leaf = search.leaves[k];
+      const float *evaluation = &search.evaluations[k * (1 + policy_width)];
+
+      expansion.clear();
+
+      if (!timed(worker.game_ns, [&]() {
+            return game.expand(leaf->state(), evaluation + 1, expansion);
+          })) {
+        return false;
+      }
+
+      search.tree.expand_leaf_lazy(leaf, evaluation[0], std::move(expansion));
+
+      if constexpr (Game::transposable) {
+        if (table) {
+          table->insert(search.keys[k], search.generation, evaluation[0],
+                        evaluation + 1);
+        }
+      }
+    }
+
+    search.leaves.clear();
+    search.keys.clear();
+
+    return true;
+  }
+
+  // What advance_self_play hands the leaves of search to, writing their
+  // features into the batch of a slot
+  struct Turns {
+    SelfPlayRuntime &runtime;
+    Worker &worker;
+    Search &search;
+    Batch &batch;
+    float *features;
+
+    template <class Fn> bool in_game(Fn &&fn) {
+      return runtime.timed(worker.game_ns, std::forward<Fn>(fn));
+    }
+
+    void finish(std::pair<double, std::vector<typename Tree::HistoryEntry>>
+                    &&result) {
+      std::lock_guard<std::mutex> lock(runtime.results_mutex);
+      runtime.results.push_back({result.first, std::move(result.second)});
+    }
+
+    void queue(Node *leaf, uint64_t key) {
+      if (runtime.table) {
+        search.keys.push_back(key);
+      }
+
+      runtime.timed(worker.marshal_ns, [&]() {
+        runtime.game.features(leaf->state(),
+                              features + batch.n * runtime.n_features);
+        return true;
+      });
+
+      search.leaves.push_back(leaf);
+      batch.n++;
+    }
+
+    TranspositionTable *table() { return runtime.table.get(); }
+
+    uint64_t generation() {
+      return __atomic_load_n(&runtime.generation, __ATOMIC_RELAXED);
+    }
+
+    float *priors() { return worker.priors.data(); }
+  };
+
+  // Run the tree of search i until at least one of its leaves awaits
+  // evaluation, in the batch of slot, or its game finishes
+  bool advance(Worker &worker, size_t i, size_t slot) {
+    Search &search = searches[i];
+    Batch &batch = batches[slot];
+
+    search.offset = batch.n;
+
+    Turns turns = {*this, worker, search, batch,
+                   channel.features(first_slot + slot)};
+
+    if (!advance_self_play(game, config, initial_state, book, search.tree,
+                           search.noised, turns)) {
+      return false;
+    }
+
+    // A tree whose game finished with nothing queued plays on once taken
+    // again, after the worker has had a chance to stop
+    if (search.leaves.empty()) {
+      worker.ready.push(i);
+    } else {
+      batch.searches.push_back(i);
+    }
+
+    return true;
+  }
+};
+
+#endif
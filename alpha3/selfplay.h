@@ -0,0 +1,580 @@
+#ifndef ALPHA3_SELFPLAY_H
+#define ALPHA3_SELFPLAY_H
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "mcts.h"
+#include "transposition.h"
+
+// Load book, a tree image, into tree, decoding its moves through game
+template <class Game, class Tree>
+bool load_opening_book(Game &game, Tree &tree, const TreeImage &book) {
+  return tree.load_image(book,
+                         [&game](uint32_t code, typename Game::Move &move) {
+                           return game.decode_move(code, move);
+                         });
+}
+
+// Run tree, given whether its root has had its noise, until at least one of
+// its leaves awaits evaluation or its game finishes: the turns of a game of
+// self-play under config, as SelfPlayEngine and SelfPlayRuntime play them.
+// Moves are chosen once the turn's evaluations are spent, finished games
+// restart from initial_state (warm-started from book, if not null), and
+// terminal leaves are expanded with their outcome. The rest are handed to
+// driver, which provides
+//
+//   // Call fn, timing it as time spent in the game
+//   bool in_game(Fn &&fn);
+//
+//   void finish(std::pair<double, std::vector<HistoryEntry>> &&result);
+//
+//   // Queue leaf for evaluation, given its key if looked up in the table
+//   void queue(Node *leaf, uint64_t key);
+//
+// and, for transposable games, the table to look leaves up in first (or
+// null for none), the generation to look them up under, and room for a
+// policy to read into
+//
+//   TranspositionTable *table();
+//   uint64_t generation();
+//   float *priors();
+template <class Game, class Tree, class Config, class Driver>
+bool advance_self_play(Game &game, const Config &config,
+                       const typename Game::State &initial_state,
+                       const TreeImage *book, Tree &tree, bool &noised,
+                       Driver &driver) {
+  typedef typename Game::State State;
+
+  auto play = [&](const State &parent, const typename Game::Move &move,
+                  State &state) {
+    return driver.in_game([&]() { return game.play(parent, move, state); });
+  };
+
+  for (;;) {
+    assert(!tree.complete());
+
+    if (tree.searches_this_turn() >= config.evaluations ||
+        (config.stop_early && !tree.halving() &&
+         tree.decided(config.evaluations - tree.searches_this_turn()))) {
+      if (tree.halving()) {
+        tree.move_gumbel();
+      } else {
+        tree.move_proportional();
+      }
+
+      noised = false;
+
+      if (tree.complete() || tree.turns() >= config.max_turns) {
+        driver.finish(tree.collect_result());
+
+        tree.reset(game.copy(initial_state));
+
+        // Every leaf may be terminal or in the table, so that none is ever
+        // queued; the caller collects the result before playing on
+        return book == nullptr || load_opening_book(game, tree, *book);
+      }
+
+      if (!tree.materialize_root(play)) {
+        return false;
+      }
+    }
+
+    if (tree.expanded() && !noised) {
+      if (config.gumbel_considered != 0) {
+        tree.add_gumbel_noise(config.gumbel_considered,
+                              config.evaluations - tree.searches_this_turn());
+      } else {
+        tree.add_dirichlet_noise(config.noise_alpha, config.noise_fraction);
+      }
+
+      noised = true;
+    }
+
+    const size_t n = std::min(config.leaves_per_tree,
+                              config.evaluations - tree.searches_this_turn());
+
+    bool queued = false;
+
+    for (typename Tree::Node *leaf : tree.select_leaves(n)) {
+      bool terminal;
+      double av;
+
+      if (!tree.materialize(leaf, play) || !driver.in_game([&]() {
+            return game.outcome(leaf->state(), terminal, av);
+          })) {
+        return false;
+      }
+
+      if (terminal) {
+        tree.expand_leaf(leaf, av, {});
+        continue;
+      }
+
+      uint64_t key = 0;
+
+      if constexpr (Game::transposable) {
+        TranspositionTable *table = driver.table();
+
+        if (table != nullptr) {
+          key = game.hash(leaf->state());
+
+          float *priors = driver.priors();
+          float value;
+
+          if (table->find(key, driver.generation(), value, priors)) {
+            std::vector<typename Tree::MoveEntry> expansion;
+
+            if (!driver.in_game([&]() {
+                  return game.expand(leaf->state(), priors, expansion);
+                })) {
+              return false;
+            }
+
+            tree.expand_leaf_lazy(leaf, value, std::move(expansion));
+            continue;
+          }
+        }
+      }
+
+      driver.queue(leaf, key);
+      queued = true;
+    }
+
+    if (queued) {
+      return true;
+    }
+  }
+}
+
+// Plays many games of self-play at once, one search tree per game, and
+// gathers the leaves awaiting evaluation across every tree into one batch.
+// Each call to step expands the previous batch with its evaluations, then
+// advances every tree (choosing moves, adding noise and collecting finished
+// games as it goes) until it is blocked on a new leaf or finishes a game, so
+// that a batch may be empty. The first batch is requested by a step with no
+// evaluations.
+//
+// Game is an adaptor over the rules, providing
+//
+//   typedef ... State, Move, Policy;
+//
+//   State copy(const State &);
+//
+//   // Set terminal, and the outcome av if terminal
+//   bool outcome(const State &, bool &terminal, double &av);
+//
+//   // Append a (move, prior) entry for every legal move, with the priors
+//   // renormalized over them
+//   bool expand(const State &, const Policy &, std::vector<MoveEntry> &);
+//
+//   bool play(const State &, const Move &, State &);
+//
+//   // Convert a move to and from its code in a TreeImage
+//   bool encode_move(const Move &, uint32_t &code);
+//   bool decode_move(uint32_t code, Move &);
+//
+// Children are expanded lazily, so play is only called for the nodes that
+// search actually reaches.
+//
+// Games whose policies are arrays of floats may also set transposable, and
+// provide
+//
+//   uint64_t hash(const State &);
+//   size_t policy_width();
+//
+// in which case leaves can be evaluated through a transposition table:
+// positions found in the table are expanded without an evaluation, and
+// repeats of a position already in the batch share its evaluation. Entries
+// are tagged with the generation of the weights that produced them, which
+// the caller advances through set_generation when the weights change.
+//
+// An opening book, an image of a deep search from the initial state, can be
+// given to warm-start the tree of every game with its top plies, so that
+// their positions need not be evaluated again in every game.
+//
+// outcome, expand, play and decode_move return false on failure, which step
+// passes on to its caller; the engine is then in an unspecified (but
+// destructible) state.
+template <class Game, class Tree = MCTS<typename Game::State,
+                                        typename Game::Move>>
+class SelfPlayEngine {
+public:
+  typedef typename Game::State State;
+  typedef typename Game::Policy Policy;
+  typedef typename Tree::Node Node;
+  typedef typename Tree::HistoryEntry HistoryEntry;
+  typedef typename Tree::MemoryStats MemoryStats;
+  typedef typename Tree::SearchStats SearchStats;
+
+  struct Config {
+    double c_init;
+    double c_base;
+
+    size_t evaluations;
+    size_t leaves_per_tree;
+    size_t max_turns;
+
+    // Move as soon as the most visited child cannot be overtaken within the
+    // evaluations left, which saves evaluations when playing greedily for
+    // strength but skews the visit counts taken as training targets
+    bool stop_early;
+
+    double noise_alpha;
+    double noise_fraction;
+
+    // Given a number of candidates, search each root by Gumbel top-k
+    // sampling and sequential halving over that many of its children, in
+    // place of Dirichlet noise and PUCT, and train on the improved policy
+    // rather than the visit counts. Then stop_early has no effect. Zero for
+    // PUCT throughout
+    size_t gumbel_considered;
+
+    // Capacity of the transposition table, or zero for none
+    size_t transpositions;
+
+    // Nodes each tree may hold before pruning, or zero for no limit
+    size_t node_budget;
+
+    // Discarded subtrees of at least this many visits are freed on a
+    // background thread shared by the trees, or zero to free them inline.
+    // States must then be safe to destroy off the calling thread.
+    uint32_t reclaim_visits;
+  };
+
+  struct Evaluation {
+    double av;
+    Policy policy;
+  };
+
+  struct Result {
+    double score;
+    std::vector<HistoryEntry> history;
+  };
+
+  struct TranspositionStats {
+    size_t capacity;
+    uint64_t generation;
+
+    // Leaves looked up in the table; those missed either joined the batch or
+    // shared the evaluation of a pending leaf with the same position
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t shared;
+
+    uint64_t evictions;
+  };
+
+  SelfPlayEngine(Game game_, const Config &config_, size_t n_trees,
+                 State initial_state_)
+      : game(std::move(game_)), config(config_),
+        initial_state(std::move(initial_state_)) {
+    assert(n_trees != 0 && config.evaluations != 0 &&
+           config.leaves_per_tree != 0);
+
+    if (config.reclaim_visits != 0) {
+      reclaimer.reset(new Reclaimer());
+    }
+
+    trees.reserve(n_trees);
+
+    for (size_t i = 0; i < n_trees; i++) {
+      trees.emplace_back(config.c_init, config.c_base,
+                         game.copy(initial_state));
+      trees.back().set_node_budget(config.node_budget);
+      trees.back().set_reclaimer(reclaimer.get(), config.reclaim_visits);
+    }
+
+    noised.reset(new bool[n_trees]());
+
+    if constexpr (Game::transposable) {
+      if (config.transpositions != 0) {
+        table.reset(new TranspositionTable(config.transpositions,
+                                           game.policy_width()));
+        priors.resize(game.policy_width());
+      }
+    }
+  }
+
+  // Leaves awaiting evaluation, in the order that step expects evaluations
+  const std::vector<Node *> &batch() const { return pending_leaves; }
+
+  // Tag the evaluations that follow with generation, invalidating those
+  // of any other
+  void set_generation(uint64_t generation_) { generation = generation_; }
+
+  // Start every game from now on with the tree saved in book, which must
+  // have been taken at the initial state and must outlive the engine (or
+  // the next call), or with an empty tree given null. Before the first step,
+  // this includes the games about to start. On failure, the engine is left
+  // without a book, and with its games as they were.
+  bool set_opening_book(const TreeImage *book_) {
+    book = book_;
+
+    if (book == nullptr || !pending_leaves.empty()) {
+      return true;
+    }
+
+    for (Tree &tree : trees) {
+      if (tree.turns() == 1 && !tree.expanded() &&
+          !load_opening_book(game, tree, *book)) {
+        book = nullptr;
+        tree.reset(game.copy(initial_state));
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  TranspositionStats transposition_stats() const {
+    if (!table) {
+      return {0, generation, 0, 0, 0, 0};
+    }
+
+    const TranspositionTable::Stats stats = table->stats();
+    return {table->capacity(), generation, stats.hits, stats.misses, shared,
+            stats.evictions};
+  }
+
+  // Summed over every tree
+  MemoryStats memory_stats() const {
+    MemoryStats total = {0, 0, 0, 0, 0, 0, 0};
+
+    for (const Tree &tree : trees) {
+      const MemoryStats stats = tree.memory_stats();
+      total.live_nodes += stats.live_nodes;
+      total.reused_nodes += stats.reused_nodes;
+      total.pruned_nodes += stats.pruned_nodes;
+      total.live_bytes += stats.live_bytes;
+      total.free_bytes += stats.free_bytes;
+      total.allocated_blocks += stats.allocated_blocks;
+      total.recycled_blocks += stats.recycled_blocks;
+    }
+
+    return total;
+  }
+
+  // Summed over every tree
+  SearchStats search_stats() const {
+    SearchStats total = {0, 0, 0, 0, 0, 0, 0, 0};
+
+    for (const Tree &tree : trees) {
+      const SearchStats stats = tree.search_stats();
+      total.searches += stats.searches;
+      total.descents += stats.descents;
+      total.depth += stats.depth;
+      total.terminal_hits += stats.terminal_hits;
+      total.collisions += stats.collisions;
+      total.select_ns += stats.select_ns;
+      total.expand_ns += stats.expand_ns;
+      total.backup_ns += stats.backup_ns;
+    }
+
+    return total;
+  }
+
+  // Measure the time spent in each phase of the search, and in the game's
+  // outcome, expand and play, from now on, or stop
+  void set_timing(bool timing) {
+    timing_ = timing;
+
+    for (Tree &tree : trees) {
+      tree.set_timing(timing);
+    }
+  }
+
+  bool timing() const { return timing_; }
+
+  // Nanoseconds spent in the game while timing
+  uint64_t game_ns() const { return game_ns_; }
+
+  // Games finished since the last call to take_results
+  std::vector<Result> take_results() {
+    std::vector<Result> taken(std::move(results));
+    results.clear();
+    return taken;
+  }
+
+  // Expand the current batch, given one evaluation per leaf in order, and
+  // select the next one
+  bool step(std::vector<Evaluation> &&evaluations) {
+    assert(evaluations.size() == pending_leaves.size());
+
+    std::vector<typename Tree::MoveEntry> expansion;
+
+    for (size_t i = 0; i < pending_leaves.size(); i++) {
+      expansion.clear();
+
+      Node *leaf = pending_leaves[i];
+
+      if (!in_game([&]() {
+            return game.expand(leaf->state(), evaluations[i].policy,
+                               expansion);
+          })) {
+        return false;
+      }
+
+      trees[pending_trees[i]].expand_leaf_lazy(leaf, evaluations[i].av,
+                                               std::move(expansion));
+    }
+
+    if constexpr (Game::transposable) {
+      if (table) {
+        for (size_t i = 0; i < pending_leaves.size(); i++) {
+          table->insert(pending_keys[i], generation, (float)evaluations[i].av,
+                        evaluations[i].policy);
+        }
+
+        for (const Follower &follower : followers) {
+          const Evaluation &evaluation = evaluations[follower.source];
+
+          expansion.clear();
+
+          if (!in_game([&]() {
+                return game.expand(follower.leaf->state(), evaluation.policy,
+                                   expansion);
+              })) {
+            return false;
+          }
+
+          trees[follower.tree].expand_leaf_lazy(follower.leaf, evaluation.av,
+                                                std::move(expansion));
+        }
+
+        pending_keys.clear();
+        followers.clear();
+        in_flight.clear();
+      }
+    }
+
+    pending_leaves.clear();
+    pending_trees.clear();
+
+    for (size_t i = 0; i < trees.size(); i++) {
+      if (!advance(i)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+private:
+  Game game;
+  const Config config;
+  const State initial_state;
+
+  // Outlives the trees, which wait for their subtrees on destruction
+  std::unique_ptr<Reclaimer> reclaimer;
+
+  std::vector<Tree> trees;
+  std::unique_ptr<bool[]> noised;
+
+  std::vector<Node *> pending_leaves;
+  std::vector<size_t> pending_trees;
+
+  std::vector<Result> results;
+
+  // A leaf waiting on the evaluation of another with the same position
+  struct Follower {
+    size_t tree;
+    Node *leaf;
+    size_t source;
+  };
+
+  std::unique_ptr<TranspositionTable> table;
+
+  // Keys of the pending leaves, and the batch index of each key
+  std::vector<uint64_t> pending_keys;
+  std::unordered_map<uint64_t, size_t> in_flight;
+
+  std::vector<Follower> followers;
+  std::vector<float> priors;
+
+  uint64_t generation = 0;
+  uint64_t shared = 0;
+
+  bool timing_ = false;
+  uint64_t game_ns_ = 0;
+
+  const TreeImage *book = nullptr;
+
+  // What advance_self_play hands the leaves of tree i to
+  struct Turns {
+    SelfPlayEngine &engine;
+    size_t i;
+
+    template <class Fn> bool in_game(Fn &&fn) {
+      return engine.in_game(std::forward<Fn>(fn));
+    }
+
+    void finish(std::pair<double, std::vector<HistoryEntry>> &&result) {
+      engine.results.push_back({result.first, std::move(result.second)});
+    }
+
+    void queue(Node *leaf, uint64_t key) { engine.queue(i, leaf, key); }
+
+    TranspositionTable *table() { return engine.table.get(); }
+
+    uint64_t generation() { return engine.generation; }
+
+    float *priors() { return engine.priors.data(); }
+  };
+
+  // Call fn, counting the time it takes towards game_ns if timing
+  template <class Fn> bool in_game(Fn &&fn) {
+    if (!timing_) {
+      return fn();
+    }
+
+    const auto started_at = std::chrono::steady_clock::now();
+    const bool ok = fn();
+
+    game_ns_ += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - started_at)
+                    .count();
+
+    return ok;
+  }
+
+  // Add leaf of tree i to the batch, given its key if looked up in the
+  // table, unless a pending leaf has the same position, whose evaluation it
+  // then shares
+  void queue(size_t i, Node *leaf, uint64_t key) {
+    if constexpr (Game::transposable) {
+      if (table) {
+        auto it = in_flight.find(key);
+
+        if (it != in_flight.end()) {
+          followers.push_back({i, leaf, it->second});
+          shared++;
+          return;
+        }
+
+        in_flight.emplace(key, pending_leaves.size());
+        pending_keys.push_back(key);
+      }
+    }
+
+    pending_leaves.push_back(leaf);
+    pending_trees.push_back(i);
+  }
+
+  // Run tree i until at least one of its leaves awaits evaluation, or its
+  // game finishes
+  bool advance(size_t i) {
+    Turns turns = {*this, i};
+    return advance_self_play(game, config, initial_state, book, trees[i],
+                             noised[i], turns);
+  }
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef ALPHA3_SYNC_H
+#define ALPHA3_SYNC_H
+
+#include <mutex>
+
+// Synchronization policies for the statistics shared by a search tree. MCTS
+// performs every read-modify-write of a visit count, value or pointer that
+// other threads may observe through one of these, so the single-threaded
+// policy compiles down to plain loads and stores.
+
+struct SingleThreaded {
+  static constexpr bool concurrent = false;
+
+  struct Mutex {
+    void lock() {}
+    void unlock() {}
+  };
+
+  template <class T> static T load(const T &location) { return location; }
+
+  template <class T> static T load_relaxed(const T &location) {
+    return location;
+  }
+
+  template <class T> static void store(T &location, T value) {
+    location = value;
+  }
+
+  template <class T> static T fetch_add(T &location, T delta) {
+    const T previous = location;
+    location += delta;
+    return previous;
+  }
+
+  template <class T> static T fetch_sub(T &location, T delta) {
+    const T previous = location;
+    location -= delta;
+    return previous;
+  }
+
+  template <class T> static void add(T &location, double delta) {
+    location = (T)(location + delta);
+  }
+};
+
+// Lock-free updates through the GCC/Clang __atomic builtins, which operate on
+// plain (suitably aligned) memory, so tree layouts are shared with the
+// single-threaded policy. Pointers are published with release semantics and
+// read with acquire semantics; selection may read slightly stale statistics,
+// which only perturbs the choice of child.
+struct MultiThreaded {
+  static constexpr bool concurrent = true;
+
+  typedef std::mutex Mutex;
+
+  template <class T> static T load(const T &location) {
+    T value;
+    __atomic_load(&location, &value, __ATOMIC_ACQUIRE);
+    return value;
+  }
+
+  template <class T> static T load_relaxed(const T &location) {
+    T value;
+    __atomic_load(&location, &value, __ATOMIC_RELAXED);
+    return value;
+  }
+
+  template <class T> static void store(T &location, T value) {
+    __atomic_store(&location, &value, __ATOMIC_RELEASE);
+  }
+
+  template <class T> static T fetch_add(T &location, T delta) {
+    return __atomic_fetch_add(&location, delta, __ATOMIC_ACQ_REL);
+  }
+
+  template <class T> static T fetch_sub(T &location, T delta) {
+    return __atomic_fetch_sub(&location, delta, __ATOMIC_ACQ_REL);
+  }
+
+  template <class T> static void add(T &location, double delta) {
+    T expected;
+    __atomic_load(&location, &expected, __ATOMIC_RELAXED);
+
+    T desired;
+
+    do {
+      desired = (T)(expected + delta);
+    } while (!__atomic_compare_exchange(&location, &expected, &desired, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+  }
+};
+
+#endif
@@ -1,20 +1,96 @@
 from collections import deque
-from multiprocessing import Process, Pipe
-from multiprocessing.connection import wait
-from time import monotonic
+from contextlib import contextmanager, nullcontext
+from multiprocessing import AuthenticationError, Process, Pipe
+from multiprocessing.connection import Client, Listener, wait
+from multiprocessing.shared_memory import SharedMemory
+from queue import Empty, SimpleQueue
+from threading import Condition, Event, Lock, Thread
+from time import monotonic, monotonic_ns
+
+import mmap
+import pickle
 
 import numpy as np
 import tensorflow as tf
 
-from alpha3.a3mcts import MCTS
-from alpha3.replaybuffer import ReplayBuffer
+from alpha3 import metrics
+from alpha3.a3mcts import MCTS, ConnectKSelfPlayRuntime, EvaluationChannel, InferenceScheduler, SelfPlayEngine
+from alpha3.connectk import ConnectK
+from alpha3.models import InferenceModel
+from alpha3.replaybuffer import PackedReplayBuffer, ReplayBuffer
 
-(_TERMINATE, _EVALUATE, _EVALUATION, _RESULT) = range(4)
+(_RESULT, _RECORDS, _STATS, _PULL) = range(4)
 
 class Config:
     def __init__(self, workers, initial_state, model, name, **kwargs):
         self.workers = workers
         self.worker_concurrency = 32
+        self.leaves_per_tree = 1
+
+        # Play ConnectK natively, from the initial empty board
+        self.native = True
+
+        # Native workers play their trees over this many threads each, which
+        # steal trees from one another and evaluate through batches of their
+        # own, two in flight per thread; so one worker per socket, with a
+        # thread per core, rather than a worker per core
+        self.worker_threads = 1
+
+        # Evaluations kept per worker for positions reached again, until the
+        # weights change (native only; 0 disables)
+        self.transpositions = 2**16
+
+        # Evaluate a position and its mirror image as one, and train on every
+        # position in both orientations (native only)
+        self.symmetric = True
+
+        # Nodes each search tree may keep across moves before its least
+        # visited subtrees are pruned (0 for no limit)
+        self.node_budget = 0
+
+        # Evaluation requests are batched by a scheduler running alongside
+        # training, over streams evaluating at once. A batch is dispatched
+        # once it holds inference_batch positions (0 for those every worker
+        # has in flight at once), or its oldest request has waited
+        # inference_delay seconds
+        self.inference_streams = 1
+        self.inference_batch = 0
+        self.inference_delay = 0.001
+
+        # Workers report their search and memory stats every metrics_every
+        # seconds, which are logged and, given metrics_path, written out as
+        # a Prometheus textfile (if it ends in .prom) or as JSON. Timing each
+        # phase of the search costs a little, so is opt-in
+        self.metrics_every = 30.0
+        self.metrics_path = None
+        self.search_timing = False
+
+        # Given a (host, port) to listen on, the learner also trains on the
+        # games of remote actors (see actor), which connect with authkey, and
+        # may then have no workers of its own. The authkey is required, since
+        # what actors send is unpickled. Actors pull the latest weights every
+        # pull_every seconds
+        self.listen = None
+        self.authkey = None
+        self.pull_every = 10.0
+
+        # Training runs on a thread of its own, publishing its weights to
+        # self-play every publish_every steps. Given a second instance of the
+        # model's architecture, self-play evaluates that, so that only
+        # publications hold off evaluations; otherwise it evaluates the model
+        # itself, held off by every update
+        self.publish_every = 1
+        self.inference_model = None
+
+        # Given a dtype (float16 or bfloat16), self-play instead evaluates a
+        # models.InferenceModel of the model at that precision, compiled with
+        # XLA. Training stays in float32
+        self.inference_precision = None
+
+        # Given the path of an opening book (see opening_book), every game
+        # starts from the top plies of its search rather than an empty tree.
+        # The file is mapped read-only, and so shared by every worker
+        self.opening_book = None
         self.steps = 50000
 
         self.initial_state = initial_state
@@ -33,6 +109,13 @@ class Config:
         self.noise_alpha = 0.5
         self.noise_fraction = 0.25
 
+        # Given a number of candidate moves, each root is instead searched by
+        # Gumbel sampling and sequential halving over that many, without the
+        # Dirichlet noise above, and trained towards an improved policy
+        # rather than its visit counts, which holds up at far fewer
+        # evaluations (say 16 to 32)
+        self.gumbel_considered = 0
+
         self.evaluations = 200
         self.max_turns = 10**6
 
@@ -75,227 +158,998 @@ def train(config):
     position = config.initial_state.position()
     label_shape = config.model(np.expand_dims(position, 0)).shape[1:]
 
-    buffer = ReplayBuffer(max_size=config.buffer_size,
-                          features_shape=position.shape,
-                          label_shape=label_shape)
+    # Native workers send packed records, which are kept packed
+    if _native(config):
+        buffer_type = PackedReplayBuffer
+    else:
+        buffer_type = ReplayBuffer
+
+    buffer = buffer_type(max_size=config.buffer_size,
+                         features_shape=position.shape,
+                         label_shape=label_shape)
 
     optimizer = tf.keras.optimizers.Adam(learning_rate=0.0, beta_1=0.9, beta_2=0.999, amsgrad=False)
 
+    policy_width = label_shape[0] - 1
+
+    # Self-play evaluates a second copy of the model if given one, or one at
+    # reduced precision, and the model itself between updates otherwise.
+    # refresh copies the model's weights into it
+    if config.inference_precision is not None:
+        inference_model = InferenceModel(model, config.inference_precision)
+        refresh = lambda: inference_model.load(model)
+    elif config.inference_model is not None:
+        inference_model = config.inference_model
+        inference_model(np.expand_dims(position, 0))
+        refresh = lambda: inference_model.set_weights(model.get_weights())
+    else:
+        inference_model = None
+
+    if inference_model is not None:
+        refresh()
+        evaluator = _PublishedModel(inference_model, position.shape)
+    else:
+        evaluator = _PublishedModel(model, position.shape)
+
     log(f"spawning {config.workers} worker(s)")
 
-    pipes, process = zip(*(_spawn_worker(config) for i in range(config.workers)))
+    if config.workers > 0:
+        self_play = _SelfPlay(config, position, policy_width, evaluator.evaluate)
+    else:
+        self_play = None
+
+    if config.listen is not None:
+        if config.authkey is None:
+            raise ValueError("listening for actors requires an authkey")
+
+        server = _ActorServer(config.listen, config.authkey)
+        server.publish(0, model.get_weights())
+        log(f"listening for actors on {config.listen}")
+    else:
+        server = None
+
+    # What actors send is checked against these before it is ingested
+    features_shape = position.shape
+
+    if buffer_type is PackedReplayBuffer:
+        record_shape = (buffer.record_size(), int(np.prod(label_shape)))
+    else:
+        record_shape = None
+
+    # Examples are inserted here and sampled by the learner thread
+    buffer_lock = Lock()
+    ingested = Event()
+
+    # Publish the weights of the learner's step to self-play, and to actors
+    def publish(step):
+        if inference_model is not None:
+            with evaluator.replacing():
+                refresh()
+
+        # Evaluations are tagged with the step of the weights that produced
+        # them, so that workers can drop cached ones
+        if self_play is not None:
+            self_play.scheduler.set_generation(step)
+
+        if server is not None:
+            server.publish(step, model.get_weights())
+
+    # Without a copy to publish into, updates are what replace the weights
+    if inference_model is None:
+        updating = evaluator.replacing
+    else:
+        updating = nullcontext
+
+    learner = _Learner(config, model, optimizer, buffer, buffer_lock, ingested, publish, updating, log)
 
-    step = 0
     games_played = 0
 
-    while step < config.steps:
-        log(f"waiting up to 1s for worker commands")
+    # The latest (search, memory) stats of each worker, by its pipe (or its
+    # actor's connection) and slot
+    worker_stats = {}
+    metrics_due = monotonic() + config.metrics_every
 
-        states_for_evaluation = []
+    def inference_stats():
+        if self_play is None:
+            return dict(batches=0, positions=0, full_batches=0, evaluate_ns=0)
 
-        wins = 0
-        losses = 0
-        draws = 0
+        return self_play.scheduler.stats()
 
-        for pipe in wait(pipes, 1):
-            buffered_pipe = _BufferedPipe(pipe)
+    def report_metrics():
+        search = metrics.total(search for search, _ in worker_stats.values())
+        memory = metrics.total(memory for _, memory in worker_stats.values())
+        inference = inference_stats()
 
-            for command, *args in pipe.recv():
-                if command == _EVALUATE:
-                    game_state, = args
-                    states_for_evaluation.append((game_state, buffered_pipe))
-                elif command == _RESULT:
-                    games_played += 1
+        summary = metrics.summarize(search, monotonic() - started_at)
 
-                    score, history = args
+        log(f"searched {search['searches']} leaves at {summary['searches_per_second']:.0f}/s, "
+            f"mean depth {summary['mean_depth']:.1f}, terminal hits {summary['terminal_hit_rate']:.1%}, "
+            f"collisions {summary['collision_rate']:.1%}")
 
-                    if abs(score) < 1e-5:
-                        score = 0
-                        draws += 1
-                    else:
-                        assert abs(score) > 0.99
-                        if score > 0:
+        if config.search_timing:
+            log("seconds in select/expand/backup/game/marshal/wait: " +
+                "/".join(f"{search[phase + '_ns'] / 1e9:.1f}"
+                         for phase in ('select', 'expand', 'backup', 'game', 'marshal', 'wait')) +
+                f"; in evaluation {inference['evaluate_ns'] / 1e9:.1f}")
+
+        log(f"{memory['live_nodes']} live node(s), {memory['recycled_blocks']} of "
+            f"{memory['allocated_blocks']} block allocation(s) recycled")
+
+        if config.metrics_path is not None:
+            metrics.write(config.metrics_path, dict(search=search, memory=memory, inference=inference),
+                          name=config.model_name)
+
+    learner.start()
+
+    # Self-play is served here while the learner trains on its own thread,
+    # until it is done
+    try:
+        while learner.running():
+            pipes = []
+
+            if self_play is not None:
+                self_play.scheduler.check()
+                pipes.extend(self_play.pipes)
+
+            if server is not None:
+                for address in server.accept():
+                    log(f"actor connected from {address}")
+
+                pipes.extend(server.connections)
+
+            wins = 0
+            losses = 0
+            draws = 0
+
+            for pipe in wait(pipes, 1.0):
+                try:
+                    commands = pipe.recv()
+                except (EOFError, OSError):
+                    # Only an actor's connection should close before the end
+                    if server is None or pipe not in server.connections:
+                        raise
+
+                    server.drop(pipe)
+                    log("actor disconnected")
+                    continue
+
+                if server is not None and pipe in server.connections and \
+                        not _valid_commands(commands, features_shape, policy_width, record_shape):
+                    server.drop(pipe)
+                    log("dropped an actor for sending invalid data")
+                    continue
+
+                for command, *args in commands:
+                    if command == _RESULT:
+                        games_played += 1
+
+                        score, history = args
+
+                        if abs(score) < 1e-5:
+                            score = 0
+                            draws += 1
+                        elif score > 0:
                             score = 1
                             wins += 1
                         else:
                             score = -1
                             losses += 1
 
-                    for i, (game_state, search_probabilities) in enumerate(history):
-                        position = game_state.position()
+                        with buffer_lock:
+                            for i, (position, search_probabilities) in enumerate(history):
+                                label = np.zeros(label_shape)
+                                label[0] = score
+
+                                if len(search_probabilities) == 0:
+                                    for i in range(1, label.shape[0]):
+                                        label[i] = 1.0 / (label.shape[0] - 1)
+                                else:
+                                    for move, probability in search_probabilities:
+                                        label[1 + move] = probability
+
+                                assert abs(np.sum(label[1:]) - 1) < 1e-5
+
+                                buffer.insert(position, label)
 
-                        label = np.zeros(label_shape)
-                        label[0] = score
+                                score = -score
+                    elif command == _RECORDS:
+                        games_played += 1
 
-                        if len(search_probabilities) == 0:
-                            for i in range(1, label.shape[0]):
-                                label[i] = 1.0 / (label.shape[0] - 1)
+                        records, = args
+
+                        # The first record's outcome is the score of the game
+                        score = np.frombuffer(records, dtype='float32', count=1)[0]
+
+                        if abs(score) < 1e-5:
+                            draws += 1
+                        elif score > 0:
+                            wins += 1
                         else:
-                            for move, probability in search_probabilities:
-                                label[1 + move] = probability
+                            losses += 1
 
-                        assert abs(np.sum(label[1:]) - 1) < 1e-5
+                        with buffer_lock:
+                            buffer.insert_records(records)
+                    elif command == _STATS:
+                        slot, search, memory, _ = args
+                        worker_stats[(id(pipe), slot)] = (search, memory)
+                    elif command == _PULL:
+                        version, = args
+                        server.answer(pipe, version)
+                    else:
+                        assert False, f"invalid command {command}"
+
+            if wins + losses + draws > 0:
+                ingested.set()
+
+                log(f"ingested {wins + losses + draws} game result(s), w/l/d {wins}/{losses}/{draws}")
+                log(f"played {games_played} game(s) total thus far")
+
+            if monotonic() >= metrics_due and worker_stats:
+                report_metrics()
+                metrics_due = monotonic() + config.metrics_every
+    finally:
+        learner.stop()
+
+    if worker_stats:
+        report_metrics()
+
+    stats = inference_stats()
+    log(f"trained for {learner.step} step(s)")
+    log(f"evaluated {stats['positions']} position(s) in {stats['batches']} batch(es), {stats['full_batches']} full")
+
+    # Actors stop once their connections close
+    if server is not None:
+        server.close()
+
+    if self_play is not None:
+        log("waiting up to 10s for workers to exit")
+        self_play.stop()
+
+# Takes config.steps gradient steps over samples of buffer on a thread of its
+# own, as soon as it holds enough examples, so that self-play is served in the
+# meantime. Calls publish with the step every config.publish_every steps, and
+# at the last, and applies each update inside updating
+class _Learner:
+    def __init__(self, config, model, optimizer, buffer, buffer_lock, ingested, publish, updating, log):
+        self.config = config
+        self.model = model
+        self.optimizer = optimizer
+        self.buffer = buffer
+        self.buffer_lock = buffer_lock
+        self.ingested = ingested
+        self.publish = publish
+        self.updating = updating
+        self.log = log
+
+        self.step = 0
+
+        self._stopping = Event()
+        self._failure = None
+        self._thread = Thread(target=self._run, daemon=True)
+
+    def start(self):
+        self._thread.start()
+
+    # Whether the learner has steps left to take, raising whatever it failed
+    # with
+    def running(self):
+        if self._failure is not None:
+            raise self._failure
+
+        return self._thread.is_alive()
+
+    def stop(self):
+        self._stopping.set()
+        self._thread.join()
+
+    def _run(self):
+        try:
+            while self.step < self.config.steps and not self._stopping.is_set():
+                self._train()
+        except BaseException as failure:
+            self._failure = failure
+
+    def _train(self):
+        config = self.config
+        needed = 4 * config.batch_size
+
+        with self.buffer_lock:
+            size = len(self.buffer)
+
+        if size < needed:
+            self.log(f"collected {size} example(s); training starts at {needed}")
+
+            self.ingested.wait(1.0)
+            self.ingested.clear()
+            return
 
-                        buffer.insert(position, label)
+        self.step += 1
+        step = self.step
 
-                        score = -score
-                else:
-                    assert False, f"invalid command {command}"
+        learning_rate = None
 
-        log(f"received {len(states_for_evaluation)} state(s) for evaluation")
-        log(f"ingested {wins + losses + draws} game result(s), w/l/d {wins}/{losses}/{draws}")
-        log(f"played {games_played} game(s) total thus far")
+        for threshold, lr in config.lr_schedule:
+            if step >= threshold:
+                learning_rate = lr
 
-        if len(states_for_evaluation) > 0:
-            evaluation_features = np.stack([state.position() for state, _ in states_for_evaluation])
+        assert learning_rate is not None
+        self.optimizer.learning_rate = learning_rate
 
-            log(f"evaluating {evaluation_features.shape[0]} position(s)")
-            evaluations = model(evaluation_features)
+        # A packed buffer's samples are only overwritten by the next sample
+        with self.buffer_lock:
+            features, labels = self.buffer.sample(config.batch_size)
+            size = len(self.buffer)
 
-            log(f"evaluation complete; emitting responses")
+        self.log(f"training against {features.shape[0]} of {size} example(s) (step {step})")
 
-            for i, (state, pipe) in enumerate(states_for_evaluation):
-                av = float(evaluations[i, 0])
-                priors = evaluations[i, 1:]
+        with tf.GradientTape() as tape:
+            predictions = self.model(features)
 
-                denom = sum(priors[move] for move in state.moves())
+            loss = tf.reduce_sum((predictions[:, 0] - labels[:, 0])**2)
+            loss += tf.reduce_sum(tf.losses.categorical_crossentropy(predictions[:, 1:], labels[:, 1:]))
 
-                expansion = [(move, state.play(move), priors[move] / denom) for move in state.moves()]
+            loss /= features.shape[0]
 
-                pipe.send((_EVALUATION, av, expansion))
+            for variable in self.model.trainable_variables:
+                loss = loss + config.weight_decay * tf.reduce_sum(tf.nn.l2_loss(variable))
 
-            for _, pipe in states_for_evaluation:
-                pipe.flush()
+        gradients = tape.gradient(loss, self.model.trainable_variables)
 
-            log(f"done")
+        with self.updating():
+            self.optimizer.apply_gradients(zip(gradients, self.model.trainable_variables))
 
-        if len(buffer) >= 4 * config.batch_size:
-            step += 1
+        if step % config.publish_every == 0 or step == config.steps:
+            self.publish(step)
 
-            learning_rate = None
+        self.log(f"done")
 
-            for threshold, lr in config.lr_schedule:
-                if step >= threshold:
-                    learning_rate = lr
+        predicted_outcomes = predictions[:, 0].numpy()
+        min_po = np.amin(predicted_outcomes)
+        avg_po = np.sum(predicted_outcomes) / features.shape[0]
+        max_po = np.amax(predicted_outcomes)
 
-            assert learning_rate is not None
-            optimizer.learning_rate = learning_rate
+        self.log(f"min., avg., max. predicted outcome: {min_po}, {avg_po}, {max_po}")
+        self.log(f"loss: {float(loss)}")
 
-            features, labels = buffer.sample(config.batch_size)
+        if step % config.checkpoint_every == 0:
+            path = f"{config.model_name}_step{step}.h5"
+            self.log(f"saving model after {step} steps to {repr(path)}")
+            self.model.save_weights(path)
 
-            log(f"training against {features.shape[0]} of {len(buffer)} example(s) (step {step})")
+# Play games of self-play through the same pipeline as training, without
+# training, and measure its throughput. Evaluates with config.model, or, if
+# None, with a stub returning zero values and uniform priors over one move
+# per column (as for ConnectK), which leaves the search, bindings and
+# channel as the only cost. Latencies are those of each leaf's round trip
+# through the channel, from the worker's request to the response, to within
+# the 26% width of a histogram bin
+def benchmark(config, games):
+    position = config.initial_state.position()
 
-            with tf.GradientTape() as tape:
-                predictions = model(features)
+    if config.model is None:
+        policy_width = position.shape[-1]
 
-                loss = tf.reduce_sum((predictions[:, 0] - labels[:, 0])**2)
-                loss += tf.reduce_sum(tf.losses.categorical_crossentropy(predictions[:, 1:], labels[:, 1:]))
+        def evaluate(stream, features, values, policies):
+            np.asarray(values)[:] = 0.0
+            np.asarray(policies)[:] = 1.0 / policy_width
+    else:
+        # Outside the timing, the first call builds the model. At reduced
+        # precision, the first batch of each size bucket is compiled within it
+        policy_width = config.model(np.expand_dims(position, 0)).shape[1] - 1
 
-                loss /= features.shape[0]
+        if config.inference_precision is not None:
+            evaluate = _model_evaluator(InferenceModel(config.model, config.inference_precision), position.shape)
+        else:
+            evaluate = _model_evaluator(config.model, position.shape)
 
-                for variable in model.trainable_variables:
-                    loss = loss + config.weight_decay * tf.reduce_sum(tf.nn.l2_loss(variable))
-            
-            gradients = tape.gradient(loss, model.trainable_variables)
-            optimizer.apply_gradients(zip(gradients, model.trainable_variables))
+    self_play = _SelfPlay(config, position, policy_width, evaluate)
 
-            log(f"done")
+    started_at = monotonic()
+    games_played = 0
 
-            predicted_outcomes = predictions[:, 0].numpy()
-            min_po = np.amin(predicted_outcomes)
-            avg_po = np.sum(predicted_outcomes) / features.shape[0]
-            max_po = np.amax(predicted_outcomes)
+    # The latest stats of each worker, by slot, which sends them again on
+    # exit
+    worker_stats = {}
+
+    def receive(pipe):
+        nonlocal games_played
+
+        for command, *args in pipe.recv():
+            if command in (_RESULT, _RECORDS):
+                games_played += 1
+            elif command == _STATS:
+                slot, search, memory_stats, latencies = args
+                worker_stats[slot] = (search, latencies)
+
+    while games_played < games:
+        self_play.scheduler.check()
+
+        for pipe in wait(self_play.pipes, 1.0):
+            receive(pipe)
+
+    elapsed = monotonic() - started_at
+    inference = self_play.scheduler.stats()
+    played = games_played
+
+    self_play.stop()
+
+    # For the stats each worker sent on exit, up to the end of its pipe
+    for pipe in self_play.pipes:
+        try:
+            while pipe.poll():
+                receive(pipe)
+        except EOFError:
+            pass
+
+    search = metrics.total(search for search, _ in worker_stats.values())
+    latencies = metrics.LatencyHistogram()
+
+    for _, counts in worker_stats.values():
+        latencies.merge(metrics.LatencyHistogram(counts))
+
+    return dict(workers=config.workers,
+                worker_threads=config.worker_threads,
+                worker_concurrency=config.worker_concurrency,
+                evaluations=config.evaluations,
+                games=played,
+                seconds=elapsed,
+                games_per_hour=3600 * played / elapsed,
+                evaluations_per_second=inference['positions'] / elapsed,
+                mean_batch=inference['positions'] / max(inference['batches'], 1),
+                full_batches=inference['full_batches'] / max(inference['batches'], 1),
+                latency_p50=latencies.quantile(0.5),
+                latency_p90=latencies.quantile(0.9),
+                latency_p99=latencies.quantile(0.99),
+                **metrics.summarize(search))
+
+# Search config.initial_state with config.model for evaluations visits, in
+# batches of batch leaves, and write the top plies of the tree to path, as
+# an image for Config.opening_book. Built with the weights self-play will
+# start from, the book's values go stale as they change, so it is best
+# rebuilt with the latest now and then
+def opening_book(config, path, plies, evaluations, batch=64):
+    tree = MCTS(c_init=config.c_init, c_base=config.c_base, initial_state=config.initial_state)
+
+    while tree.searches_this_turn() < evaluations and not tree.complete():
+        leaves = tree.select_leaves(batch)
+        expansions = []
+        evaluated = []
+
+        for leaf, game_state in leaves:
+            outcome = game_state.outcome()
+
+            if outcome is not None:
+                expansions.append((leaf, outcome, []))
+            else:
+                evaluated.append((leaf, game_state))
+
+        if evaluated:
+            features = np.array([game_state.position() for _, game_state in evaluated])
+            outputs = config.model(features).numpy()
+
+            for (leaf, game_state), output in zip(evaluated, outputs):
+                moves = game_state.moves()
+                priors = output[1:][moves]
+                priors = priors / priors.sum()
+
+                expansions.append((leaf, float(output[0]),
+                                   [(move, game_state.play(move), float(prior))
+                                    for move, prior in zip(moves, priors)]))
+
+        tree.expand_leaves(expansions)
+
+    with open(path, 'wb') as file:
+        file.write(tree.image(plies))
+
+# Play self-play games on this host for the learner at address (where train
+# runs with config.listen), streaming them back as they finish, until the
+# learner closes the connection, authenticating with the learner's authkey.
+# Games are played as train's workers play
+# them, with config.workers workers and an evaluator of their own over
+# config.model, which must be built with the learner's architecture. Its
+# weights are replaced by the learner's once connected, and then every
+# config.pull_every seconds. Evaluations are tagged with the learner's step,
+# so that cached ones are dropped when the weights change.
+def actor(config, address, authkey):
+    model = config.model
+    position = config.initial_state.position()
+
+    policy_width = model(np.expand_dims(position, 0)).shape[1] - 1
+
+    # Evaluated at reduced precision if asked, refreshed from the model with
+    # each new set of weights
+    if config.inference_precision is not None:
+        inference_model = InferenceModel(model, config.inference_precision)
+    else:
+        inference_model = None
+
+    def set_weights(weights):
+        model.set_weights(weights)
+
+        if inference_model is not None:
+            inference_model.load(model)
 
-            log(f"min., avg., max. predicted outcome: {min_po}, {avg_po}, {max_po}")
-            log(f"loss: {float(loss)}")
+    evaluator = _PublishedModel(inference_model or model, position.shape)
+    connection = None
 
-            if step % config.checkpoint_every == 0:
-                path = f"{config.model_name}_step{step}.h5"
-                log(f"saving model after {step} steps to {repr(path)}")
-                model.save_weights(path)
+    # Nothing is evaluated until the first weights arrive, replacing the
+    # model's own
+    with evaluator.replacing():
+        self_play = _SelfPlay(config, position, policy_width, evaluator.evaluate)
+
+        # Connected only once the workers are spawned, so that none inherits
+        # the connection and keeps it open past the actor
+        try:
+            connection = Client(address, authkey=authkey)
+            connection.send([(_PULL, -1)])
+
+            version, weights = pickle.loads(connection.recv_bytes())
+            set_weights(weights)
+            self_play.scheduler.set_generation(version)
+        except BaseException as exception:
+            failure = exception
         else:
+            failure = None
 
-            log(f"collected {len(buffer)} example(s); training starts at {4 * config.batch_size}")
+    if failure is not None:
+        self_play.stop()
 
-    log(f"trained for {config.steps} step(s)")
+        if connection is not None:
+            connection.close()
 
-    for pipe in pipes:
-        pipe.send((_TERMINATE,))
-        pipe.flush()
+        raise failure
+
+    remote = _BufferedPipe(connection)
+
+    pull_due = monotonic() + config.pull_every
+    pulling = False
+
+    try:
+        while True:
+            self_play.scheduler.check()
+
+            for pipe in wait(self_play.pipes + (connection,), 1.0):
+                # The learner only sends weights, when asked
+                if pipe is connection:
+                    version, weights = pickle.loads(connection.recv_bytes())
 
-    log("waiting up to 10s for workers to exit")
+                    if weights is not None:
+                        with evaluator.replacing():
+                            set_weights(weights)
 
-    waiting_at = monotonic()
+                    self_play.scheduler.set_generation(version)
+                    pulling = False
+                    continue
+
+                for command in pipe.recv():
+                    remote.send(command)
+
+            if not pulling and monotonic() >= pull_due:
+                remote.send((_PULL, version))
+                pull_due = monotonic() + config.pull_every
+                pulling = True
+
+            remote.flush()
+    except (EOFError, OSError):
+        pass
+    finally:
+        self_play.stop()
+        connection.close()
+
+# Accepts the connections of remote actors on a background thread, and
+# serves them the latest weights published, serialized once per version
+class _ActorServer:
+    def __init__(self, address, authkey):
+        self._listener = Listener(address, authkey=authkey)
+        self._accepted = SimpleQueue()
+
+        # Replaced whole by publish, from any thread
+        self._published = (None, None)
+
+        self.connections = []
+
+        Thread(target=self._accept, daemon=True).start()
+
+    # The addresses of the actors connected since the last call
+    def accept(self):
+        addresses = []
+
+        while True:
+            try:
+                connection, address = self._accepted.get_nowait()
+            except Empty:
+                return addresses
+
+            self.connections.append(connection)
+            addresses.append(address)
+
+    def drop(self, connection):
+        self.connections.remove(connection)
+        connection.close()
+
+    def publish(self, version, weights):
+        self._published = (version, pickle.dumps((version, weights)))
+
+    # Send the latest weights to an actor holding those of version, unless
+    # they are the same
+    def answer(self, connection, version):
+        latest, weights = self._published
+
+        if version == latest:
+            connection.send_bytes(pickle.dumps((latest, None)))
+        else:
+            connection.send_bytes(weights)
+
+    def close(self):
+        self._listener.close()
+
+        for connection in self.connections:
+            connection.close()
+
+        self.connections.clear()
+
+    def _accept(self):
+        while True:
+            try:
+                connection = self._listener.accept()
+            except AuthenticationError:
+                continue
+            except OSError:
+                return
+
+            self._accepted.put((connection, self._listener.last_accepted))
+
+# Whether the commands an actor sent are ones the learner can ingest: game
+# results with an outcome of a win, loss or draw and search probabilities
+# over the policy that sum to one or, given the (bytes, labels) per record of
+# a packed buffer, whole records of finite labels with such outcomes, and
+# well-formed stats and pulls
+def _valid_commands(commands, features_shape, policy_width, record_shape):
+    def outcome(score):
+        return abs(score) < 1e-5 or abs(abs(score) - 1) < 1e-5
+
+    def probabilities(search_probabilities):
+        try:
+            moves = [int(move) for move, _ in search_probabilities]
+            weights = [float(probability) for _, probability in search_probabilities]
+        except (TypeError, ValueError):
+            return False
+
+        return all(0 <= move < policy_width for move in moves) and \
+            all(0 <= weight <= 1 for weight in weights) and \
+            (len(weights) == 0 or abs(sum(weights) - 1) < 1e-5)
+
+    def records(data):
+        record_size, labels = record_shape
+
+        if len(data) == 0 or len(data) % record_size != 0:
+            return False
+
+        scores = np.frombuffer(data, dtype='float32').reshape(-1, record_size // 4)[:, :labels]
+        return bool(np.all(np.isfinite(scores))) and all(outcome(score) for score in scores[:, 0])
+
+    if not isinstance(commands, list):
+        return False
+
+    for command in commands:
+        if not isinstance(command, tuple) or len(command) == 0:
+            return False
+
+        kind, *args = command
+
+        if kind == _RESULT and record_shape is None and len(args) == 2:
+            score, history = args
+
+            if not isinstance(score, (int, float)) or not outcome(score) or not isinstance(history, list):
+                return False
+
+            for entry in history:
+                if not isinstance(entry, tuple) or len(entry) != 2:
+                    return False
+
+                position, search_probabilities = entry
+
+                if not isinstance(position, np.ndarray) or position.shape != features_shape or \
+                        not probabilities(search_probabilities):
+                    return False
+        elif kind == _RECORDS and record_shape is not None and len(args) == 1:
+            if not isinstance(args[0], bytes) or not records(args[0]):
+                return False
+        elif kind == _STATS and len(args) == 4:
+            slot, search, memory, _ = args
+
+            if not isinstance(slot, int) or not all(isinstance(stats, dict) and
+                       all(isinstance(value, (int, float)) for value in stats.values())
+                       for stats in (search, memory)):
+                return False
+        elif kind == _PULL and len(args) == 1:
+            if not isinstance(args[0], int):
+                return False
+        else:
+            return False
+
+    return True
+
+# Evaluates through model on the scheduler's threads, whose weights are only
+# ever changed inside replacing. Evaluations run alongside one another (one
+# per inference stream), but not alongside a replacement, which waits for
+# those in flight and holds off any more until it is done
+class _PublishedModel:
+    def __init__(self, model, features_shape):
+        self._evaluate = _model_evaluator(model, features_shape)
+
+        self._changed = Condition()
+        self._evaluating = 0
+        self._replacing = False
+
+    def evaluate(self, stream, features, values, policies):
+        with self._changed:
+            self._changed.wait_for(lambda: not self._replacing)
+            self._evaluating += 1
+
+        try:
+            self._evaluate(stream, features, values, policies)
+        finally:
+            with self._changed:
+                self._evaluating -= 1
+                self._changed.notify_all()
+
+    @contextmanager
+    def replacing(self):
+        with self._changed:
+            self._replacing = True
+            self._changed.wait_for(lambda: self._evaluating == 0)
+
+        try:
+            yield
+        finally:
+            with self._changed:
+                self._replacing = False
+                self._changed.notify_all()
+
+# Evaluates through model on the scheduler's threads. The views are only
+# valid for the call, so the features are copied out and nothing over them
+# is kept
+def _model_evaluator(model, features_shape):
+    def evaluate(stream, features, values, policies):
+        features = np.array(features).reshape((-1, *features_shape))
+        evaluations = model(features).numpy()
+
+        np.asarray(values)[:] = evaluations[:, 0]
+        np.asarray(policies)[:] = evaluations[:, 1:]
+
+    return evaluate
+
+# Workers exchange features and evaluations with the trainer through one slot
+# each of a shared evaluation channel, evaluated by a scheduler running
+# alongside, and send finished games over their pipes
+class _SelfPlay:
+    def __init__(self, config, position, policy_width, evaluate):
+        slots, capacity = _slot_layout(config)
+
+        self._memory = SharedMemory(create=True, size=EvaluationChannel.nbytes(config.workers * slots, capacity, position.size, policy_width))
+        self._channel = EvaluationChannel(self._memory.buf, config.workers * slots, capacity, position.size, policy_width)
+
+        # Native workers build half their batches while the other half is in
+        # flight
+        if config.inference_batch > 0:
+            max_batch = config.inference_batch
+        elif _native(config):
+            max_batch = max(config.workers * slots * capacity // 2, 1)
+        else:
+            max_batch = config.workers * slots * capacity
+
+        self.scheduler = InferenceScheduler(self._channel, evaluate,
+                                            streams=config.inference_streams,
+                                            max_batch=max_batch,
+                                            max_delay=config.inference_delay)
+
+        self.pipes, self._processes = zip(*(_spawn_worker(config, self._memory.name, slot, policy_width)
+                                            for slot in range(config.workers)))
+
+    # Wait up to 10s for the workers to exit. The pipes can still be read
+    def stop(self):
+        # Closing the channel fails the workers' waits for evaluations
+        self.scheduler.stop()
+        self._channel.close()
+
+        waiting_at = monotonic()
+
+        for process in self._processes:
+            process.join(max(10 - (monotonic() - waiting_at), 0.01))
 
-    for process in processes:
-        process.join(max(10 - (monotonic - waiting_at), 0.01))
+        # Shared memory can't be closed while the channel is over it
+        self.scheduler = None
+        self._channel = None
 
+        self._memory.close()
+        self._memory.unlink()
 
-def _spawn_worker(config):
-    (pipe, worker_pipe) = Pipe(duplex=True)
-    process = Process(target=_worker, args=(worker_pipe, config), daemon=True)
+
+def _spawn_worker(config, memory_name, worker, policy_width):
+    (pipe, worker_pipe) = Pipe(duplex=False)
+    process = Process(target=_worker, args=(worker_pipe, config, memory_name, worker, policy_width), daemon=True)
     process.start()
     return pipe, process
 
 
-def _worker(pipe, config):
+def _native(config):
+    return config.native and isinstance(config.initial_state, ConnectK)
+
+
+# Channel slots per worker, and positions per slot. Native workers keep two
+# batches per thread, each over a share of their trees; Python workers send
+# every tree's leaves at once
+def _slot_layout(config):
+    if _native(config):
+        slots = 2 * config.worker_threads
+        return slots, -(-config.worker_concurrency // slots) * config.leaves_per_tree
+
+    return 1, config.worker_concurrency * config.leaves_per_tree
+
+
+# Features, values and policies of slot, as arrays over the channel's memory
+def _slot_arrays(memory, channel, slot, capacity, shape, policy_width):
+    features_offset, values_offset, policies_offset = channel.offsets(slot)
+
+    features = np.ndarray((capacity, *shape), dtype='float32', buffer=memory.buf, offset=features_offset)
+    values = np.ndarray((capacity,), dtype='float32', buffer=memory.buf, offset=values_offset)
+    policies = np.ndarray((capacity, policy_width), dtype='float32', buffer=memory.buf, offset=policies_offset)
+
+    return features, values, policies
+
+
+def _open_book(engine, config):
+    if config.opening_book is not None:
+        with open(config.opening_book, 'rb') as file:
+            engine.set_opening_book(mmap.mmap(file.fileno(), 0, access=mmap.ACCESS_READ))
+
+
+def _worker(pipe, config, memory_name, worker, policy_width):
     pipe = _BufferedPipe(pipe)
 
-    pending_selection = deque(maxlen=config.worker_concurrency)
-    pending_evaluation = deque(maxlen=config.worker_concurrency)
+    search_args = dict(trees=config.worker_concurrency,
+                       c_init=config.c_init,
+                       c_base=config.c_base,
+                       evaluations=config.evaluations,
+                       noise_alpha=config.noise_alpha,
+                       noise_fraction=config.noise_fraction,
+                       leaves_per_tree=config.leaves_per_tree,
+                       max_turns=config.max_turns,
+                       node_budget=config.node_budget,
+                       gumbel_considered=config.gumbel_considered)
 
-    for i in range(config.worker_concurrency):
-        pending_selection.append(MCTS(config.c_init, config.c_base, config.initial_state))
+    shape = config.initial_state.position().shape
+    slots, capacity = _slot_layout(config)
 
-    while len(pending_selection) + len(pending_evaluation) > 0:
-        requeue = []
+    memory = SharedMemory(memory_name)
+    channel = EvaluationChannel(memory.buf, config.workers * slots, capacity, int(np.prod(shape)), policy_width)
 
-        while len(pending_selection) > 0:
-            mcts = pending_selection.popleft()
+    if _native(config):
+        _native_worker(pipe, config, channel, worker, slots, search_args)
+    else:
+        # Features are written straight into the slot, and evaluations read
+        # back from it in place
+        arrays = _slot_arrays(memory, channel, worker, capacity, shape, policy_width)
+        _python_worker(pipe, config, channel, worker, arrays, search_args)
+        del arrays
 
-            assert not mcts.complete()
+    # Shared memory can't be closed while anything over it remains
+    del channel
+    memory.close()
 
-            if mcts.searches_this_turn() >= config.evaluations:
-                mcts.move_proportional()
 
-                if mcts.complete() or mcts.turns() >= config.max_turns:
-                    score, history = mcts.collect_result()
-                    pipe.send((_RESULT, score, history))
-                    mcts.reset(config.initial_state)
-                    requeue.append(mcts)
-                    continue
+# Plays over native threads until the channel is closed, collecting finished
+# games (as packed records of each position, and its mirror image if
+# symmetric) and stats as it goes
+def _native_worker(pipe, config, channel, worker, slots, search_args):
+    initial_state = config.initial_state
 
-            if mcts.searches_this_turn() == 1:
-                mcts.add_dirichlet_noise(config.noise_alpha, config.noise_fraction)
+    runtime = ConnectKSelfPlayRuntime(channel, worker * slots, slots, config.worker_threads,
+                                      initial_state.rows,
+                                      initial_state.columns,
+                                      initial_state.k,
+                                      transpositions=config.transpositions,
+                                      symmetric=config.symmetric,
+                                      **search_args)
 
-            leaf_and_state = mcts.select_leaf()
+    runtime.set_timing(config.search_timing)
+    _open_book(runtime, config)
+
+    def send_stats():
+        search = dict(runtime.search_stats(), wait_ns=runtime.wait_ns())
+        pipe.send((_STATS, worker, search, runtime.memory_stats(), runtime.latency_counts()))
+
+    stats_due = monotonic() + config.metrics_every
+    stopped = False
+
+    runtime.start()
+
+    try:
+        while not stopped:
+            stopped = runtime.wait(0.05)
+
+            for records in runtime.results_packed():
+                pipe.send((_RECORDS, records))
+
+            if monotonic() >= stats_due:
+                send_stats()
+                stats_due = monotonic() + config.metrics_every
+
+            pipe.flush()
+    finally:
+        runtime.stop()
+
+    send_stats()
+    pipe.flush()
 
-            if leaf_and_state is None:
-                requeue.append(mcts)
-            else:
-                leaf, game_state = leaf_and_state
 
-                if game_state.outcome() is not None:
-                    mcts.expand_leaf(leaf, game_state.outcome(), [])
-                    requeue.append(mcts)
-                else:
-                    pipe.send((_EVALUATE, game_state))
-                    pending_evaluation.append((mcts, leaf))
+# Steps every tree in turn, waiting on the evaluation of each step's batch
+def _python_worker(pipe, config, channel, slot, arrays, search_args):
+    features, values, policies = arrays
 
-        pending_selection.extend(requeue)
+    engine = SelfPlayEngine(config.initial_state, **search_args)
+
+    def step(n):
+        evaluations = [] if n is None else zip(values[:n].tolist(), policies[:n])
+        game_states = engine.step(evaluations)
+
+        for i, game_state in enumerate(game_states):
+            features[i] = game_state.position()
+
+        return len(game_states)
+
+    def send_results():
+        for score, history in engine.results():
+            history = [(game_state.position(), search_probabilities)
+                       for game_state, search_probabilities in history]
+            pipe.send((_RESULT, score, history))
+
+    engine.set_timing(config.search_timing)
+    _open_book(engine, config)
+
+    # Time spent waiting on evaluations, which is measured regardless, and
+    # the latency of each leaf's evaluation
+    wait_ns = 0
+    latencies = metrics.LatencyHistogram()
+
+    def send_stats():
+        search = dict(engine.search_stats(), wait_ns=wait_ns)
+        pipe.send((_STATS, slot, search, engine.memory_stats(), latencies.counts))
+
+    stats_due = monotonic() + config.metrics_every
+
+    n = None
+
+    while True:
+        n = step(n)
+
+        send_results()
+
+        if monotonic() >= stats_due:
+            send_stats()
+            stats_due = monotonic() + config.metrics_every
 
         pipe.flush()
 
-        if len(pending_evaluation) > 0:
-            for command, *args in pipe.recv():
-                if command == _TERMINATE:
-                    return
+        # Every tree finished a game with no leaf to evaluate
+        if n == 0:
+            if channel.closed():
+                break
+
+            continue
+
+        requested_at = monotonic_ns()
 
-                assert command == _EVALUATION, f"invalid command {command}"
+        channel.request(slot, n)
+        generation = channel.wait_response(slot)
+        waited = monotonic_ns() - requested_at
+        wait_ns += waited
 
-                av, expansion = args
+        if generation is None:
+            break
 
-                mcts, leaf = pending_evaluation.popleft()
-                mcts.expand_leaf(leaf, av, expansion)
+        latencies.record(waited / 1e9, n)
 
-                pending_selection.append(mcts)
+    send_stats()
+    pipe.flush()
@@ -0,0 +1,206 @@
+#ifndef ALPHA3_TRANSPOSITION_H
+#define ALPHA3_TRANSPOSITION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bounded table of network evaluations, keyed by a 64-bit position hash and
+// the generation of the weights that produced them, so that positions
+// reached through different move orders (or in different trees) are
+// evaluated once per set of weights. Entries of other generations are never
+// returned and are the first to be replaced, so moving to a new generation
+// invalidates the whole table at once.
+//
+// A key maps to a bucket of a few slots, replaced by the clock algorithm:
+// lookups mark the slot they hit as referenced, and insertion sweeps the
+// bucket's hand past referenced slots (clearing them) to the first one that
+// is not. Each slot holds a value and a fixed number of priors behind a
+// sequence lock: readers never block, and discard a slot whose write
+// overlapped the read; a writer that finds its slot busy drops its entry,
+// which only costs a future evaluation.
+class TranspositionTable {
+public:
+  static constexpr size_t ways = 4;
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+
+    // Live entries of the current generation that were replaced
+    uint64_t evictions;
+  };
+
+  TranspositionTable(size_t capacity, size_t width_)
+      : width(width_), mask(round_up_pow2((capacity + ways - 1) / ways) - 1),
+        slots((mask + 1) * ways), hands(mask + 1, 0),
+        payload((mask + 1) * ways * (width + 1)), stats_{0, 0, 0} {}
+
+  TranspositionTable(const TranspositionTable &) = delete;
+
+  TranspositionTable &operator=(const TranspositionTable &) = delete;
+
+  size_t capacity() const { return slots.size(); }
+
+  Stats stats() const {
+    return {__atomic_load_n(&stats_.hits, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats_.misses, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats_.evictions, __ATOMIC_RELAXED)};
+  }
+
+  // Copy out the value and priors stored for key under generation, if any
+  bool find(uint64_t key, uint64_t generation, float &value, float *priors) {
+    key = nonzero(key);
+
+    const size_t bucket = (size_t)(key & mask);
+
+    for (size_t way = 0; way < ways; way++) {
+      const size_t index = bucket * ways + way;
+      Slot &slot = slots[index];
+
+      const uint64_t version =
+          __atomic_load_n(&slot.version, __ATOMIC_ACQUIRE);
+
+      if ((version & 1) != 0 ||
+          __atomic_load_n(&slot.key, __ATOMIC_RELAXED) != key ||
+          __atomic_load_n(&slot.generation, __ATOMIC_RELAXED) != generation) {
+        continue;
+      }
+
+      const float *entry = &payload[index * (width + 1)];
+
+      __atomic_load(&entry[0], &value, __ATOMIC_RELAXED);
+
+      for (size_t i = 0; i < width; i++) {
+        __atomic_load(&entry[i + 1], &priors[i], __ATOMIC_RELAXED);
+      }
+
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+      if (__atomic_load_n(&slot.version, __ATOMIC_RELAXED) != version) {
+        continue;
+      }
+
+      __atomic_store_n(&slot.referenced, (uint8_t)1, __ATOMIC_RELAXED);
+      __atomic_fetch_add(&stats_.hits, 1, __ATOMIC_RELAXED);
+      return true;
+    }
+
+    __atomic_fetch_add(&stats_.misses, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+
+  void insert(uint64_t key, uint64_t generation, float value,
+              const float *priors) {
+    key = nonzero(key);
+
+    const size_t bucket = (size_t)(key & mask);
+    const size_t index = bucket * ways + victim(bucket, key, generation);
+    Slot &slot = slots[index];
+
+    uint64_t version = __atomic_load_n(&slot.version, __ATOMIC_RELAXED);
+
+    if ((version & 1) != 0 ||
+        !__atomic_compare_exchange_n(&slot.version, &version, version + 1,
+                                     false, __ATOMIC_ACQUIRE,
+                                     __ATOMIC_RELAXED)) {
+      return;
+    }
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    const uint64_t replaced = __atomic_load_n(&slot.key, __ATOMIC_RELAXED);
+
+    if (replaced != 0 && replaced != key &&
+        __atomic_load_n(&slot.generation, __ATOMIC_RELAXED) == generation) {
+      __atomic_fetch_add(&stats_.evictions, 1, __ATOMIC_RELAXED);
+    }
+
+    float *entry = &payload[index * (width + 1)];
+
+    __atomic_store_n(&slot.key, key, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot.generation, generation, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot.referenced, (uint8_t)0, __ATOMIC_RELAXED);
+    __atomic_store(&entry[0], &value, __ATOMIC_RELAXED);
+
+    for (size_t i = 0; i < width; i++) {
+      __atomic_store(&entry[i + 1], &priors[i], __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&slot.version, version + 2, __ATOMIC_RELEASE);
+  }
+
+private:
+  struct Slot {
+    // Zero while empty
+    uint64_t key = 0;
+
+    // Odd while a write is in progress
+    uint64_t version = 0;
+
+    uint64_t generation = 0;
+    uint8_t referenced = 0;
+  };
+
+  const size_t width;
+  const size_t mask;
+
+  std::vector<Slot> slots;
+  std::vector<uint8_t> hands;
+  std::vector<float> payload;
+
+  Stats stats_;
+
+  static size_t round_up_pow2(size_t n) {
+    size_t rounded = 1;
+
+    while (rounded < n) {
+      rounded *= 2;
+    }
+
+    return rounded;
+  }
+
+  static uint64_t nonzero(uint64_t key) { return (key == 0) ? 1 : key; }
+
+  // The way of bucket to overwrite with key: its current slot, else an empty
+  // or stale one, else the first unreferenced slot from the clock hand on.
+  // Reads race with writers, which can only make for a poorer choice.
+  size_t victim(size_t bucket, uint64_t key, uint64_t generation) {
+    const Slot *bucket_slots = &slots[bucket * ways];
+
+    for (size_t way = 0; way < ways; way++) {
+      if (__atomic_load_n(&bucket_slots[way].key, __ATOMIC_RELAXED) == key) {
+        return way;
+      }
+    }
+
+    for (size_t way = 0; way < ways; way++) {
+      if (__atomic_load_n(&bucket_slots[way].key, __ATOMIC_RELAXED) == 0 ||
+          __atomic_load_n(&bucket_slots[way].generation, __ATOMIC_RELAXED) !=
+              generation) {
+        return way;
+      }
+    }
+
+    uint8_t hand = __atomic_load_n(&hands[bucket], __ATOMIC_RELAXED);
+
+    // Every slot is unreferenced by the end of the first sweep
+    for (size_t i = 0; i < ways; i++) {
+      uint8_t &referenced = slots[bucket * ways + hand].referenced;
+
+      if (__atomic_load_n(&referenced, __ATOMIC_RELAXED) == 0) {
+        break;
+      }
+
+      __atomic_store_n(&referenced, (uint8_t)0, __ATOMIC_RELAXED);
+      hand = (uint8_t)((hand + 1) % ways);
+    }
+
+    __atomic_store_n(&hands[bucket], (uint8_t)((hand + 1) % ways),
+                     __ATOMIC_RELAXED);
+    return hand;
+  }
+};
+
+#endif
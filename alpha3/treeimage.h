@@ -0,0 +1,127 @@
+#ifndef ALPHA3_TREEIMAGE_H
+#define ALPHA3_TREEIMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// The top plies of an MCTS tree, as a flat image that new trees can be
+// warm-started from (see MCTS::image and MCTS::load_image). A header is
+// followed by the nodes in breadth-first order, the root first, with each
+// node's children stored together and found by index. An image is used in
+// place, read-only, so one file mapped into memory can serve as an opening
+// book to any number of processes at once. Moves are stored as 32-bit codes
+// chosen by the caller, and everything is in native byte order.
+//
+// A node without children is terminal if visited, and otherwise a leaf.
+// Nodes on the last ply saved are stored as leaves, with their priors, and
+// their visits are taken back from their ancestors, so that each expanded
+// node's visits are still one more than its children's.
+class TreeImage {
+public:
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_nodes;
+  };
+
+  struct Node {
+    // Index of the first child, and the number of children
+    uint32_t first_child;
+    uint32_t n_children;
+
+    // The statistics of the edge leading into the node
+    uint32_t n_visits;
+    float total_av;
+    float prior;
+
+    uint32_t move;
+  };
+
+  static_assert(sizeof(Header) == 16, "unexpected padding");
+  static_assert(sizeof(Node) == 24, "unexpected padding");
+
+  static constexpr uint32_t version = 1;
+
+  TreeImage() : nodes_(nullptr), size_(0) {}
+
+  // View the size bytes at data, which must be 4-byte aligned and outlive
+  // the view, as an image, or return false if they are not one. Every node
+  // but the root is checked to be the child of exactly one node before it,
+  // so that any image that passes can be walked safely.
+  bool view(const void *data, size_t size) {
+    const Header *header = (const Header *)data;
+
+    if ((uintptr_t)data % alignof(Header) != 0 || size < sizeof(Header) ||
+        memcmp(header->magic, magic(), sizeof(header->magic)) != 0 ||
+        header->version != version || header->n_nodes == 0 ||
+        (size - sizeof(Header)) / sizeof(Node) < header->n_nodes) {
+      return false;
+    }
+
+    const Node *nodes = (const Node *)(header + 1);
+    const size_t n = header->n_nodes;
+
+    // In breadth-first order, each node's children follow those of the node
+    // before it
+    size_t next_child = 1;
+
+    for (size_t i = 0; i < n; i++) {
+      const Node &node = nodes[i];
+
+      if (node.n_children == 0) {
+        continue;
+      }
+
+      if (node.first_child != next_child || next_child <= i ||
+          node.n_children > n - next_child) {
+        return false;
+      }
+
+      next_child += node.n_children;
+    }
+
+    if (next_child != n) {
+      return false;
+    }
+
+    nodes_ = nodes;
+    size_ = n;
+
+    return true;
+  }
+
+  size_t size() const { return size_; }
+
+  const Node &root() const { return nodes_[0]; }
+
+  const Node &node(size_t i) const { return nodes_[i]; }
+
+  // The bytes of an image of nodes, as MCTS::image returns them
+  static std::vector<char> serialize(const std::vector<Node> &nodes) {
+    std::vector<char> bytes(sizeof(Header) + nodes.size() * sizeof(Node));
+
+    Header header;
+    memcpy(header.magic, magic(), sizeof(header.magic));
+    header.version = version;
+    header.n_nodes = (uint32_t)nodes.size();
+
+    memcpy(bytes.data(), &header, sizeof(header));
+
+    if (!nodes.empty()) {
+      memcpy(bytes.data() + sizeof(header), nodes.data(),
+             nodes.size() * sizeof(Node));
+    }
+
+    return bytes;
+  }
+
+private:
+  const Node *nodes_;
+  size_t size_;
+
+  static const char *magic() { return "A3TREE\0\0"; }
+};
+
+#endif
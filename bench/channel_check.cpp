@@ -0,0 +1,212 @@
+// Stress of EvaluationChannel: clients post batches on their slots while a
+// server collects them on one thread and responds from others, and every
+// client must get back the evaluations of its own batch, tagged with its
+// own generation. A client left waiting on a request no one answers must be
+// released by close. Build it with -fsanitize=thread (or configure
+// bench/CMakeLists.txt with -DALPHA3_SANITIZE=thread) to check the
+// orderings as well.
+//
+//   g++ -O1 -g -std=c++17 -pthread -fsanitize=thread -I alpha3 bench/channel_check.cpp -o channel_check
+//
+// then
+//
+//   ./channel_check [clients] [batches_per_client]
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "channel.h"
+
+static const size_t capacity = 8;
+static const size_t n_features = 5;
+static const size_t policy_width = 3;
+
+// Feature j of position k of batch b on slot
+static float feature(size_t slot, size_t b, size_t k, size_t j) {
+  return (float)((slot * 131 + b * 17 + k * 5 + j) % 1009);
+}
+
+int main(int argc, char **argv) {
+  const size_t n_clients = (argc > 1) ? strtoul(argv[1], NULL, 10) : 4;
+  const size_t batches = (argc > 2) ? strtoul(argv[2], NULL, 10) : 5000;
+
+  const size_t n_responders = 2;
+
+  // One more slot than clients, whose requests are never answered
+  const size_t slots = n_clients + 1;
+  const size_t ignored = n_clients;
+
+  const size_t size = EvaluationChannel::size(slots, capacity, n_features,
+                                              policy_width);
+  void *memory = aligned_alloc(
+      EvaluationChannel::alignment,
+      (size + EvaluationChannel::alignment - 1) /
+          EvaluationChannel::alignment * EvaluationChannel::alignment);
+  memset(memory, 0, size);
+
+  EvaluationChannel channel(memory, slots, capacity, n_features,
+                            policy_width);
+
+  // Requests collected and not yet answered, as (slot, n)
+  std::mutex queue_mutex;
+  std::condition_variable queued;
+  std::deque<std::pair<size_t, size_t>> queue;
+
+  std::thread collector([&]() {
+    std::vector<std::pair<size_t, size_t>> requests;
+
+    while (!channel.closed()) {
+      requests.clear();
+      channel.wait_requests(std::chrono::milliseconds(1), requests);
+
+      std::lock_guard<std::mutex> lock(queue_mutex);
+
+      for (const auto &request : requests) {
+        if (request.first != ignored) {
+          queue.push_back(request);
+        }
+      }
+
+      queued.notify_all();
+    }
+  });
+
+  // Each position's value is the sum of its features, and its priors follow
+  // on from it; the generation is the first feature of the batch
+  std::vector<std::thread> responders;
+
+  for (size_t r = 0; r < n_responders; r++) {
+    responders.emplace_back([&]() {
+      for (;;) {
+        std::pair<size_t, size_t> request;
+
+        {
+          std::unique_lock<std::mutex> lock(queue_mutex);
+
+          while (queue.empty()) {
+            if (channel.closed()) {
+              return;
+            }
+
+            queued.wait_for(lock, std::chrono::milliseconds(1));
+          }
+
+          request = queue.front();
+          queue.pop_front();
+        }
+
+        const size_t slot = request.first;
+        const float *features = channel.features(slot);
+        float *values = channel.values(slot);
+        float *policies = channel.policies(slot);
+
+        for (size_t k = 0; k < request.second; k++) {
+          float sum = 0;
+
+          for (size_t j = 0; j < n_features; j++) {
+            sum += features[k * n_features + j];
+          }
+
+          values[k] = sum;
+
+          for (size_t j = 0; j < policy_width; j++) {
+            policies[k * policy_width + j] = sum + (float)(j + 1);
+          }
+        }
+
+        channel.respond(slot, (uint64_t)features[0]);
+      }
+    });
+  }
+
+  size_t wrong = 0;
+  size_t failed = 0;
+
+  std::vector<std::thread> clients;
+
+  for (size_t slot = 0; slot < n_clients; slot++) {
+    clients.emplace_back([&, slot]() {
+      float *features = channel.features(slot);
+      const float *values = channel.values(slot);
+      const float *policies = channel.policies(slot);
+
+      for (size_t b = 0; b < batches; b++) {
+        const size_t n = 1 + (slot + b) % capacity;
+
+        for (size_t k = 0; k < n; k++) {
+          for (size_t j = 0; j < n_features; j++) {
+            features[k * n_features + j] = feature(slot, b, k, j);
+          }
+        }
+
+        channel.request(slot, n);
+
+        uint64_t generation;
+
+        if (!channel.wait_response(slot, generation)) {
+          __atomic_fetch_add(&failed, 1, __ATOMIC_RELAXED);
+          return;
+        }
+
+        bool right = (generation == (uint64_t)feature(slot, b, 0, 0));
+
+        for (size_t k = 0; k < n; k++) {
+          float sum = 0;
+
+          for (size_t j = 0; j < n_features; j++) {
+            sum += feature(slot, b, k, j);
+          }
+
+          right = right && values[k] == sum;
+
+          for (size_t j = 0; j < policy_width; j++) {
+            right = right &&
+                    policies[k * policy_width + j] == sum + (float)(j + 1);
+          }
+        }
+
+        if (!right) {
+          __atomic_fetch_add(&wrong, 1, __ATOMIC_RELAXED);
+        }
+      }
+    });
+  }
+
+  bool released = false;
+
+  std::thread waiter([&]() {
+    uint64_t generation;
+
+    channel.request(ignored, 1);
+    released = !channel.wait_response(ignored, generation);
+  });
+
+  for (std::thread &client : clients) {
+    client.join();
+  }
+
+  channel.close();
+
+  waiter.join();
+  collector.join();
+
+  for (std::thread &responder : responders) {
+    responder.join();
+  }
+
+  free(memory);
+
+  printf("%zu client(s), %zu batch(es) each: %zu wrong, %zu failed; waiter "
+         "%s by close\n",
+         n_clients, batches, wrong, failed,
+         released ? "released" : "not released");
+
+  return (wrong == 0 && failed == 0 && released) ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+// Stress of StealingDeque: an owner pushes and pops items while thieves
+// steal them, and every item must be taken exactly once. Build it with
+// -fsanitize=thread (or configure bench/CMakeLists.txt with
+// -DALPHA3_SANITIZE=thread) to check the orderings as well.
+//
+//   g++ -O1 -g -std=c++17 -pthread -fsanitize=thread -I alpha3 bench/deque_check.cpp -o deque_check
+//
+// then
+//
+//   ./deque_check [thieves] [items]
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "runtime.h"
+
+int main(int argc, char **argv) {
+  const size_t n_thieves = (argc > 1) ? strtoul(argv[1], NULL, 10) : 3;
+  const size_t n_items = (argc > 2) ? strtoul(argv[2], NULL, 10) : 200000;
+
+  const size_t capacity = 64;
+
+  StealingDeque deque(capacity);
+
+  // Times each item was taken, and items taken in all
+  std::unique_ptr<uint32_t[]> taken(new uint32_t[n_items]());
+  size_t n_taken = 0;
+  bool pushed_all = false;
+
+  auto take = [&](size_t item) {
+    __atomic_fetch_add(&taken[item], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&n_taken, 1, __ATOMIC_RELEASE);
+  };
+
+  std::vector<std::thread> thieves;
+
+  for (size_t i = 0; i < n_thieves; i++) {
+    thieves.emplace_back([&]() {
+      size_t item;
+
+      for (;;) {
+        if (deque.steal(item)) {
+          take(item);
+        } else if (__atomic_load_n(&pushed_all, __ATOMIC_ACQUIRE)) {
+          return;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  // The owner pops one item for every few it pushes, and never holds more
+  // than the capacity, since its count of those still held errs high
+  size_t pushed = 0;
+  size_t item;
+
+  while (pushed < n_items) {
+    if (pushed - __atomic_load_n(&n_taken, __ATOMIC_ACQUIRE) < capacity) {
+      deque.push(pushed++);
+    } else {
+      std::this_thread::yield();
+    }
+
+    if (pushed % 3 == 0 && deque.pop(item)) {
+      take(item);
+    }
+  }
+
+  while (deque.pop(item)) {
+    take(item);
+  }
+
+  __atomic_store_n(&pushed_all, true, __ATOMIC_RELEASE);
+
+  for (std::thread &thief : thieves) {
+    thief.join();
+  }
+
+  size_t lost = 0;
+  size_t duplicated = 0;
+
+  for (size_t i = 0; i < n_items; i++) {
+    lost += taken[i] == 0;
+    duplicated += taken[i] > 1;
+  }
+
+  printf("%zu item(s), %zu thief thread(s): %zu lost, %zu taken twice\n",
+         n_items, n_thieves, lost, duplicated);
+
+  return (lost == 0 && duplicated == 0) ? 0 : 1;
+}
@@ -0,0 +1,186 @@
+// Selection throughput of MCTS on a synthetic game, per node allocator and
+// child layout, followed by the scaling of multithreaded search of a single
+// tree. Build with -mavx (or -march=native) to exercise the AVX selection
+// kernel of SoALayout; SSE2 or NEON is used otherwise.
+//
+//   g++ -O2 -std=c++17 -pthread -I alpha3 bench/mcts_bench.cpp -o mcts_bench
+//
+// (or through bench/CMakeLists.txt), then
+//
+//   ./mcts_bench [branching_factor] [visits_per_move] [moves] [max_threads]
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "mcts.h"
+
+struct SyntheticState {
+  uint64_t key;
+  uint32_t depth;
+};
+
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+static double unit(uint64_t x) { return (double)(mix(x) >> 11) * 0x1.0p-53; }
+
+template <class Allocator, template <class> class Layout,
+          class Sync = SingleThreaded>
+struct Bench {
+  typedef MCTS<SyntheticState, uint32_t, std::default_random_engine, Allocator,
+               Layout, Sync>
+      Tree;
+
+  static constexpr uint32_t max_depth = 42;
+
+  size_t branching_factor;
+  size_t visits_per_move;
+  size_t moves;
+
+  double select_ns = 0.0;
+  double total_ns = 0.0;
+  size_t visits = 0;
+
+  double evaluate(const SyntheticState &state,
+                  std::vector<typename Tree::ExpansionEntry> &expansion) const {
+    if (state.depth < max_depth) {
+      double sum = 0.0;
+
+      for (size_t i = 0; i < branching_factor; i++) {
+        const uint64_t key = mix(state.key * 31 + i + 1);
+        const double prior = 0.1 + unit(key);
+
+        expansion.push_back({(uint32_t)i, {key, state.depth + 1}, prior});
+        sum += prior;
+      }
+
+      for (auto &entry : expansion) {
+        entry.prior_probability /= sum;
+      }
+    }
+
+    return 2.0 * unit(state.key) - 1.0;
+  }
+
+  void expand(Tree &tree, typename Tree::Node *leaf) {
+    std::vector<typename Tree::ExpansionEntry> expansion;
+    const double av = evaluate(leaf->state(), expansion);
+
+    tree.expand_leaf(leaf, av, std::move(expansion));
+  }
+
+  void run() {
+    typedef std::chrono::steady_clock Clock;
+
+    Tree tree(1.25, 19652, SyntheticState{1, 0}, 0);
+
+    const auto started_at = Clock::now();
+
+    for (size_t move = 0; move < moves && !tree.complete(); move++) {
+      for (size_t i = 0; i < visits_per_move; i++) {
+        const auto selecting_at = Clock::now();
+        auto leaf = tree.select_leaf();
+        select_ns += std::chrono::duration<double, std::nano>(Clock::now() -
+                                                              selecting_at)
+                         .count();
+
+        visits++;
+
+        if (leaf != nullptr) {
+          expand(tree, leaf);
+        }
+      }
+
+      tree.move_greedy();
+    }
+
+    total_ns +=
+        std::chrono::duration<double, std::nano>(Clock::now() - started_at)
+            .count();
+  }
+
+  void run_threaded(size_t n_threads) {
+    typedef std::chrono::steady_clock Clock;
+
+    Tree tree(1.25, 19652, SyntheticState{1, 0}, 0);
+
+    const auto started_at = Clock::now();
+
+    for (size_t move = 0; move < moves && !tree.complete(); move++) {
+      tree.search(visits_per_move, n_threads,
+                  [this](const SyntheticState &state, double &av,
+                         std::vector<typename Tree::ExpansionEntry> &expansion) {
+                    av = evaluate(state, expansion);
+                  });
+
+      visits += visits_per_move;
+      tree.move_greedy();
+    }
+
+    total_ns +=
+        std::chrono::duration<double, std::nano>(Clock::now() - started_at)
+            .count();
+  }
+};
+
+template <class Allocator, template <class> class Layout>
+static void run(const char *name, size_t branching_factor,
+                size_t visits_per_move, size_t moves) {
+  Bench<Allocator, Layout> bench{branching_factor, visits_per_move, moves};
+  bench.run();
+
+  printf("%-12s b=%-3zu visits=%-9zu select %7.1f ns/visit, total %7.1f "
+         "ns/visit\n",
+         name, branching_factor, bench.visits, bench.select_ns / bench.visits,
+         bench.total_ns / bench.visits);
+}
+
+static void run_threaded(size_t n_threads, size_t branching_factor,
+                         size_t visits_per_move, size_t moves) {
+  Bench<NodeArena, EdgeLayout, MultiThreaded> bench{branching_factor,
+                                                    visits_per_move, moves};
+  bench.run_threaded(n_threads);
+
+  printf("threads=%-4zu b=%-3zu visits=%-9zu total %7.1f ns/visit, %9.0f "
+         "visits/s\n",
+         n_threads, branching_factor, bench.visits,
+         bench.total_ns / bench.visits, bench.visits / bench.total_ns * 1e9);
+}
+
+int main(int argc, char **argv) {
+  const size_t branching_factor = (argc > 1) ? strtoul(argv[1], NULL, 10) : 7;
+  const size_t visits_per_move =
+      (argc > 2) ? strtoul(argv[2], NULL, 10) : 200000;
+  const size_t moves = (argc > 3) ? strtoul(argv[3], NULL, 10) : 8;
+  const size_t max_threads = (argc > 4)
+                                 ? strtoul(argv[4], NULL, 10)
+                                 : std::thread::hardware_concurrency();
+
+  run<HeapAllocator, EdgeLayout>("heap/edge", branching_factor,
+                                 visits_per_move, moves);
+  run<NodeArena, EdgeLayout>("arena/edge", branching_factor, visits_per_move,
+                             moves);
+  run<NodeArena, SoALayout>("arena/soa", branching_factor, visits_per_move,
+                            moves);
+
+  if (branching_factor <= 7) {
+    run<NodeArena, FixedEdgeLayout<7>::Layout>("arena/fixed7", branching_factor,
+                                               visits_per_move, moves);
+  }
+
+  for (size_t n_threads = 1; n_threads <= max_threads; n_threads *= 2) {
+    run_threaded(n_threads, branching_factor, visits_per_move, moves);
+  }
+
+  return 0;
+}
@@ -0,0 +1,133 @@
+// Stress of ReplayRing: writers insert records while samplers draw from the
+// ring, and every record drawn must be one written whole, never a mix of
+// two. Build it with -fsanitize=thread (or configure bench/CMakeLists.txt
+// with -DALPHA3_SANITIZE=thread) to check the orderings as well.
+//
+//   g++ -O1 -g -std=c++17 -pthread -fsanitize=thread -I alpha3 bench/ring_check.cpp -o ring_check
+//
+// then
+//
+//   ./ring_check [writers] [samplers] [records_per_writer]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "replay.h"
+
+static const size_t capacity = 97;
+static const size_t n_labels = 8;
+static const size_t n_features = 42;
+
+// Record v has every label v, and feature j the bit j % 16 of v
+static void write_record(uint32_t v, uint8_t *record, size_t record_size) {
+  memset(record, 0, record_size);
+
+  for (size_t i = 0; i < n_labels; i++) {
+    const float label = (float)v;
+    memcpy(record + i * sizeof(float), &label, sizeof(float));
+  }
+
+  uint8_t *bits = record + n_labels * sizeof(float);
+
+  for (size_t j = 0; j < n_features; j++) {
+    bits[j / 8] |= (uint8_t)(((v >> (j % 16)) & 1) << (j % 8));
+  }
+}
+
+static bool whole(const float *features, const float *labels) {
+  const uint32_t v = (uint32_t)labels[0];
+
+  for (size_t i = 0; i < n_labels; i++) {
+    if (labels[i] != (float)v) {
+      return false;
+    }
+  }
+
+  for (size_t j = 0; j < n_features; j++) {
+    if (features[j] != (float)((v >> (j % 16)) & 1)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const size_t n_writers = (argc > 1) ? strtoul(argv[1], NULL, 10) : 3;
+  const size_t n_samplers = (argc > 2) ? strtoul(argv[2], NULL, 10) : 2;
+  const size_t per_writer = (argc > 3) ? strtoul(argv[3], NULL, 10) : 50000;
+
+  // Small, so that writers lap one another under the samplers
+  ReplayRing ring(capacity, n_labels, n_features);
+
+  bool writing = true;
+  size_t torn = 0;
+  size_t drawn = 0;
+
+  std::vector<std::thread> writers;
+  std::vector<std::thread> samplers;
+
+  for (size_t w = 0; w < n_writers; w++) {
+    writers.emplace_back([&, w]() {
+      const size_t batch = 1 + w % 4;
+      std::vector<uint8_t> records(batch * ring.record_size());
+
+      for (size_t i = 0; i < per_writer; i += batch) {
+        for (size_t k = 0; k < batch; k++) {
+          write_record((uint32_t)(w * per_writer + i + k) % (1 << 20),
+                       records.data() + k * ring.record_size(),
+                       ring.record_size());
+        }
+
+        ring.insert(records.data(), batch);
+      }
+    });
+  }
+
+  for (size_t s = 0; s < n_samplers; s++) {
+    samplers.emplace_back([&, s]() {
+      std::default_random_engine generator((unsigned)s);
+
+      const size_t n = 16;
+      std::vector<float> features(n * n_features);
+      std::vector<float> labels(n * n_labels);
+
+      while (__atomic_load_n(&writing, __ATOMIC_ACQUIRE)) {
+        if (ring.size() == 0) {
+          std::this_thread::yield();
+          continue;
+        }
+
+        ring.sample(n, generator, features.data(), labels.data());
+
+        for (size_t i = 0; i < n; i++) {
+          if (!whole(&features[i * n_features], &labels[i * n_labels])) {
+            __atomic_fetch_add(&torn, 1, __ATOMIC_RELAXED);
+          }
+        }
+
+        __atomic_fetch_add(&drawn, n, __ATOMIC_RELAXED);
+      }
+    });
+  }
+
+  for (std::thread &writer : writers) {
+    writer.join();
+  }
+
+  __atomic_store_n(&writing, false, __ATOMIC_RELEASE);
+
+  for (std::thread &sampler : samplers) {
+    sampler.join();
+  }
+
+  printf("%zu record(s) drawn while %zu writer(s) inserted %zu each: %zu "
+         "torn; size %zu\n",
+         drawn, n_writers, per_writer, torn, ring.size());
+
+  return (torn == 0 && ring.size() == capacity) ? 0 : 1;
+}
@@ -0,0 +1,78 @@
+// Self-play of Connect-3 on a 3x3 board, whose every position fits in the
+// transposition table, so that once the table fills no leaf ever needs
+// evaluating. Each step must still return, and the games it finishes must be
+// collected, whether or not anything was queued.
+//
+//   g++ -O2 -std=c++17 -pthread -I alpha3 bench/selfplay_check.cpp -o selfplay_check
+//
+// (or through bench/CMakeLists.txt, which runs it under ctest), then
+//
+//   ./selfplay_check [games]
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "connectk.h"
+#include "selfplay.h"
+
+int main(int argc, char **argv) {
+  const size_t games = (argc > 1) ? strtoul(argv[1], NULL, 10) : 2000;
+
+  typedef SelfPlayEngine<ConnectKRules> Engine;
+
+  Engine::Config config;
+  config.c_init = 1.25;
+  config.c_base = 19652;
+  config.evaluations = 16;
+  config.leaves_per_tree = 2;
+  config.max_turns = 999;
+  config.stop_early = false;
+  config.noise_alpha = 0.3;
+  config.noise_fraction = 0.25;
+  config.gumbel_considered = 0;
+  config.transpositions = 1 << 16;
+  config.node_budget = 0;
+  config.reclaim_visits = 0;
+
+  ConnectKRules rules(3, 3, 3);
+  const BitboardConnectK initial = rules.initial();
+
+  Engine engine(rules, config, 4, initial);
+
+  const std::vector<float> uniform(rules.policy_width(), 1.0f / 3);
+
+  size_t finished = 0;
+  size_t steps = 0;
+  size_t empty_steps = 0;
+
+  std::vector<Engine::Evaluation> evaluations;
+
+  while (finished < games) {
+    evaluations.assign(engine.batch().size(), {0.0, uniform.data()});
+
+    if (!engine.step(std::move(evaluations))) {
+      fprintf(stderr, "step failed\n");
+      return 1;
+    }
+
+    steps++;
+    empty_steps += engine.batch().empty();
+    finished += engine.take_results().size();
+  }
+
+  const Engine::TranspositionStats stats = engine.transposition_stats();
+
+  printf("%zu game(s) in %zu step(s), %zu with no leaf to evaluate; "
+         "%llu hit(s), %llu miss(es)\n",
+         finished, steps, empty_steps, (unsigned long long)stats.hits,
+         (unsigned long long)stats.misses);
+
+  // Every position is in the table long before the last game
+  if (empty_steps == 0) {
+    fprintf(stderr, "expected steps with no leaf to evaluate\n");
+    return 1;
+  }
+
+  return 0;
+}
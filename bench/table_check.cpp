@@ -0,0 +1,117 @@
+// Stress of TranspositionTable: threads store and look up entries over a few
+// keys while the generation moves on under them, and every entry found must
+// be the one stored for its key and generation, never a mix of two or one
+// of another generation. Build it with -fsanitize=thread (or configure
+// bench/CMakeLists.txt with -DALPHA3_SANITIZE=thread) to check the orderings
+// as well.
+//
+//   g++ -O1 -g -std=c++17 -pthread -fsanitize=thread -I alpha3 bench/table_check.cpp -o table_check
+//
+// then
+//
+//   ./table_check [threads] [operations_per_thread]
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "transposition.h"
+
+static const size_t width = 7;
+
+// The value stored for key under generation, whose priors follow on from it
+static float entry_value(uint64_t key, uint64_t generation) {
+  return (float)((key * 31 + generation * 7) % 100003);
+}
+
+int main(int argc, char **argv) {
+  const size_t n_threads = (argc > 1) ? strtoul(argv[1], NULL, 10) : 4;
+  const size_t operations = (argc > 2) ? strtoul(argv[2], NULL, 10) : 200000;
+
+  // Far fewer slots than keys, so that entries keep being replaced
+  TranspositionTable table(64, width);
+  const uint64_t n_keys = 1024;
+
+  uint64_t generation = 1;
+  size_t hits = 0;
+  size_t wrong = 0;
+
+  std::vector<std::thread> threads;
+
+  for (size_t t = 0; t < n_threads; t++) {
+    threads.emplace_back([&, t]() {
+      std::default_random_engine generator((unsigned)t);
+
+      // Zero is not a key of its own, but an alias of one
+      std::uniform_int_distribution<uint64_t> keys(1, n_keys);
+
+      float priors[width];
+
+      for (size_t i = 0; i < operations; i++) {
+        // The first thread moves the generation on every so often
+        if (t == 0 && i % 1000 == 999) {
+          __atomic_fetch_add(&generation, 1, __ATOMIC_RELAXED);
+        }
+
+        const uint64_t key = keys(generator);
+        const uint64_t current = __atomic_load_n(&generation, __ATOMIC_RELAXED);
+
+        // Look up under the current generation or, now and then, an older
+        // one whose entries may linger
+        const uint64_t looked_up =
+            (i % 8 == 0 && current > 1) ? current - 1 : current;
+
+        float value;
+
+        if (table.find(key, looked_up, value, priors)) {
+          const float expected = entry_value(key, looked_up);
+          bool whole = (value == expected);
+
+          for (size_t j = 0; j < width; j++) {
+            whole = whole && (priors[j] == expected + (float)(j + 1));
+          }
+
+          __atomic_fetch_add(&hits, 1, __ATOMIC_RELAXED);
+
+          if (!whole) {
+            __atomic_fetch_add(&wrong, 1, __ATOMIC_RELAXED);
+          }
+
+          continue;
+        }
+
+        const float stored = entry_value(key, current);
+
+        for (size_t j = 0; j < width; j++) {
+          priors[j] = stored + (float)(j + 1);
+        }
+
+        table.insert(key, current, stored, priors);
+      }
+    });
+  }
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  // Nothing is ever stored under a generation yet to come
+  float value;
+  float priors[width];
+  size_t future = 0;
+
+  for (uint64_t key = 1; key <= n_keys; key++) {
+    future += table.find(key, generation + 1, value, priors);
+  }
+
+  const TranspositionTable::Stats stats = table.stats();
+
+  printf("%zu thread(s), %zu operation(s) each, %llu generation(s): %zu "
+         "hit(s), %zu wrong, %llu eviction(s)\n",
+         n_threads, operations, (unsigned long long)generation, hits, wrong,
+         (unsigned long long)stats.evictions);
+
+  return (wrong == 0 && future == 0 && hits != 0) ? 0 : 1;
+}
@@ -0,0 +1,325 @@
+// Microbenchmarks of MCTS on its own, over a synthetic game with uniform
+// priors and over native Connect-K, per branching factor and tree size:
+//
+//   Search         select_leaf and expand_leaf_lazy, from an empty tree to
+//                  the given number of visits
+//   Reroot         move_greedy on such a tree, keeping the best child's
+//                  subtree and freeing its siblings'
+//   FreeTree       reset on such a tree, freeing every node
+//   Move           move_proportional at a root of many visits over terminal
+//                  children, or move_greedy, whose difference from it is
+//                  the cost of sampling
+//
+// Built with Google Benchmark by bench/CMakeLists.txt, or by hand with
+//
+//   g++ -O2 -std=c++17 -pthread -I alpha3 -c bench/tree_bench.cpp
+//   g++ -pthread tree_bench.o -lbenchmark -o tree_bench
+//   ./tree_bench [--benchmark_filter=...]
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "connectk.h"
+#include "mcts.h"
+
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// An evaluation in [-1, 1] that is the same for every visit of a position
+static double value(uint64_t key) {
+  return 2.0 * ((double)(mix(key) >> 11) * 0x1.0p-53) - 1.0;
+}
+
+// Every position has branching_factor moves with equal priors, until
+// max_depth, where the game ends
+struct SyntheticGame {
+  struct State {
+    uint64_t key;
+    uint32_t depth;
+  };
+
+  typedef uint32_t Move;
+
+  size_t branching_factor;
+  uint32_t max_depth;
+
+  State initial() const { return {1, 0}; }
+
+  bool play(const State &parent, Move move, State &state) const {
+    state = {mix(parent.key * 31 + move + 1), parent.depth + 1};
+    return true;
+  }
+
+  bool outcome(const State &state, bool &terminal, double &av) const {
+    terminal = (state.depth >= max_depth);
+    av = value(state.key);
+    return true;
+  }
+
+  template <class Entry>
+  double expand(const State &state, std::vector<Entry> &expansion) const {
+    for (size_t i = 0; i < branching_factor; i++) {
+      expansion.push_back({(Move)i, 1.0 / branching_factor});
+    }
+
+    return value(state.key);
+  }
+};
+
+// Connect-K under an evaluator with uniform priors over the columns
+struct ConnectKGame {
+  typedef BitboardConnectK State;
+  typedef ConnectKRules::Move Move;
+
+  ConnectKRules rules;
+  std::vector<float> policy;
+
+  ConnectKGame(size_t rows, size_t columns, size_t k)
+      : rules(rows, columns, k), policy(columns, 1.0f) {}
+
+  State initial() const { return rules.initial(); }
+
+  bool play(const State &parent, Move move, State &state) const {
+    return rules.play(parent, move, state);
+  }
+
+  bool outcome(const State &state, bool &terminal, double &av) const {
+    return rules.outcome(state, terminal, av);
+  }
+
+  template <class Entry>
+  double expand(const State &state, std::vector<Entry> &expansion) const {
+    rules.expand(state, policy.data(), expansion);
+    return value(rules.hash(state));
+  }
+};
+
+template <class Game> struct Driver {
+  typedef MCTS<typename Game::State, typename Game::Move> Tree;
+  typedef typename Tree::Node Node;
+
+  const Game &game;
+  std::vector<typename Tree::MoveEntry> expansion;
+
+  std::unique_ptr<Tree> tree() const {
+    return std::unique_ptr<Tree>(new Tree(19652, 1.25, game.initial()));
+  }
+
+  void visit(Tree &tree) {
+    Node *leaf = tree.select_leaf();
+
+    if (leaf == nullptr) {
+      return;
+    }
+
+    tree.materialize(leaf, [this](const typename Game::State &parent,
+                                  const typename Game::Move &move,
+                                  typename Game::State &state) {
+      return game.play(parent, move, state);
+    });
+
+    bool terminal;
+    double av;
+
+    game.outcome(leaf->state(), terminal, av);
+
+    if (terminal) {
+      tree.expand_leaf(leaf, av, {});
+      return;
+    }
+
+    expansion.clear();
+    av = game.expand(leaf->state(), expansion);
+
+    tree.expand_leaf_lazy(leaf, av, std::move(expansion));
+  }
+
+  void search(Tree &tree, size_t visits) {
+    while (tree.searches_this_turn() < visits && !tree.complete()) {
+      visit(tree);
+    }
+  }
+};
+
+template <class Game>
+static void search(benchmark::State &state, const Game &game, size_t visits) {
+  Driver<Game> driver{game, {}};
+  size_t nodes = 0;
+
+  for (auto _ : state) {
+    auto tree = driver.tree();
+    driver.search(*tree, visits);
+
+    state.PauseTiming();
+    nodes = tree->memory_stats().live_nodes;
+    tree.reset();
+    state.ResumeTiming();
+  }
+
+  state.SetItemsProcessed(state.iterations() * visits);
+  state.counters["nodes"] = (double)nodes;
+}
+
+template <class Game>
+static void reroot(benchmark::State &state, const Game &game, size_t visits) {
+  Driver<Game> driver{game, {}};
+  size_t freed = 0;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto tree = driver.tree();
+    driver.search(*tree, visits);
+    const size_t before = tree->memory_stats().live_nodes;
+    state.ResumeTiming();
+
+    tree->move_greedy();
+
+    state.PauseTiming();
+    freed += before - tree->memory_stats().live_nodes;
+    tree.reset();
+    state.ResumeTiming();
+  }
+
+  state.counters["freed"] =
+      benchmark::Counter((double)freed, benchmark::Counter::kAvgIterations);
+}
+
+template <class Game>
+static void free_tree(benchmark::State &state, const Game &game,
+                      size_t visits) {
+  Driver<Game> driver{game, {}};
+  size_t freed = 0;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto tree = driver.tree();
+    driver.search(*tree, visits);
+    freed += tree->memory_stats().live_nodes;
+    state.ResumeTiming();
+
+    tree->reset(game.initial());
+
+    state.PauseTiming();
+    tree.reset();
+    state.ResumeTiming();
+  }
+
+  state.SetItemsProcessed((int64_t)freed);
+}
+
+static void BM_SyntheticSearch(benchmark::State &state) {
+  search(state, SyntheticGame{(size_t)state.range(0), 42},
+         (size_t)state.range(1));
+}
+
+static void BM_SyntheticReroot(benchmark::State &state) {
+  reroot(state, SyntheticGame{(size_t)state.range(0), 42},
+         (size_t)state.range(1));
+}
+
+static void BM_SyntheticFreeTree(benchmark::State &state) {
+  free_tree(state, SyntheticGame{(size_t)state.range(0), 42},
+            (size_t)state.range(1));
+}
+
+static void BM_ConnectKSearch(benchmark::State &state) {
+  search(state,
+         ConnectKGame((size_t)state.range(0), (size_t)state.range(1),
+                      (size_t)state.range(2)),
+         (size_t)state.range(3));
+}
+
+static void BM_ConnectKReroot(benchmark::State &state) {
+  reroot(state,
+         ConnectKGame((size_t)state.range(0), (size_t)state.range(1),
+                      (size_t)state.range(2)),
+         (size_t)state.range(3));
+}
+
+static void BM_ConnectKFreeTree(benchmark::State &state) {
+  free_tree(state,
+            ConnectKGame((size_t)state.range(0), (size_t)state.range(1),
+                         (size_t)state.range(2)),
+            (size_t)state.range(3));
+}
+
+// Each move is timed over a batch of trees, since one takes too little time
+// to pause the timer around
+template <bool Proportional> static void BM_Move(benchmark::State &state) {
+  static constexpr size_t batch = 64;
+
+  const SyntheticGame game{(size_t)state.range(0), 1};
+  Driver<SyntheticGame> driver{game, {}};
+
+  std::vector<std::unique_ptr<MCTS<SyntheticGame::State, uint32_t>>> trees;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    trees.clear();
+
+    for (size_t i = 0; i < batch; i++) {
+      trees.push_back(driver.tree());
+      driver.search(*trees.back(), (size_t)state.range(1));
+    }
+
+    state.ResumeTiming();
+
+    for (auto &tree : trees) {
+      benchmark::DoNotOptimize(Proportional ? tree->move_proportional()
+                                            : tree->move_greedy());
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+
+// Trees are capped at about 2^22 nodes
+static void tree_sizes(benchmark::internal::Benchmark *benchmark) {
+  benchmark->ArgNames({"b", "visits"});
+
+  for (int64_t branching_factor : {2, 7, 16, 64}) {
+    for (int64_t visits : {1 << 10, 1 << 13, 1 << 16}) {
+      if (branching_factor * visits <= (1 << 22)) {
+        benchmark->Args({branching_factor, visits});
+      }
+    }
+  }
+}
+
+static void boards(benchmark::internal::Benchmark *benchmark) {
+  benchmark->ArgNames({"rows", "columns", "k", "visits"});
+
+  for (int64_t visits : {1 << 10, 1 << 13, 1 << 16}) {
+    benchmark->Args({4, 4, 3, visits});
+    benchmark->Args({6, 7, 4, visits});
+    benchmark->Args({5, 10, 4, visits});
+  }
+}
+
+BENCHMARK(BM_SyntheticSearch)->Apply(tree_sizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SyntheticReroot)->Apply(tree_sizes)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_SyntheticFreeTree)
+    ->Apply(tree_sizes)
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK(BM_ConnectKSearch)->Apply(boards)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ConnectKReroot)->Apply(boards)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ConnectKFreeTree)->Apply(boards)->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_TEMPLATE(BM_Move, true)
+    ->ArgNames({"b", "visits"})
+    ->ArgsProduct({{2, 7, 16, 64, 256}, {1 << 12}});
+BENCHMARK_TEMPLATE(BM_Move, false)
+    ->ArgNames({"b", "visits"})
+    ->ArgsProduct({{2, 7, 16, 64, 256}, {1 << 12}});
+
+BENCHMARK_MAIN();
@@ -0,0 +1,52 @@
+import argparse
+
+import numpy as np
+
+from alpha3 import ConnectK, Config
+from alpha3.models import ConvNet3x3
+from alpha3.train import actor
+
+# Plays Connect Four for a learner on another host, started with
+# Config(listen=(host, port), authkey=...) there. For example,
+#
+#   python3 scripts/actor.py learner.local:7700 --authkey secret --workers 4
+#
+# plays until the learner finishes training
+
+parser = argparse.ArgumentParser()
+parser.add_argument('learner', help='host:port the learner listens on')
+parser.add_argument('--authkey', required=True, help='the key the learner was started with')
+parser.add_argument('--workers', type=int, default=4)
+parser.add_argument('--worker-threads', type=int, default=1)
+parser.add_argument('--worker-concurrency', type=int, default=128)
+parser.add_argument('--evaluations', type=int, default=100)
+parser.add_argument('--leaves-per-tree', type=int, default=1)
+parser.add_argument('--inference-streams', type=int, default=1)
+parser.add_argument('--pull-every', type=float, default=10.0, help='seconds between pulls of the weights')
+parser.add_argument('--precision', choices=('float16', 'bfloat16'), help='evaluate at reduced precision, compiled with XLA')
+parser.add_argument('--python', action='store_true', help='play through the Python engine rather than natively')
+args = parser.parse_args()
+
+host, port = args.learner.rsplit(':', 1)
+
+initial_state = ConnectK(6, 7, 4)
+
+# The weights come from the learner
+model = ConvNet3x3(7)
+model(np.zeros((1, *initial_state.position().shape)))
+
+config = Config(workers=args.workers,
+                worker_threads=args.worker_threads,
+                initial_state=initial_state,
+                model=model,
+                name='actor',
+                worker_concurrency=args.worker_concurrency,
+                evaluations=args.evaluations,
+                leaves_per_tree=args.leaves_per_tree,
+                inference_streams=args.inference_streams,
+                pull_every=args.pull_every,
+                native=not args.python,
+                inference_precision=args.precision,
+                max_turns=999)
+
+actor(config, (host, int(port)), args.authkey.encode())
@@ -0,0 +1,79 @@
+import argparse
+import itertools
+import json
+
+import numpy as np
+
+from alpha3 import ConnectK, Config
+from alpha3.models import ConvNet3x3
+from alpha3.train import benchmark
+
+# Self-play throughput of Connect Four, over every combination of the values
+# given for each swept option. For example,
+#
+#   python3 scripts/benchmark.py --games 200 --workers 1 2 4 \
+#       --worker-threads 1 4 --worker-concurrency 32 128 --evaluations 100
+#
+# evaluates with the bundled weights, and with --stub without a model at all
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--games', type=int, default=100)
+parser.add_argument('--workers', type=int, nargs='+', default=[4])
+parser.add_argument('--worker-threads', type=int, nargs='+', default=[1])
+parser.add_argument('--worker-concurrency', type=int, nargs='+', default=[128])
+parser.add_argument('--evaluations', type=int, nargs='+', default=[100])
+parser.add_argument('--leaves-per-tree', type=int, default=1)
+parser.add_argument('--inference-streams', type=int, default=1)
+parser.add_argument('--python', action='store_true', help='play through the Python engine rather than natively')
+parser.add_argument('--weights', default='c4_c3x3_20000.h5')
+parser.add_argument('--stub', action='store_true', help='evaluate with uniform priors instead of the weights')
+parser.add_argument('--precision', choices=('float16', 'bfloat16'), help='evaluate at reduced precision, compiled with XLA')
+parser.add_argument('--timing', action='store_true', help='time each phase of the search, at a small cost')
+parser.add_argument('--gumbel', type=int, default=0, help='search roots by sequential halving over this many moves')
+parser.add_argument('--book', help='start every game from this opening book (see scripts/book.py)')
+parser.add_argument('--asymmetric', action='store_true', help='evaluate mirror images of a position separately')
+parser.add_argument('--json', help='append each run to this file, one JSON object per line')
+args = parser.parse_args()
+
+initial_state = ConnectK(6, 7, 4)
+
+if args.stub:
+    model = None
+else:
+    model = ConvNet3x3(7)
+    model(np.zeros((1, *initial_state.position().shape)))
+    model.load_weights(args.weights)
+
+columns = ('workers', 'worker_threads', 'worker_concurrency', 'evaluations', 'games', 'games_per_hour',
+           'evaluations_per_second', 'mean_batch', 'latency_p50', 'latency_p99')
+
+print(' '.join(f'{column:>12.12}' for column in columns))
+
+for workers, worker_threads, worker_concurrency, evaluations in itertools.product(args.workers, args.worker_threads,
+                                                                                  args.worker_concurrency,
+                                                                                  args.evaluations):
+    config = Config(workers=workers,
+                    worker_threads=worker_threads,
+                    initial_state=initial_state,
+                    model=model,
+                    name='benchmark',
+                    worker_concurrency=worker_concurrency,
+                    evaluations=evaluations,
+                    leaves_per_tree=args.leaves_per_tree,
+                    inference_streams=args.inference_streams,
+                    native=not args.python,
+                    inference_precision=args.precision,
+                    gumbel_considered=args.gumbel,
+                    opening_book=args.book,
+                    symmetric=not args.asymmetric,
+                    search_timing=args.timing,
+                    max_turns=999)
+
+    result = benchmark(config, args.games)
+
+    print(' '.join(f'{result[column]:>12.4g}' if result[column] is not None else f'{"-":>12}'
+                   for column in columns))
+
+    if args.json is not None:
+        with open(args.json, 'a') as file:
+            file.write(json.dumps(dict(result, native=not args.python, stub=args.stub)) + '\n')
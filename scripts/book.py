@@ -0,0 +1,32 @@
+import argparse
+
+import numpy as np
+
+from alpha3 import ConnectK, Config
+from alpha3.models import ConvNet3x3
+from alpha3.train import opening_book
+
+# Builds an opening book of Connect Four for Config.opening_book, from a deep
+# search of the empty board with the given weights. For example,
+#
+#   python3 scripts/book.py c4.book --evaluations 200000 --plies 6
+#
+# saves the tree's top six plies to c4.book
+
+parser = argparse.ArgumentParser()
+parser.add_argument('path', help='file to write the book to')
+parser.add_argument('--weights', default='c4_c3x3_20000.h5')
+parser.add_argument('--evaluations', type=int, default=100000)
+parser.add_argument('--plies', type=int, default=6, help='depth of the tree saved')
+parser.add_argument('--batch', type=int, default=64, help='leaves evaluated at once')
+args = parser.parse_args()
+
+initial_state = ConnectK(6, 7, 4)
+
+model = ConvNet3x3(7)
+model(np.zeros((1, *initial_state.position().shape)))
+model.load_weights(args.weights)
+
+config = Config(workers=0, initial_state=initial_state, model=model, name='book')
+
+opening_book(config, args.path, args.plies, args.evaluations, args.batch)
@@ -1,6 +1,17 @@
 from distutils.core import setup, Extension
 
-a3mcts = Extension('alpha3.a3mcts', sources=['alpha3/a3mcts.cpp'])
+a3mcts = Extension('alpha3.a3mcts',
+                   sources=['alpha3/a3mcts.cpp'],
+                   depends=['alpha3/arena.h', 'alpha3/channel.h',
+                            'alpha3/connectk.h', 'alpha3/halving.h',
+                            'alpha3/inference.h',
+                            'alpha3/layout.h', 'alpha3/mcts.h', 'alpha3/puct.h',
+                            'alpha3/reclaim.h', 'alpha3/replay.h',
+                            'alpha3/runtime.h',
+                            'alpha3/selfplay.h', 'alpha3/sync.h',
+                            'alpha3/transposition.h', 'alpha3/treeimage.h'],
+                   extra_compile_args=['-std=c++17', '-pthread'],
+                   extra_link_args=['-pthread'])
 
 setup(name='alpha3',
       version='1.0.0',